@@ -0,0 +1,293 @@
+#include "Arduino.h"
+#include "NativeHal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+volatile uint32_t GPI = 0;
+volatile uint32_t GPO = 0;
+NativeGpioSetRegister GPOS;
+NativeGpioClearRegister GPOC;
+volatile uint32_t GP16I = 0;
+volatile uint32_t GP16O = 0;
+
+EspClass ESP;
+HardwareSerial Serial;
+
+static const uint8_t numPins = 17;
+
+struct Interrupt
+{
+	voidFuncPtrArg handler = nullptr;
+	void* arg = nullptr;
+	int mode = 0;
+};
+static Interrupt interruptHandlers[EXTERNAL_NUM_INTERRUPTS];
+static bool interruptsEnabled = true;
+static uint8_t pinModes[numPins] = {};
+
+static bool simulatedTime = false;
+static uint64_t simulatedMicros = 0;
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+
+static FILE* serialOutput = stdout;
+
+// the state of the boards not selected
+struct Board
+{
+	uint32_t gpi = 0;
+	uint32_t gpo = 0;
+	uint32_t gp16i = 0;
+	uint32_t gp16o = 0;
+	Interrupt interruptHandlers[EXTERNAL_NUM_INTERRUPTS];
+	bool interruptsEnabled = true;
+	uint8_t pinModes[numPins] = {};
+};
+static std::vector<Board> boards(1);
+static unsigned currentBoard = 0;
+
+
+void NativeGpioSetRegister::operator=(uint32_t mask)
+{
+	GPO |= mask;
+}
+
+void NativeGpioClearRegister::operator=(uint32_t mask)
+{
+	GPO &= ~mask;
+}
+
+
+uint64_t NativeHal::getMicros64()
+{
+	if (simulatedTime)
+		return simulatedMicros;
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void NativeHal::setMicros(uint64_t us)
+{
+	simulatedTime = true;
+	simulatedMicros = us;
+}
+
+void NativeHal::advanceMicros(uint64_t us)
+{
+	if (!simulatedTime)
+		setMicros(getMicros64());
+	simulatedMicros += us;
+}
+
+void NativeHal::useHostClock()
+{
+	simulatedTime = false;
+}
+
+void NativeHal::setInput(uint8_t pin, bool level)
+{
+	if (pin >= numPins)
+		return;
+
+	bool previous = getInput(pin);
+	if (16 == pin)
+		GP16I = level;
+	else if (level)
+		GPI |= 1UL << pin;
+	else
+		GPI &= ~(1UL << pin);
+
+	if (pin >= EXTERNAL_NUM_INTERRUPTS || previous == level || !interruptsEnabled)
+		return;
+
+	const Interrupt& i = interruptHandlers[pin];
+	if (!i.handler)
+		return;
+	if (CHANGE == i.mode || (RISING == i.mode && level) || (FALLING == i.mode && !level))
+		i.handler(i.arg);
+}
+
+bool NativeHal::getInput(uint8_t pin)
+{
+	if (16 == pin)
+		return GP16I & 1;
+	return pin < numPins && ((GPI >> pin) & 1);
+}
+
+bool NativeHal::getOutput(uint8_t pin)
+{
+	if (16 == pin)
+		return GP16O & 1;
+	return pin < numPins && ((GPO >> pin) & 1);
+}
+
+bool NativeHal::isInterruptAttached(uint8_t pin)
+{
+	return pin < EXTERNAL_NUM_INTERRUPTS && interruptHandlers[pin].handler;
+}
+
+bool NativeHal::getInterruptsEnabled()
+{
+	return interruptsEnabled;
+}
+
+void NativeHal::selectBoard(unsigned board)
+{
+	if (board == currentBoard)
+		return;
+
+	Board& saved = boards[currentBoard];
+	saved.gpi = GPI;
+	saved.gpo = GPO;
+	saved.gp16i = GP16I;
+	saved.gp16o = GP16O;
+	memcpy(saved.interruptHandlers, interruptHandlers, sizeof(interruptHandlers));
+	saved.interruptsEnabled = interruptsEnabled;
+	memcpy(saved.pinModes, pinModes, sizeof(pinModes));
+
+	if (board >= boards.size())
+		boards.resize(board + 1);
+	const Board& loaded = boards[board];
+	GPI = loaded.gpi;
+	GPO = loaded.gpo;
+	GP16I = loaded.gp16i;
+	GP16O = loaded.gp16o;
+	memcpy(interruptHandlers, loaded.interruptHandlers, sizeof(interruptHandlers));
+	interruptsEnabled = loaded.interruptsEnabled;
+	memcpy(pinModes, loaded.pinModes, sizeof(pinModes));
+	currentBoard = board;
+}
+
+unsigned NativeHal::getBoard()
+{
+	return currentBoard;
+}
+
+void NativeHal::setSerialOutput(FILE* file)
+{
+	serialOutput = file;
+}
+
+
+uint32_t millis()
+{
+	return NativeHal::getMicros64() / 1000;
+}
+
+uint32_t micros()
+{
+	return NativeHal::getMicros64();
+}
+
+void delay(unsigned long ms)
+{
+	if (simulatedTime)
+		simulatedMicros += ms * 1000ULL;
+	else
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	if (simulatedTime)
+		simulatedMicros += us;
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield()
+{
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin < numPins)
+		pinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	if (16 == pin)
+	{
+		if (value)
+			GP16O |= 1;
+		else
+			GP16O &= ~1;
+	}
+	else if (pin < numPins)
+	{
+		if (value)
+			GPOS = 1UL << pin;
+		else
+			GPOC = 1UL << pin;
+	}
+}
+
+int digitalRead(uint8_t pin)
+{
+	if (pin < numPins && OUTPUT == pinModes[pin])
+		return NativeHal::getOutput(pin);
+	return NativeHal::getInput(pin);
+}
+
+void attachInterrupt(uint8_t pin, voidFuncPtr handler, int mode)
+{
+	attachInterruptArg(pin, reinterpret_cast<voidFuncPtrArg>(handler), nullptr, mode);
+}
+
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void* arg, int mode)
+{
+	if (pin >= EXTERNAL_NUM_INTERRUPTS)
+		return;
+	interruptHandlers[pin].handler = handler;
+	interruptHandlers[pin].arg = arg;
+	interruptHandlers[pin].mode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+	if (pin < EXTERNAL_NUM_INTERRUPTS)
+		interruptHandlers[pin] = Interrupt();
+}
+
+void noInterrupts()
+{
+	interruptsEnabled = false;
+}
+
+void interrupts()
+{
+	interruptsEnabled = true;
+}
+
+
+uint32_t EspClass::getCycleCount()
+{
+	return NativeHal::getMicros64() * getCpuFreqMHz();
+}
+
+void EspClass::restart()
+{
+	exit(0);
+}
+
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	return serialOutput ? fwrite(&c, 1, 1, serialOutput) : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+	return serialOutput ? fwrite(buffer, 1, size, serialOutput) : size;
+}
+
+void HardwareSerial::flush()
+{
+	if (serialOutput)
+		fflush(serialOutput);
+}
@@ -0,0 +1,137 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// The part of the ESP8266 Arduino core used by the firmware, for host
+// builds (env:native). Pins, interrupts and time are simulated and
+// driven through NativeHal.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+
+#ifndef F_CPU
+#define F_CPU 160000000L
+#endif
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x00
+#define OUTPUT       0x01
+#define INPUT_PULLUP 0x02
+
+#define CHANGE  0x03
+#define FALLING 0x02
+#define RISING  0x01
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bit(b) (1UL << (b))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+// Wemos D1 mini pin names
+static const uint8_t D0 = 16;
+static const uint8_t D1 = 5;
+static const uint8_t D2 = 4;
+static const uint8_t D3 = 0;
+static const uint8_t D4 = 2;
+static const uint8_t D5 = 14;
+static const uint8_t D6 = 12;
+static const uint8_t D7 = 13;
+static const uint8_t D8 = 15;
+static const uint8_t LED_BUILTIN = 2;
+
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// GPIO16 can not raise interrupts
+#define EXTERNAL_NUM_INTERRUPTS 16
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (((p) < EXTERNAL_NUM_INTERRUPTS) ? (p) : NOT_AN_INTERRUPT)
+
+typedef void (*voidFuncPtr)(void);
+typedef void (*voidFuncPtrArg)(void*);
+void attachInterrupt(uint8_t pin, voidFuncPtr handler, int mode);
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void* arg, int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+// GPIO registers. GPOS and GPOC set and clear the bits written to them
+// in GPO, like the write-1-to-set/clear registers of the ESP8266.
+struct NativeGpioSetRegister
+{
+	void operator=(uint32_t mask);
+};
+struct NativeGpioClearRegister
+{
+	void operator=(uint32_t mask);
+};
+extern volatile uint32_t GPI;
+extern volatile uint32_t GPO;
+extern NativeGpioSetRegister GPOS;
+extern NativeGpioClearRegister GPOC;
+extern volatile uint32_t GP16I;
+extern volatile uint32_t GP16O;
+
+class EspClass
+{
+public:
+	// cycles of a 160MHz cpu, derived from micros()
+	uint32_t getCycleCount();
+	uint8_t getCpuFreqMHz() { return F_CPU / 1000000L; }
+	uint32_t getChipId() { return 0x00c0ffee; }
+	uint32_t getFreeHeap() { return 40000; }
+	void restart();
+};
+extern EspClass ESP;
+
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baud) {}
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+	void flush() override;
+	using Print::write;
+};
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef NATIVE_ESP8266WIFI_H
+#define NATIVE_ESP8266WIFI_H
+
+#include "Arduino.h"
+#include "Client.h"
+#include "IPAddress.h"
+
+// TCP client on a POSIX socket of the host
+class WiFiClient : public Client
+{
+public:
+	WiFiClient() {}
+	~WiFiClient() { stop(); }
+	WiFiClient(const WiFiClient&) = delete;
+	WiFiClient& operator=(const WiFiClient&) = delete;
+
+	int connect(IPAddress ip, uint16_t port) override;
+	int connect(const char* host, uint16_t port) override;
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t* buf, size_t size) override;
+	int available() override;
+	int read() override;
+	int read(uint8_t* buf, size_t size) override;
+	int peek() override;
+	void flush() override {}
+	void stop() override;
+	uint8_t connected() override;
+	operator bool() override { return connected(); }
+	using Print::write;
+
+	void setNoDelay(bool noDelay);
+
+private:
+	int fd = -1;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "FS.h"
+#include "LittleFS.h"
+
+#include <sys/stat.h>
+
+fs::FS LittleFS;
+
+namespace fs
+{
+
+File::File(FILE* f, const String& name) : handle(f, fclose), fileName(name)
+{
+}
+
+size_t File::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buf, size_t size)
+{
+	return handle ? fwrite(buf, 1, size, handle.get()) : 0;
+}
+
+int File::available()
+{
+	if (!handle)
+		return 0;
+	return size() - position();
+}
+
+int File::read()
+{
+	uint8_t c;
+	return 1 == read(&c, 1) ? c : -1;
+}
+
+int File::peek()
+{
+	if (!handle)
+		return -1;
+	int c = fgetc(handle.get());
+	if (c != EOF)
+		ungetc(c, handle.get());
+	return c == EOF ? -1 : c;
+}
+
+void File::flush()
+{
+	if (handle)
+		fflush(handle.get());
+}
+
+size_t File::read(uint8_t* buf, size_t size)
+{
+	return handle ? fread(buf, 1, size, handle.get()) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+	static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+	return handle && 0 == fseek(handle.get(), pos, whence[mode]);
+}
+
+size_t File::position() const
+{
+	return handle ? ftell(handle.get()) : 0;
+}
+
+size_t File::size() const
+{
+	struct stat st;
+	if (!handle || 0 != fstat(fileno(handle.get()), &st))
+		return 0;
+	return st.st_size;
+}
+
+
+String FS::hostPath(const String& path) const
+{
+	if (path.startsWith("/"))
+		return root + path;
+	return root + "/" + path;
+}
+
+File FS::open(const String& path, const char* mode)
+{
+	// the firmware uses "r", "w" and "a", open them as binary files
+	String hostMode(mode);
+	if (hostMode.indexOf('b') < 0)
+		hostMode += "b";
+
+	FILE* f = fopen(hostPath(path).c_str(), hostMode.c_str());
+	if (!f)
+		return File();
+	return File(f, path);
+}
+
+bool FS::exists(const String& path)
+{
+	struct stat st;
+	return 0 == stat(hostPath(path).c_str(), &st);
+}
+
+bool FS::remove(const String& path)
+{
+	return 0 == ::remove(hostPath(path).c_str());
+}
+
+bool FS::rename(const String& pathFrom, const String& pathTo)
+{
+	return 0 == ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str());
+}
+
+} // namespace fs
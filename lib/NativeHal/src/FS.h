@@ -0,0 +1,80 @@
+#ifndef NATIVE_FS_H
+#define NATIVE_FS_H
+
+#include <stdio.h>
+#include <memory>
+
+#include "Arduino.h"
+
+namespace fs
+{
+
+enum SeekMode
+{
+	SeekSet = 0,
+	SeekCur = 1,
+	SeekEnd = 2
+};
+
+// A file of the host file system
+class File : public Stream
+{
+public:
+	File() {}
+	File(FILE* f, const String& name);
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buf, size_t size) override;
+	int available() override;
+	int read() override;
+	int peek() override;
+	void flush() override;
+	using Print::write;
+
+	size_t read(uint8_t* buf, size_t size);
+	bool seek(uint32_t pos, SeekMode mode = SeekSet);
+	size_t position() const;
+	size_t size() const;
+	void close() { handle.reset(); }
+	const char* name() const { return fileName.c_str(); }
+	operator bool() const { return (bool)handle; }
+
+private:
+	std::shared_ptr<FILE> handle;
+	String fileName;
+};
+
+// The files below a directory of the host, paths of the firmware are
+// relative to it
+class FS
+{
+public:
+	FS(const String& root = ".") : root(root) {}
+
+	bool begin() { return true; }
+	void end() {}
+
+	void setRoot(const String& newRoot) { root = newRoot; }
+	const String& getRoot() const { return root; }
+
+	File open(const String& path, const char* mode);
+	bool exists(const String& path);
+	bool remove(const String& path);
+	bool rename(const String& pathFrom, const String& pathTo);
+
+private:
+	String hostPath(const String& path) const;
+
+	String root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
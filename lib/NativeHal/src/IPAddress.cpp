@@ -0,0 +1,24 @@
+#include "IPAddress.h"
+
+#include <stdio.h>
+
+bool IPAddress::fromString(const char* address)
+{
+	unsigned int a, b, c, d;
+	char end;
+	if (4 != sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) ||
+		a > 255 || b > 255 || c > 255 || d > 255)
+		return false;
+	bytes[0] = a;
+	bytes[1] = b;
+	bytes[2] = c;
+	bytes[3] = d;
+	return true;
+}
+
+String IPAddress::toString() const
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+	return String(buf);
+}
@@ -0,0 +1,35 @@
+#ifndef NATIVE_IPADDRESS_H
+#define NATIVE_IPADDRESS_H
+
+#include <stdint.h>
+
+#include "WString.h"
+
+class IPAddress
+{
+public:
+	IPAddress() {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+	{
+		bytes[0] = a;
+		bytes[1] = b;
+		bytes[2] = c;
+		bytes[3] = d;
+	}
+
+	uint8_t operator[](int index) const { return bytes[index]; }
+	uint8_t& operator[](int index) { return bytes[index]; }
+	bool operator==(const IPAddress& other) const
+	{
+		return bytes[0] == other.bytes[0] && bytes[1] == other.bytes[1] &&
+			bytes[2] == other.bytes[2] && bytes[3] == other.bytes[3];
+	}
+
+	bool fromString(const char* address);
+	String toString() const;
+
+private:
+	uint8_t bytes[4] = {};
+};
+
+#endif
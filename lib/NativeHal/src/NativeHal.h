@@ -0,0 +1,40 @@
+#ifndef NATIVE_HAL_H
+#define NATIVE_HAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Drives the simulated hardware of a host build. Input pins are set
+// here instead of by the wiring, and a level change raises the
+// interrupt attached to the pin like the GPIO block would.
+class NativeHal
+{
+public:
+	// input level of a pin as seen by digitalRead(), GPI and GP16I.
+	// Calls the attached interrupt handler on a matching edge while
+	// interrupts are enabled.
+	static void setInput(uint8_t pin, bool level);
+	static bool getInput(uint8_t pin);
+	// level written by digitalWrite(), GPOS/GPOC or GP16O
+	static bool getOutput(uint8_t pin);
+	static bool isInterruptAttached(uint8_t pin);
+	static bool getInterruptsEnabled();
+
+	// each board has its own pins, interrupt handlers and interrupt
+	// enable, so a program can run several firmwares side by side.
+	// Board 0 is selected at the start, the time is shared.
+	static void selectBoard(unsigned board);
+	static unsigned getBoard();
+
+	// where Serial writes to, stdout by default, nullptr discards
+	static void setSerialOutput(FILE* file);
+
+	// micros() follows the host clock until a simulated time is set,
+	// from then on it only moves with advanceMicros()
+	static void setMicros(uint64_t us);
+	static void advanceMicros(uint64_t us);
+	static void useHostClock();
+	static uint64_t getMicros64();
+};
+
+#endif
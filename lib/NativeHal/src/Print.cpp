@@ -0,0 +1,37 @@
+#include "Print.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t n = 0;
+	while (size--)
+	{
+		if (!write(*buffer++))
+			break;
+		++n;
+	}
+	return n;
+}
+
+size_t Print::printf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	char buf[64];
+	int len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (len < 0)
+		return 0;
+	if ((size_t)len < sizeof(buf))
+		return write((const uint8_t*)buf, len);
+
+	char* big = new char[len + 1];
+	va_start(args, format);
+	vsnprintf(big, len + 1, format, args);
+	va_end(args);
+	size_t n = write((const uint8_t*)big, len);
+	delete[] big;
+	return n;
+}
@@ -0,0 +1,20 @@
+#ifndef NATIVE_STREAM_H
+#define NATIVE_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+	unsigned long getTimeout() const { return timeout; }
+
+protected:
+	unsigned long timeout = 1000;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "WString.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <algorithm>
+
+static std::string toBase(unsigned long value, unsigned char base)
+{
+	if (base < 2 || base > 36)
+		base = 10;
+
+	char buf[8 * sizeof(value) + 1];
+	char* p = buf + sizeof(buf);
+	*--p = 0;
+	do
+	{
+		unsigned digit = value % base;
+		*--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	} while (value);
+	return p;
+}
+
+String::String(unsigned char value, unsigned char base) : str(toBase(value, base)) {}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+
+String::String(unsigned int value, unsigned char base) : str(toBase(value, base)) {}
+
+String::String(long value, unsigned char base)
+{
+	if (10 == base && value < 0)
+		str = "-" + toBase(-(unsigned long)value, base);
+	else
+		str = toBase(value, base);
+}
+
+String::String(unsigned long value, unsigned char base) : str(toBase(value, base)) {}
+
+String::String(float value, unsigned char decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned char decimals)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+	str = buf;
+}
+
+bool String::equalsIgnoreCase(const String& s) const
+{
+	return str.length() == s.str.length() && 0 == strcasecmp(str.c_str(), s.str.c_str());
+}
+
+bool String::startsWith(const String& prefix, unsigned int offset) const
+{
+	return offset + prefix.str.length() <= str.length() &&
+		0 == str.compare(offset, prefix.str.length(), prefix.str);
+}
+
+bool String::endsWith(const String& suffix) const
+{
+	return suffix.str.length() <= str.length() &&
+		0 == str.compare(str.length() - suffix.str.length(), suffix.str.length(), suffix.str);
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+	size_t pos = str.find(c, from);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String& s, unsigned int from) const
+{
+	size_t pos = str.find(s.str, from);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char c) const
+{
+	size_t pos = str.rfind(c);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(const String& s) const
+{
+	size_t pos = str.rfind(s.str);
+	return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+	if (beginIndex > endIndex)
+		std::swap(beginIndex, endIndex);
+	if (beginIndex >= str.length())
+		return String();
+	String s;
+	s.str = str.substr(beginIndex, endIndex - beginIndex);
+	return s;
+}
+
+void String::replace(char find, char replace)
+{
+	for (size_t i = 0; i < str.length(); ++i)
+	{
+		if (str[i] == find)
+			str[i] = replace;
+	}
+}
+
+void String::replace(const String& find, const String& replace)
+{
+	if (find.str.empty())
+		return;
+	size_t pos = 0;
+	while ((pos = str.find(find.str, pos)) != std::string::npos)
+	{
+		str.replace(pos, find.str.length(), replace.str);
+		pos += replace.str.length();
+	}
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+	if (index < str.length())
+		str.erase(index, count);
+}
+
+void String::toLowerCase()
+{
+	for (size_t i = 0; i < str.length(); ++i)
+		str[i] = tolower((unsigned char)str[i]);
+}
+
+void String::toUpperCase()
+{
+	for (size_t i = 0; i < str.length(); ++i)
+		str[i] = toupper((unsigned char)str[i]);
+}
+
+void String::trim()
+{
+	size_t begin = 0;
+	size_t end = str.length();
+	while (begin < end && isspace((unsigned char)str[begin]))
+		++begin;
+	while (end > begin && isspace((unsigned char)str[end - 1]))
+		--end;
+	str = str.substr(begin, end - begin);
+}
+
+long String::toInt() const
+{
+	return atol(str.c_str());
+}
+
+float String::toFloat() const
+{
+	return atof(str.c_str());
+}
+
+double String::toDouble() const
+{
+	return atof(str.c_str());
+}
+
+
+String operator+(const String& lhs, const String& rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String& lhs, const char* rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const char* lhs, const String& rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String& lhs, char rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, int rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, unsigned int rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, long rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, unsigned long rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, float rhs) { return lhs + String(rhs); }
+String operator+(const String& lhs, double rhs) { return lhs + String(rhs); }
@@ -0,0 +1,106 @@
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// The part of the Arduino String class used by the firmware
+class String
+{
+	// like the Arduino String, a String is true in an if() as long
+	// as it holds a buffer, even when it is empty
+	typedef void (String::*StringIfHelperType)() const;
+	void StringIfHelper() const {}
+
+public:
+	String() {}
+	String(const char* cstr) : str(cstr ? cstr : "") {}
+	String(const String& other) : str(other.str) {}
+	explicit String(char c) : str(1, c) {}
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	explicit String(float value, unsigned char decimals = 2);
+	explicit String(double value, unsigned char decimals = 2);
+
+	String& operator=(const String& rhs) { str = rhs.str; return *this; }
+	String& operator=(const char* cstr) { str = cstr ? cstr : ""; return *this; }
+
+	unsigned int length() const { return str.length(); }
+	bool isEmpty() const { return str.empty(); }
+	bool reserve(unsigned int size) { str.reserve(size); return true; }
+	const char* c_str() const { return str.c_str(); }
+	operator StringIfHelperType() const { return &String::StringIfHelper; }
+
+	bool concat(const String& s) { str += s.str; return true; }
+	bool concat(const char* cstr) { if (cstr) str += cstr; return true; }
+	bool concat(char c) { str += c; return true; }
+	bool concat(unsigned char n) { return concat(String(n)); }
+	bool concat(int n) { return concat(String(n)); }
+	bool concat(unsigned int n) { return concat(String(n)); }
+	bool concat(long n) { return concat(String(n)); }
+	bool concat(unsigned long n) { return concat(String(n)); }
+	bool concat(float n) { return concat(String(n)); }
+	bool concat(double n) { return concat(String(n)); }
+
+	template<typename T>
+	String& operator+=(T rhs) { concat(rhs); return *this; }
+	String& operator+=(const String& rhs) { concat(rhs); return *this; }
+
+	int compareTo(const String& s) const { return str.compare(s.str); }
+	bool equals(const String& s) const { return str == s.str; }
+	bool equals(const char* cstr) const { return str == (cstr ? cstr : ""); }
+	bool equalsIgnoreCase(const String& s) const;
+	bool startsWith(const String& prefix) const { return startsWith(prefix, 0); }
+	bool startsWith(const String& prefix, unsigned int offset) const;
+	bool endsWith(const String& suffix) const;
+
+	bool operator==(const String& rhs) const { return equals(rhs); }
+	bool operator==(const char* cstr) const { return equals(cstr); }
+	bool operator!=(const String& rhs) const { return !equals(rhs); }
+	bool operator!=(const char* cstr) const { return !equals(cstr); }
+	bool operator<(const String& rhs) const { return compareTo(rhs) < 0; }
+
+	char charAt(unsigned int index) const { return index < str.length() ? str[index] : 0; }
+	void setCharAt(unsigned int index, char c) { if (index < str.length()) str[index] = c; }
+	char operator[](unsigned int index) const { return charAt(index); }
+	char& operator[](unsigned int index) { return str[index]; }
+
+	int indexOf(char c, unsigned int from = 0) const;
+	int indexOf(const String& s, unsigned int from = 0) const;
+	int lastIndexOf(char c) const;
+	int lastIndexOf(const String& s) const;
+	String substring(unsigned int beginIndex) const { return substring(beginIndex, str.length()); }
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void replace(char find, char replace);
+	void replace(const String& find, const String& replace);
+	void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+	void remove(unsigned int index, unsigned int count);
+	void toLowerCase();
+	void toUpperCase();
+	void trim();
+
+	long toInt() const;
+	float toFloat() const;
+	double toDouble() const;
+
+private:
+	std::string str;
+};
+
+String operator+(const String& lhs, const String& rhs);
+String operator+(const String& lhs, const char* rhs);
+String operator+(const char* lhs, const String& rhs);
+String operator+(const String& lhs, char rhs);
+String operator+(const String& lhs, int rhs);
+String operator+(const String& lhs, unsigned int rhs);
+String operator+(const String& lhs, long rhs);
+String operator+(const String& lhs, unsigned long rhs);
+String operator+(const String& lhs, float rhs);
+String operator+(const String& lhs, double rhs);
+
+#endif
@@ -0,0 +1,121 @@
+#include "ESP8266WiFi.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+	return connect(ip.toString().c_str(), port);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port)
+{
+	stop();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* result = nullptr;
+	if (0 != getaddrinfo(host, String(port).c_str(), &hints, &result))
+		return 0;
+
+	for (addrinfo* ai = result; ai; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (0 == ::connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	return fd >= 0 ? 1 : 0;
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t size)
+{
+	size_t sent = 0;
+	while (fd >= 0 && sent < size)
+	{
+		ssize_t n = send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n <= 0)
+		{
+			stop();
+			break;
+		}
+		sent += n;
+	}
+	return sent;
+}
+
+int WiFiClient::available()
+{
+	int n = 0;
+	if (fd < 0 || 0 != ioctl(fd, FIONREAD, &n))
+		return 0;
+	return n;
+}
+
+int WiFiClient::read()
+{
+	uint8_t c;
+	return 1 == read(&c, 1) ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buf, size_t size)
+{
+	if (fd < 0)
+		return -1;
+	ssize_t n = recv(fd, buf, size, MSG_DONTWAIT);
+	if (0 == n)
+		stop();
+	return n > 0 ? n : -1;
+}
+
+int WiFiClient::peek()
+{
+	uint8_t c;
+	if (fd < 0 || 1 != recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT))
+		return -1;
+	return c;
+}
+
+void WiFiClient::stop()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
+
+uint8_t WiFiClient::connected()
+{
+	if (fd < 0)
+		return 0;
+
+	// the peer closed the connection once a read returns nothing
+	uint8_t c;
+	ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (0 == n || (n < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno))
+	{
+		stop();
+		return 0;
+	}
+	return 1;
+}
+
+void WiFiClient::setNoDelay(bool noDelay)
+{
+	int flag = noDelay;
+	if (fd >= 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
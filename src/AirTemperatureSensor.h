@@ -0,0 +1,21 @@
+#ifndef AIR_TEMPERATURE_SENSOR_H
+#define AIR_TEMPERATURE_SENSOR_H
+
+#include <stdint.h>
+
+// Sensor for the air temperature next to the spa, polled by SpaState
+class AirTemperatureSensor
+{
+public:
+	virtual ~AirTemperatureSensor() {}
+
+	virtual void begin() = 0;
+	virtual int getDeviceCount() = 0;
+
+	// starts a conversion, returns the milliseconds it takes
+	virtual uint32_t requestTemperature() = 0;
+	virtual bool isConversionComplete() = 0;
+	virtual float getTemperature(bool celsius) = 0;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stdint.h>
+
+// Fixed capacity queue for loop(), nothing is allocated. Elements can
+// be replaced and removed anywhere, the others keep their order. Meant
+// for a few elements, removing shifts the ones behind.
+template<typename T, uint8_t Capacity>
+class BoundedQueue
+{
+public:
+	// false if the queue is full
+	bool pushBack(const T& value)
+	{
+		if (count >= Capacity)
+			return false;
+		items[count++] = value;
+		return true;
+	}
+
+	bool pushFront(const T& value)
+	{
+		if (count >= Capacity)
+			return false;
+		for (uint8_t i = count; i > 0; --i)
+			items[i] = items[i - 1];
+		items[0] = value;
+		++count;
+		return true;
+	}
+
+	void removeAt(uint8_t index)
+	{
+		for (uint8_t i = index; i + 1 < count; ++i)
+			items[i] = items[i + 1];
+		--count;
+	}
+	void popFront() { removeAt(0); }
+
+	T& front() { return items[0]; }
+	T& operator[](uint8_t index) { return items[index]; }
+	const T& operator[](uint8_t index) const { return items[index]; }
+
+	uint8_t size() const { return count; }
+	bool empty() const { return 0 == count; }
+	bool full() const { return count >= Capacity; }
+	static uint8_t capacity() { return Capacity; }
+
+private:
+	T items[Capacity];
+	uint8_t count = 0;
+};
+
+#endif
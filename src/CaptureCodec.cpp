@@ -0,0 +1,236 @@
+#include "CaptureCodec.h"
+
+static void put16(uint8_t* buf, uint16_t value)
+{
+	buf[0] = value;
+	buf[1] = value >> 8;
+}
+
+static void put32(uint8_t* buf, uint32_t value)
+{
+	put16(buf, value);
+	put16(buf + 2, value >> 16);
+}
+
+static uint16_t get16(const uint8_t* buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* buf)
+{
+	return get16(buf) | ((uint32_t)get16(buf + 2) << 16);
+}
+
+static size_t putVarint(uint8_t* buf, uint32_t value)
+{
+	size_t size = 0;
+	while (value >= 0x80)
+	{
+		buf[size++] = value | 0x80;
+		value >>= 7;
+	}
+	buf[size++] = value;
+	return size;
+}
+
+void CaptureBlockHeader::encode(uint8_t* buf) const
+{
+	buf[0] = 'S';
+	buf[1] = 'B';
+	buf[2] = historyCount;
+	buf[3] = 0;
+	put32(buf + 4, micros);
+	put32(buf + 8, elapsed);
+	put32(buf + 12, elapsed >> 32);
+	put32(buf + 16, records);
+	for (uint8_t i = 0; i < FrameCapture::historySize; ++i)
+		put16(buf + 20 + 2 * i, i < historyCount ? history[i] : 0);
+}
+
+bool CaptureBlockHeader::decode(const uint8_t* buf)
+{
+	if (buf[0] != 'S' || buf[1] != 'B' || buf[2] > FrameCapture::historySize)
+		return false;
+	historyCount = buf[2];
+	micros = get32(buf + 4);
+	elapsed = get32(buf + 8) | ((uint64_t)get32(buf + 12) << 32);
+	records = get32(buf + 16);
+	for (uint8_t i = 0; i < FrameCapture::historySize; ++i)
+		history[i] = get16(buf + 20 + 2 * i);
+	return true;
+}
+
+
+bool CaptureEncoder::begin(CaptureSink* newSink)
+{
+	sink = newSink;
+	history = CaptureHistory();
+	records = 0;
+	decodedMicros = 0;
+	decodedElapsed = 0;
+	lastDistance = 0;
+	lastLiteral = false;
+	lastMicros = 0;
+	period = 0;
+	runCount = 0;
+	// the first entry starts the first block
+	blockUsed = FrameCapture::blockSize;
+
+	uint8_t header[FrameCapture::headerSize];
+	FrameCapture::encodeCompressedHeader(header);
+	ok = sink->write(header, sizeof(header));
+	bytes = ok ? sizeof(header) : 0;
+	return ok;
+}
+
+void CaptureEncoder::saveState(CaptureBlockHeader& header) const
+{
+	history.save(header);
+	header.micros = decodedMicros;
+	header.elapsed = decodedElapsed;
+	header.records = records;
+}
+
+bool CaptureEncoder::writeEntry(const uint8_t* entry, size_t size, const CaptureBlockHeader& header)
+{
+	if (!ok)
+		return false;
+
+	if (blockUsed + size > FrameCapture::blockSize)
+	{
+		// 0xFF ends the block, the rest of it is padding
+		uint8_t padding[16];
+		memset(padding, 0xFF, sizeof(padding));
+		for (size_t left = FrameCapture::blockSize - blockUsed; left > 0 && ok; )
+		{
+			size_t n = left < sizeof(padding) ? left : sizeof(padding);
+			ok = sink->write(padding, n);
+			left -= n;
+			bytes += n;
+		}
+
+		uint8_t buf[FrameCapture::blockHeaderSize];
+		header.encode(buf);
+		ok = ok && sink->write(buf, sizeof(buf));
+		bytes += sizeof(buf);
+		blockUsed = sizeof(buf);
+	}
+
+	ok = ok && sink->write(entry, size);
+	bytes += size;
+	blockUsed += size;
+	return ok;
+}
+
+bool CaptureEncoder::writeLiteral(const CaptureRecord& r, uint8_t distance)
+{
+	uint8_t entry[1 + 5 + 2 + 1];
+	size_t size = 1;
+	entry[0] = 0x40 | distance;
+	size += putVarint(entry + size, r.micros - decodedMicros);
+	if (0 == distance)
+	{
+		put16(entry + size, r.data);
+		size += 2;
+	}
+	if (FrameCapture::CAPTURE_FLAG_GAP == r.flags)
+	{
+		entry[0] |= 0x10;
+	}
+	else if (r.flags)
+	{
+		entry[0] |= 0x20;
+		entry[size++] = r.flags;
+	}
+
+	CaptureBlockHeader header;
+	saveState(header);
+	return writeEntry(entry, size, header);
+}
+
+bool CaptureEncoder::writeRun()
+{
+	uint8_t entry[1 + 5 + 5];
+	size_t size = 1;
+	entry[0] = runDistance;
+	size += putVarint(entry + size, runCount);
+	size += putVarint(entry + size, runPeriod);
+	runCount = 0;
+	return writeEntry(entry, size, runStart);
+}
+
+bool CaptureEncoder::add(const CaptureRecord& r)
+{
+	if (!ok)
+		return false;
+
+	uint32_t delta = r.micros - lastMicros;
+	if (records > 0 && delta < 0x10000 && (0 == period || delta < (period >> 7)))
+	{
+		// moving average of the frame period, without the pauses
+		int32_t error = (int32_t)(delta << 8) - (int32_t)period;
+		period = 0 == period ? delta << 8 : period + error / 32;
+	}
+	lastMicros = r.micros;
+
+	if (runCount > 0)
+	{
+		uint32_t expected = runStart.micros + runOffset(runCount + 1);
+		// never later than the original, so the delta of the next
+		// literal can not go backwards
+		if (0 == r.flags && history.get(runDistance) == r.data && runCount < maxRunRecords &&
+			r.micros - expected <= maxRunError)
+		{
+			++runCount;
+			history.push(r.data);
+			decodedMicros = expected;
+			decodedElapsed = runStart.elapsed + runOffset(runCount);
+			++records;
+			return true;
+		}
+		if (!writeRun())
+			return false;
+	}
+
+	// a run starts after a literal, the time of the record before the
+	// run is exact then
+	uint8_t distance = history.find(r.data);
+	if (0 == r.flags && distance && distance == lastDistance && lastLiteral && period > runPeriodMargin)
+	{
+		uint32_t expected = decodedMicros + ((period - runPeriodMargin + 128) >> 8);
+		if (r.micros - expected <= maxRunError)
+		{
+			saveState(runStart);
+			runCount = 1;
+			runDistance = distance;
+			runPeriod = period - runPeriodMargin;
+			lastLiteral = false;
+			history.push(r.data);
+			decodedMicros = runStart.micros + runOffset(1);
+			decodedElapsed = runStart.elapsed + runOffset(1);
+			++records;
+			return true;
+		}
+	}
+
+	if (!writeLiteral(r, distance))
+		return false;
+
+	uint32_t decodedDelta = r.micros - decodedMicros;
+	if (records > 0 && decodedDelta < 0x80000000UL)
+		decodedElapsed += decodedDelta;
+	decodedMicros = r.micros;
+	history.push(r.data);
+	lastDistance = distance;
+	lastLiteral = true;
+	++records;
+	return true;
+}
+
+bool CaptureEncoder::finish()
+{
+	if (runCount > 0)
+		writeRun();
+	return ok;
+}
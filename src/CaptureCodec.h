@@ -0,0 +1,474 @@
+#ifndef CAPTURE_CODEC_H
+#define CAPTURE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "FrameCapture.h"
+
+// Where the compressed capture goes, called with a few bytes at a time
+class CaptureSink
+{
+public:
+	virtual ~CaptureSink() {}
+	virtual bool write(const uint8_t* data, size_t size) = 0;
+};
+
+// State of the decoder at the start of a block
+struct CaptureBlockHeader
+{
+	uint8_t historyCount = 0;
+	uint32_t micros = 0;   // of the record before the block
+	uint64_t elapsed = 0;  // from the first record to that record
+	uint32_t records = 0;  // before the block
+	uint16_t history[FrameCapture::historySize] = {}; // latest first
+
+	void encode(uint8_t* buf) const;
+	bool decode(const uint8_t* buf);
+};
+
+// Keeps the frames of the last records so a repeated frame can refer to
+// the one it repeats
+class CaptureHistory
+{
+public:
+	void push(uint16_t frame)
+	{
+		latest = (latest + 1) % size;
+		frames[latest] = frame;
+		if (count < FrameCapture::historySize)
+			++count;
+	}
+	// the frame distance records back, 1 is the previous record
+	uint16_t get(uint8_t distance) const { return frames[(latest + size + 1 - distance) % size]; }
+	uint8_t getCount() const { return count; }
+
+	// smallest distance of a record with this frame, 0 if there is none
+	uint8_t find(uint16_t frame) const
+	{
+		for (uint8_t distance = 1; distance <= count; ++distance)
+		{
+			if (get(distance) == frame)
+				return distance;
+		}
+		return 0;
+	}
+
+	void save(CaptureBlockHeader& header) const
+	{
+		header.historyCount = count;
+		for (uint8_t distance = 1; distance <= count; ++distance)
+			header.history[distance - 1] = get(distance);
+	}
+
+	void load(const CaptureBlockHeader& header)
+	{
+		count = 0;
+		for (int distance = header.historyCount; distance >= 1; --distance)
+			push(header.history[distance - 1]);
+	}
+
+private:
+	static const uint8_t size = FrameCapture::historySize + 1;
+	uint16_t frames[size] = {};
+	uint8_t latest = 0;
+	uint8_t count = 0;
+};
+
+// Compresses capture records as they come, cheap enough for the latch
+// rate of the bus. A frame that repeats the frame of the same slot in
+// the previous scan cycle becomes part of a run while its time stays
+// close to the estimated frame period, everything else is a literal.
+class CaptureEncoder
+{
+public:
+	// largest difference of a time in a run to the original
+	static const uint32_t maxRunError = 1000;
+	// a run is written at the latest after this many records, the
+	// records of a run not written yet are lost when the power fails
+	static const uint32_t maxRunRecords = 1 << 20;
+
+	// writes the file header
+	bool begin(CaptureSink* sink);
+	bool add(const CaptureRecord& r);
+	// writes the pending run
+	bool finish();
+
+	uint32_t getRecordCount() const { return records; }
+	uint32_t getBytes() const { return bytes; }
+
+private:
+	// runs are half a micro faster than the estimated period, their
+	// times fall behind the original ones slowly instead of passing them
+	static const uint32_t runPeriodMargin = 128;
+
+	bool writeLiteral(const CaptureRecord& r, uint8_t distance);
+	bool writeRun();
+	bool writeEntry(const uint8_t* entry, size_t size, const CaptureBlockHeader& header);
+	uint32_t runOffset(uint32_t n) const { return ((uint64_t)n * runPeriod + 128) >> 8; }
+	void saveState(CaptureBlockHeader& header) const;
+
+	CaptureSink* sink = nullptr;
+	bool ok = false;
+	uint32_t bytes = 0;
+	uint32_t blockUsed = 0;
+	uint32_t records = 0;
+
+	CaptureHistory history;
+	uint32_t decodedMicros = 0;  // time the decoder gives the last record
+	uint64_t decodedElapsed = 0;
+	uint8_t lastDistance = 0;    // the last literal repeated the frame this far back
+	bool lastLiteral = false;    // the last record was a literal
+
+	uint32_t lastMicros = 0;     // original time of the last record
+	uint32_t period = 0;         // estimated frame period, 1/256 micros
+
+	uint32_t runCount = 0;
+	uint8_t runDistance = 0;
+	uint32_t runPeriod = 0;
+	CaptureBlockHeader runStart; // the state before the run
+};
+
+// Reads capture files of both versions. Reader has int read() that
+// returns -1 at the end, bool seek(uint32_t) and size_t size().
+template<class Reader>
+class CaptureDecoder
+{
+public:
+	CaptureDecoder(Reader& reader) : reader(reader) {}
+
+	// reads the file header
+	bool begin();
+	bool isCompressed() const { return compressed; }
+
+	// the next record, false at the end of the capture
+	bool next(CaptureRecord& r);
+	// the next record of the current block, false at its end
+	bool nextInBlock(CaptureRecord& r);
+
+	// micros from the first record to the last one returned
+	uint64_t getElapsed() const { return elapsed; }
+	// records returned and skipped so far
+	uint32_t getRecordIndex() const { return recordIndex; }
+
+	// compressed captures only
+	uint32_t getBlockCount() const;
+	bool seekBlock(uint32_t block);
+	const CaptureBlockHeader& getBlockHeader() const { return blockHeader; }
+
+	// moves to the first record at least elapsedMicros after the first
+	// one, the block is found by a binary search over the block headers
+	bool seek(uint64_t elapsedMicros);
+
+private:
+	int readByte();
+	bool readVarint(uint32_t& value);
+	bool readBlockHeader(uint32_t block, CaptureBlockHeader& header);
+	void produce(uint16_t frame, uint32_t delta, uint8_t flags, CaptureRecord& r);
+
+	Reader& reader;
+	bool compressed = false;
+	bool started = false;
+
+	uint32_t block = 0;
+	uint32_t blockPos = 0;
+	bool blockEnded = true;
+	CaptureBlockHeader blockHeader;
+
+	CaptureHistory history;
+	uint32_t micros = 0;
+	uint64_t elapsed = 0;
+	uint32_t recordIndex = 0;
+
+	uint32_t runLeft = 0;
+	uint32_t runDone = 0;
+	uint8_t runDistance = 0;
+	uint32_t runPeriod = 0;
+	uint32_t runMicros = 0;
+	uint64_t runElapsed = 0;
+
+	bool pendingValid = false;
+	CaptureRecord pending = {};
+};
+
+
+template<class Reader>
+bool CaptureDecoder<Reader>::begin()
+{
+	uint8_t header[FrameCapture::headerSize];
+	if (!reader.seek(0))
+		return false;
+	for (size_t i = 0; i < sizeof(header); ++i)
+	{
+		int b = reader.read();
+		if (b < 0)
+			return false;
+		header[i] = b;
+	}
+
+	compressed = FrameCapture::decodeCompressedHeader(header);
+	if (!compressed && !FrameCapture::decodeHeader(header))
+		return false;
+
+	started = false;
+	recordIndex = 0;
+	elapsed = 0;
+	pendingValid = false;
+	block = 0;
+	blockEnded = true;
+	// a compressed capture without records has no blocks
+	return !compressed || 0 == getBlockCount() || seekBlock(0);
+}
+
+template<class Reader>
+int CaptureDecoder<Reader>::readByte()
+{
+	int b = reader.read();
+	if (b >= 0)
+		++blockPos;
+	return b;
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::readVarint(uint32_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		int b = readByte();
+		if (b < 0)
+			return false;
+		value |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+template<class Reader>
+uint32_t CaptureDecoder<Reader>::getBlockCount() const
+{
+	size_t size = reader.size();
+	if (!compressed || size <= FrameCapture::headerSize)
+		return 0;
+	return (size - FrameCapture::headerSize + FrameCapture::blockSize - 1) / FrameCapture::blockSize;
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::readBlockHeader(uint32_t index, CaptureBlockHeader& header)
+{
+	uint8_t buf[FrameCapture::blockHeaderSize];
+	if (!reader.seek(FrameCapture::headerSize + index * FrameCapture::blockSize))
+		return false;
+	for (size_t i = 0; i < sizeof(buf); ++i)
+	{
+		int b = reader.read();
+		if (b < 0)
+			return false;
+		buf[i] = b;
+	}
+	return header.decode(buf);
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::seekBlock(uint32_t index)
+{
+	runLeft = 0;
+	pendingValid = false;
+	blockEnded = true;
+	if (!compressed || index >= getBlockCount() || !readBlockHeader(index, blockHeader))
+		return false;
+
+	block = index;
+	blockPos = FrameCapture::blockHeaderSize;
+	blockEnded = false;
+	history.load(blockHeader);
+	micros = blockHeader.micros;
+	elapsed = blockHeader.elapsed;
+	recordIndex = blockHeader.records;
+	// the first record of the capture has no record before it
+	started = blockHeader.records > 0;
+	return true;
+}
+
+template<class Reader>
+void CaptureDecoder<Reader>::produce(uint16_t frame, uint32_t delta, uint8_t flags, CaptureRecord& r)
+{
+	if (started && delta < 0x80000000UL)
+		elapsed += delta;
+	started = true;
+	micros += delta;
+	history.push(frame);
+	++recordIndex;
+	r.micros = micros;
+	r.data = frame;
+	r.flags = flags;
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::nextInBlock(CaptureRecord& r)
+{
+	if (pendingValid)
+	{
+		r = pending;
+		pendingValid = false;
+		return true;
+	}
+
+	if (!compressed)
+	{
+		uint8_t buf[FrameCapture::recordSize];
+		for (size_t i = 0; i < sizeof(buf); ++i)
+		{
+			int b = reader.read();
+			if (b < 0)
+				return false;
+			buf[i] = b;
+		}
+		CaptureRecord record;
+		FrameCapture::decodeRecord(buf, record);
+		uint32_t delta = recordIndex > 0 ? record.micros - micros : 0;
+		micros = record.micros - delta;
+		produce(record.data, delta, record.flags, r);
+		return true;
+	}
+
+	if (runLeft > 0)
+	{
+		--runLeft;
+		++runDone;
+		uint32_t offset = ((uint64_t)runDone * runPeriod + 128) >> 8;
+		uint32_t time = runMicros + offset;
+		produce(history.get(runDistance), time - micros, 0, r);
+		// the times of a run are relative to the record before it
+		elapsed = runElapsed + offset;
+		return true;
+	}
+
+	if (blockEnded || blockPos >= FrameCapture::blockSize)
+	{
+		blockEnded = true;
+		return false;
+	}
+
+	int tag = readByte();
+	if (tag < 0 || 0xFF == tag)
+	{
+		blockEnded = true;
+		return false;
+	}
+
+	uint8_t distance = tag & 0x0F;
+	if ((tag & 0xC0) == 0x00)
+	{
+		uint32_t count;
+		if (0 == distance || distance > history.getCount() || !readVarint(count) || !readVarint(runPeriod) || 0 == count)
+		{
+			blockEnded = true;
+			return false;
+		}
+		runLeft = count;
+		runDone = 0;
+		runDistance = distance;
+		runMicros = micros;
+		runElapsed = elapsed;
+		return nextInBlock(r);
+	}
+
+	uint32_t delta;
+	if ((tag & 0xC0) != 0x40 || distance > history.getCount() || !readVarint(delta))
+	{
+		blockEnded = true;
+		return false;
+	}
+
+	uint16_t frame;
+	if (distance)
+	{
+		frame = history.get(distance);
+	}
+	else
+	{
+		int lo = readByte();
+		int hi = readByte();
+		if (lo < 0 || hi < 0)
+		{
+			blockEnded = true;
+			return false;
+		}
+		frame = lo | (hi << 8);
+	}
+
+	uint8_t flags = (tag & 0x10) ? FrameCapture::CAPTURE_FLAG_GAP : 0;
+	if (tag & 0x20)
+	{
+		int b = readByte();
+		if (b < 0)
+		{
+			blockEnded = true;
+			return false;
+		}
+		flags = b;
+	}
+
+	produce(frame, delta, flags, r);
+	return true;
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::next(CaptureRecord& r)
+{
+	if (nextInBlock(r))
+		return true;
+	while (compressed && block + 1 < getBlockCount())
+	{
+		if (!seekBlock(block + 1))
+			return false;
+		if (nextInBlock(r))
+			return true;
+	}
+	return false;
+}
+
+template<class Reader>
+bool CaptureDecoder<Reader>::seek(uint64_t elapsedMicros)
+{
+	if (compressed)
+	{
+		// the last block that starts before the time
+		uint32_t lo = 0;
+		uint32_t hi = getBlockCount();
+		CaptureBlockHeader header;
+		while (hi - lo > 1)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (!readBlockHeader(mid, header))
+				return false;
+			if (header.elapsed < elapsedMicros)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if (!seekBlock(lo))
+			return false;
+	}
+	else if (!begin())
+	{
+		return false;
+	}
+
+	CaptureRecord r;
+	while (next(r))
+	{
+		if (elapsed >= elapsedMicros)
+		{
+			pending = r;
+			pendingValid = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
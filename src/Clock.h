@@ -0,0 +1,47 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+
+// Time source of the timers in loop(). The display bus keeps using the
+// cpu cycle counter, the clock is for delays, timeouts and polling.
+class Clock
+{
+public:
+	virtual ~Clock() {}
+	virtual uint32_t millis() = 0;
+};
+
+// millis() of the Arduino core
+class SystemClock : public Clock
+{
+public:
+	virtual uint32_t millis() override { return ::millis(); }
+
+	static SystemClock& instance()
+	{
+		static SystemClock clock;
+		return clock;
+	}
+};
+
+// Time that only moves when it is advanced, so a host program can run
+// hours of loop() calls in seconds and start close to the wraparound
+// of millis().
+class VirtualClock : public Clock
+{
+public:
+	VirtualClock(uint64_t startMS = 0) : nowMS(startMS) {}
+
+	virtual uint32_t millis() override { return nowMS; }
+
+	void advance(uint32_t ms) { nowMS += ms; }
+	void set(uint64_t ms) { nowMS = ms; }
+	// milliseconds since the start, without wraparound
+	uint64_t get() const { return nowMS; }
+
+private:
+	uint64_t nowMS;
+};
+
+#endif
@@ -0,0 +1,354 @@
+#include "CommandBenchmark.h"
+#include "SpaState.h"
+#include "Log.h"
+
+extern Log logger;
+
+bool CommandBenchmark::start(const Config& newConfig, uint32_t nowMS)
+{
+	uint32_t cellCount = 0;
+	for (int i = 0; i < CommandTiming::TYPE_COUNT; ++i)
+	{
+		if (!(newConfig.types & (1 << i)))
+			continue;
+		for (uint8_t d = 0; d < newConfig.delays.count; ++d)
+		{
+			for (uint8_t t = 0; t < newConfig.timeouts.count; ++t)
+			{
+				if (isSwept(newConfig, (Type)i, d, t))
+					++cellCount;
+			}
+		}
+	}
+	if (0 == cellCount || cellCount > maxCells || 0 == newConfig.tries)
+		return false;
+
+	config = newConfig;
+	cells.clear();
+	cells.reserve(cellCount);
+	for (int i = 0; i < CommandTiming::TYPE_COUNT; ++i)
+		histograms[i].reset();
+	cellHistogram.reset();
+	tries = 0;
+	failed = 0;
+	delayIndex = 0;
+	timeoutIndex = 0;
+	type = CommandTiming::TYPE_POWER;
+	while (!(config.types & (1 << type)))
+		type = (Type)(type + 1);
+
+	phase = PHASE_PREPARE;
+	phaseStartMS = nowMS;
+	running = true;
+	logger.addLine("Benchmark started: " + String(cellCount) + " settings, " + String(config.tries) + " tries each");
+	return true;
+}
+
+void CommandBenchmark::stop()
+{
+	if (!running)
+		return;
+	running = false;
+	logger.addLine("Benchmark stopped");
+}
+
+// A delay only takes effect where it is longer than the timeout, a
+// switch press is retried after the longer of the two. A temperature
+// step waits for the setting mode longer than any delay, it is only
+// swept over the timeouts. The other cells would measure the same as
+// the first delay of their timeout.
+bool CommandBenchmark::isSwept(const Config& config, Type type, uint8_t delayIndex, uint8_t timeoutIndex)
+{
+	if (0 == delayIndex)
+		return true;
+	if (CommandTiming::TYPE_TEMPERATURE == type)
+		return false;
+	return config.delays.start + delayIndex * config.delays.step >
+		config.timeouts.start + timeoutIndex * config.timeouts.step;
+}
+
+bool CommandBenchmark::nextCell()
+{
+	do
+	{
+		if (!advanceCell())
+			return false;
+	} while (!isSwept(config, type, delayIndex, timeoutIndex));
+	return true;
+}
+
+bool CommandBenchmark::advanceCell()
+{
+	if (++timeoutIndex < config.timeouts.count)
+		return true;
+	timeoutIndex = 0;
+	if (++delayIndex < config.delays.count)
+		return true;
+	delayIndex = 0;
+	for (int next = type + 1; next < CommandTiming::TYPE_COUNT; ++next)
+	{
+		if (config.types & (1 << next))
+		{
+			type = (Type)next;
+			return true;
+		}
+	}
+	return false;
+}
+
+void CommandBenchmark::finishCell()
+{
+	Cell cell;
+	cell.type = type;
+	cell.delay = config.delays.start + delayIndex * config.delays.step;
+	cell.timeout = config.timeouts.start + timeoutIndex * config.timeouts.step;
+	cell.tries = tries;
+	cell.failed = failed;
+	cell.min = cellHistogram.getMin();
+	cell.average = cellHistogram.getAverage();
+	cell.p50 = cellHistogram.getPercentile(50);
+	cell.p95 = cellHistogram.getPercentile(95);
+	cell.p99 = cellHistogram.getPercentile(99);
+	cell.max = cellHistogram.getMax();
+	cells.push_back(cell);
+
+	logger.addLine("Benchmark " + String(CommandTiming::getTypeName(type)) + " delay " + String(cell.delay) +
+		" timeout " + String(cell.timeout) + ": " + String(tries - failed) + "/" + String(tries) +
+		" ok, p50 " + String(cell.p50) + " p95 " + String(cell.p95) + " max " + String(cell.max) + " ms");
+
+	cellHistogram.reset();
+	tries = 0;
+	failed = 0;
+}
+
+bool CommandBenchmark::matches(SpaState& state) const
+{
+	switch (type)
+	{
+	case CommandTiming::TYPE_POWER:
+		return state.getPowerEnabled() == expectedBool;
+	case CommandTiming::TYPE_HEATING:
+		return state.getHeatingEnabled() == expectedBool;
+	case CommandTiming::TYPE_FILTER:
+		return state.getFilterEnabled() == expectedBool;
+	case CommandTiming::TYPE_BUBBLES:
+		return state.getBubblesEnabled() == expectedBool;
+	case CommandTiming::TYPE_TEMPERATURE:
+		return state.getTargetTemperature() == expectedInt;
+	case CommandTiming::TYPE_UNITS:
+		return state.getIsTempInC() == expectedBool;
+	default:
+		return false;
+	}
+}
+
+void CommandBenchmark::send(SpaState& state)
+{
+	SpaState::Command::CommandType commandType = SpaState::Command::COMMAND_NONE;
+	bool isInt = false;
+	switch (type)
+	{
+	case CommandTiming::TYPE_POWER:
+		commandType = SpaState::Command::COMMAND_SET_POWER;
+		expectedBool = !state.getPowerEnabled();
+		break;
+	case CommandTiming::TYPE_HEATING:
+		commandType = SpaState::Command::COMMAND_SET_HEATING;
+		expectedBool = !state.getHeatingEnabled();
+		break;
+	case CommandTiming::TYPE_FILTER:
+		commandType = SpaState::Command::COMMAND_SET_FILTER;
+		expectedBool = !state.getFilterEnabled();
+		break;
+	case CommandTiming::TYPE_BUBBLES:
+		commandType = SpaState::Command::COMMAND_SET_BUBBLES;
+		expectedBool = !state.getBubblesEnabled();
+		break;
+	case CommandTiming::TYPE_TEMPERATURE:
+	{
+		// one step, up and down in turns within the range of the spa
+		commandType = SpaState::Command::COMMAND_SET_TEMPERATURE;
+		int current = state.getTargetTemperature();
+		int minTemp = SpaProtocol::minTemperature(state.getIsTempInC());
+		int maxTemp = SpaProtocol::maxTemperature(state.getIsTempInC());
+		expectedInt = current % 2 == 0 ? current + 1 : current - 1;
+		if (expectedInt > maxTemp)
+			expectedInt = current - 1;
+		else if (expectedInt < minTemp)
+			expectedInt = current + 1;
+		isInt = true;
+		break;
+	}
+	case CommandTiming::TYPE_UNITS:
+		commandType = SpaState::Command::COMMAND_SET_UNITS;
+		expectedBool = !state.getIsTempInC();
+		break;
+	default:
+		break;
+	}
+
+	SpaState::Command command = isInt ?
+		SpaState::Command(commandType, expectedInt) : SpaState::Command(commandType, expectedBool);
+	command.setTiming(config.delays.start + delayIndex * config.delays.step,
+		config.timeouts.start + timeoutIndex * config.timeouts.step);
+	state.queueCommand(command);
+}
+
+void CommandBenchmark::loop(SpaState& state, uint32_t nowMS)
+{
+	if (!running)
+		return;
+
+	switch (phase)
+	{
+	case PHASE_PREPARE:
+		// the commands of the user go first
+		if (!state.commands.empty() || state.reconciler.isRunning())
+			return;
+		if (CommandTiming::TYPE_POWER != type && !state.getPowerEnabled())
+		{
+			if (nowMS - phaseStartMS > config.tryTimeoutMS)
+			{
+				logger.addLine("Benchmark stopped, the spa does not power on");
+				running = false;
+				return;
+			}
+			state.setPowerEnabled(true);
+			return;
+		}
+		send(state);
+		phase = PHASE_WAIT;
+		phaseStartMS = nowMS;
+		break;
+
+	case PHASE_WAIT:
+	{
+		uint32_t elapsed = nowMS - phaseStartMS;
+		if (matches(state))
+		{
+			cellHistogram.record(elapsed);
+			histograms[type].record(elapsed);
+		}
+		else if (elapsed >= config.tryTimeoutMS || state.commands.empty())
+		{
+			// the command gave up or never got its turn
+			++failed;
+		}
+		else
+		{
+			return;
+		}
+		++tries;
+		phase = PHASE_SETTLE;
+		phaseStartMS = nowMS;
+		break;
+	}
+
+	case PHASE_SETTLE:
+	{
+		bool temperature = CommandTiming::TYPE_TEMPERATURE == type || CommandTiming::TYPE_UNITS == type;
+		if (nowMS - phaseStartMS < (temperature ? config.temperatureSettleMS : config.settleMS))
+			return;
+		if (tries >= config.tries)
+		{
+			finishCell();
+			if (!nextCell())
+			{
+				running = false;
+				logger.addLine("Benchmark finished");
+				return;
+			}
+		}
+		phase = PHASE_PREPARE;
+		phaseStartMS = nowMS;
+		break;
+	}
+	}
+}
+
+String CommandBenchmark::toJson() const
+{
+	String str = "{\"running\":";
+	str += running ? "true" : "false";
+	str += ",\"tries\":" + String(config.tries);
+	str += ",\"cells\":[";
+	uint32_t failedByType[CommandTiming::TYPE_COUNT] = {};
+	for (size_t i = 0; i < cells.size(); ++i)
+	{
+		const Cell& c = cells[i];
+		failedByType[c.type] += c.failed;
+		if (i > 0)
+			str += ",";
+		str += "{\"command\":\"";
+		str += CommandTiming::getTypeName(c.type);
+		str += "\",\"delay\":" + String(c.delay);
+		str += ",\"timeout\":" + String(c.timeout);
+		str += ",\"tries\":" + String(c.tries);
+		str += ",\"failed\":" + String(c.failed);
+		str += ",\"failure_rate\":" + String(c.tries ? (float)c.failed / c.tries : 0.f, 3);
+		str += ",\"min\":" + String(c.min);
+		str += ",\"avg\":" + String(c.average);
+		str += ",\"p50\":" + String(c.p50);
+		str += ",\"p95\":" + String(c.p95);
+		str += ",\"p99\":" + String(c.p99);
+		str += ",\"max\":" + String(c.max);
+		str += "}";
+	}
+	str += "],\"commands\":{";
+	bool first = true;
+	for (int t = 0; t < CommandTiming::TYPE_COUNT; ++t)
+	{
+		if (!(config.types & (1 << t)))
+			continue;
+		const LatencyHistogram& h = histograms[t];
+		if (!first)
+			str += ",";
+		first = false;
+		str += "\"";
+		str += CommandTiming::getTypeName((Type)t);
+		str += "\":{\"count\":" + String(h.getCount());
+		str += ",\"failed\":" + String(failedByType[t]);
+		str += ",\"p50\":" + String(h.getPercentile(50));
+		str += ",\"p95\":" + String(h.getPercentile(95));
+		str += ",\"p99\":" + String(h.getPercentile(99));
+		str += ",\"max\":" + String(h.getMax());
+		// [upper bound, count] of the buckets in use
+		str += ",\"histogram\":[";
+		bool firstBucket = true;
+		for (uint8_t i = 0; i < LatencyHistogram::numBuckets; ++i)
+		{
+			if (0 == h.getBucketCount(i))
+				continue;
+			if (!firstBucket)
+				str += ",";
+			firstBucket = false;
+			str += "[" + String(LatencyHistogram::getBucketUpperBound(i)) + "," + String(h.getBucketCount(i)) + "]";
+		}
+		str += "]}";
+	}
+	str += "}}";
+	return str;
+}
+
+uint8_t CommandBenchmark::parseTypes(const String& names)
+{
+	uint8_t types = 0;
+	int from = 0;
+	while (from <= (int)names.length())
+	{
+		int comma = names.indexOf(',', from);
+		if (comma < 0)
+			comma = names.length();
+		String name = names.substring(from, comma);
+		name.trim();
+		if (name == "all")
+			types = (1 << CommandTiming::TYPE_COUNT) - 1;
+		for (int t = 0; t < CommandTiming::TYPE_COUNT; ++t)
+		{
+			if (name == CommandTiming::getTypeName((Type)t))
+				types |= 1 << t;
+		}
+		from = comma + 1;
+	}
+	return types;
+}
@@ -0,0 +1,110 @@
+#ifndef COMMAND_BENCHMARK_H
+#define COMMAND_BENCHMARK_H
+
+#include <Arduino.h>
+#include <vector>
+
+#include "CommandTiming.h"
+#include "LatencyStats.h"
+
+class SpaState;
+
+// Measures how long the commands take until the display shows the new
+// value. For every command type it sweeps the delay between button
+// presses and the time a press waits for the display, sends a number of
+// tries with each setting and keeps the latency percentiles and the
+// failure rate. Settings where the delay has no effect are left out.
+// Latencies are in ms.
+class CommandBenchmark
+{
+public:
+	// the types the timing is learned for, named by CommandTiming::getTypeName()
+	typedef CommandTiming::Type Type;
+
+	// delay and timeout values are start + i * step for i < count
+	struct Sweep
+	{
+		uint32_t start;
+		uint32_t step;
+		uint8_t count;
+	};
+
+	struct Config
+	{
+		uint8_t types = (1 << CommandTiming::TYPE_COUNT) - 1; // bit per Type
+		uint8_t tries = 10;                    // per delay and timeout
+		Sweep delays = { 0, 150, 4 };
+		Sweep timeouts = { 200, 200, 3 };
+		uint32_t settleMS = 1000;              // after each try
+		uint32_t temperatureSettleMS = 6000;   // the display shows the target that long
+		uint32_t tryTimeoutMS = 20000;         // a try fails after this
+	};
+
+	// results of one command type, delay and timeout
+	struct Cell
+	{
+		Type type;
+		uint32_t delay;
+		uint32_t timeout;
+		uint8_t tries;
+		uint8_t failed;
+		uint32_t min;
+		uint32_t average;
+		uint32_t p50;
+		uint32_t p95;
+		uint32_t p99;
+		uint32_t max;
+	};
+
+	// sweeps larger than this are refused, the results stay in RAM
+	static const uint16_t maxCells = 128;
+
+	bool start(const Config& config, uint32_t nowMS);
+	void stop();
+	bool isRunning() const { return running; }
+
+	// advances the benchmark, called from SpaState::loop()
+	void loop(SpaState& state, uint32_t nowMS);
+
+	const std::vector<Cell>& getCells() const { return cells; }
+	const LatencyHistogram& getHistogram(Type type) const { return histograms[type]; }
+	String toJson() const;
+
+	// comma separated type names or "all" to a Config::types mask
+	static uint8_t parseTypes(const String& names);
+
+private:
+	enum Phase
+	{
+		PHASE_PREPARE, // waits for a free queue and powers the spa on, then sends
+		PHASE_WAIT,    // for the display to show the value
+		PHASE_SETTLE
+	};
+
+	void send(SpaState& state);
+	// false for a cell that measures the same as one before it
+	static bool isSwept(const Config& config, Type type, uint8_t delayIndex, uint8_t timeoutIndex);
+	bool nextCell();
+	bool advanceCell();
+	void finishCell();
+	bool matches(SpaState& state) const;
+
+	Config config;
+	bool running = false;
+	Phase phase = PHASE_PREPARE;
+	uint32_t phaseStartMS = 0;
+
+	Type type = CommandTiming::TYPE_POWER;
+	uint8_t delayIndex = 0;
+	uint8_t timeoutIndex = 0;
+	uint8_t tries = 0;
+	uint8_t failed = 0;
+	bool expectedBool = false;
+	int expectedInt = 0;
+
+	LatencyHistogram cellHistogram;
+	LatencyHistogram histograms[CommandTiming::TYPE_COUNT];
+	std::vector<Cell> cells;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "CommandTiming.h"
+#include "SpaProtocol.h"
+
+// measured on a SB-H10:
+// power: 200 timeout, 500 delay
+// C/F:  500 timeout 300 delay
+// set temp: 550 timeout, 0 delay
+// the others: 600 timeout, 600 delay
+static const struct { uint32_t timeout; uint32_t delay; } defaults[CommandTiming::TYPE_COUNT] = {
+	{ 200, 500 }, // power
+	{ 600, 600 }, // heating
+	{ 600, 600 }, // filter
+	{ 600, 600 }, // bubbles
+	{ 550, 0 },   // temperature
+	{ 500, 300 }  // units
+};
+
+static uint32_t clamp(uint32_t value, uint32_t low, uint32_t high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+void CommandTiming::reset()
+{
+	for (int i = 0; i < TYPE_COUNT; ++i)
+	{
+		entries[i] = Entry();
+		entries[i].timeout = defaults[i].timeout;
+		entries[i].delay = defaults[i].delay;
+	}
+	pressCycles = defaultPressCycles;
+	pressFloor = minPressCycles;
+	pressStreak = 0;
+	dirty = true;
+}
+
+void CommandTiming::recordLatency(Type type, uint32_t ms)
+{
+	Entry& e = entries[type];
+	if (0 == e.samples)
+	{
+		e.latency = ms;
+		e.deviation = ms / 2;
+		e.maxLatency = ms;
+	}
+	else
+	{
+		uint32_t difference = e.latency > ms ? e.latency - ms : ms - e.latency;
+		e.deviation = (3 * e.deviation + difference) / 4;
+		e.latency = (7 * e.latency + ms) / 8;
+		e.maxLatency -= e.maxLatency / 16;
+		if (ms > e.maxLatency)
+			e.maxLatency = ms;
+	}
+	++e.samples;
+	update(type);
+
+	++pressStreak;
+	if (0 == pressStreak % pressProbeStreak && pressCycles > pressFloor)
+		--pressCycles;
+	if (pressStreak >= pressFloorStreak)
+	{
+		// the loss that raised the floor is long ago
+		if (pressFloor > minPressCycles)
+			--pressFloor;
+		pressStreak = 0;
+	}
+	dirty = true;
+}
+
+void CommandTiming::recordLoss(Type type)
+{
+	Entry& e = entries[type];
+	e.timeout = e.timeout * 2 < maxTimeoutMS ? e.timeout * 2 : maxTimeoutMS;
+
+	if (pressCycles < maxPressCycles)
+	{
+		if (pressCycles + 1 > pressFloor)
+			pressFloor = pressCycles + 1;
+		++pressCycles;
+	}
+	pressStreak = 0;
+	dirty = true;
+}
+
+void CommandTiming::update(Type type)
+{
+	Entry& e = entries[type];
+	if (e.samples < minSamples)
+		return;
+
+	e.timeout = clamp(e.latency + 4 * e.deviation + marginMS, minTimeoutMS, maxTimeoutMS);
+	// the presses of a temperature burst pace themselves
+	if (TYPE_TEMPERATURE != type)
+	{
+		// both count from the press, a retry waits for the longer
+		uint32_t late = e.maxLatency + e.maxLatency / 4 + marginMS;
+		e.delay = late < maxDelayMS ? late : maxDelayMS;
+	}
+}
+
+// the number after "key": from index from on
+static bool readNumber(const String& json, int from, const char* key, uint32_t& value)
+{
+	String pattern = String("\"") + key + "\":";
+	int index = json.indexOf(pattern, from);
+	if (index < 0)
+		return false;
+	value = json.substring(index + pattern.length()).toInt();
+	return true;
+}
+
+bool CommandTiming::load(fs::FS& fs, const String& path)
+{
+	File file = fs.open(path, "r");
+	if (!file)
+		return false;
+	String json;
+	while (file.available())
+		json += (char)file.read();
+	file.close();
+
+	// learned on another board model or by another format
+	uint32_t value = 0;
+	if (!readNumber(json, 0, "format", value) || value != format)
+		return false;
+	if (json.indexOf(String("\"model\":\"") + SpaProtocol::name() + "\"") < 0)
+		return false;
+
+	Entry loaded[TYPE_COUNT];
+	for (int i = 0; i < TYPE_COUNT; ++i)
+	{
+		int from = json.indexOf(String("\"") + getTypeName((Type)i) + "\":{");
+		if (from < 0)
+			return false;
+		Entry& e = loaded[i];
+		if (!readNumber(json, from, "samples", e.samples) || !readNumber(json, from, "latency", e.latency) ||
+			!readNumber(json, from, "deviation", e.deviation) || !readNumber(json, from, "max", e.maxLatency) ||
+			!readNumber(json, from, "timeout", e.timeout) || !readNumber(json, from, "delay", e.delay))
+			return false;
+		e.timeout = clamp(e.timeout, minTimeoutMS, maxTimeoutMS);
+		if (e.delay > maxDelayMS)
+			e.delay = maxDelayMS;
+	}
+	uint32_t cycles = 0;
+	uint32_t floor = 0;
+	if (!readNumber(json, 0, "press_cycles", cycles) || !readNumber(json, 0, "press_floor", floor))
+		return false;
+
+	for (int i = 0; i < TYPE_COUNT; ++i)
+		entries[i] = loaded[i];
+	pressCycles = clamp(cycles, minPressCycles, maxPressCycles);
+	pressFloor = clamp(floor, minPressCycles, maxPressCycles);
+	pressStreak = 0;
+	dirty = false;
+	return true;
+}
+
+bool CommandTiming::save(fs::FS& fs, const String& path)
+{
+	File file = fs.open(path, "w");
+	if (!file)
+		return false;
+	String json = toJson();
+	bool saved = file.write((const uint8_t*)json.c_str(), json.length()) == json.length();
+	file.close();
+	if (saved)
+		dirty = false;
+	return saved;
+}
+
+String CommandTiming::toJson() const
+{
+	String str = "{\"format\":" + String(format);
+	str += ",\"model\":\"";
+	str += SpaProtocol::name();
+	str += "\",\"press_cycles\":" + String(pressCycles);
+	str += ",\"press_floor\":" + String(pressFloor);
+	str += ",\"commands\":{";
+	for (int i = 0; i < TYPE_COUNT; ++i)
+	{
+		const Entry& e = entries[i];
+		if (i > 0)
+			str += ",";
+		str += "\"";
+		str += getTypeName((Type)i);
+		str += "\":{\"samples\":" + String(e.samples);
+		str += ",\"latency\":" + String(e.latency);
+		str += ",\"deviation\":" + String(e.deviation);
+		str += ",\"max\":" + String(e.maxLatency);
+		str += ",\"timeout\":" + String(e.timeout);
+		str += ",\"delay\":" + String(e.delay);
+		str += "}";
+	}
+	str += "}}";
+	return str;
+}
+
+const char* CommandTiming::getTypeName(Type type)
+{
+	switch (type)
+	{
+	case TYPE_POWER:
+		return "power";
+	case TYPE_HEATING:
+		return "heating";
+	case TYPE_FILTER:
+		return "filter";
+	case TYPE_BUBBLES:
+		return "bubbles";
+	case TYPE_TEMPERATURE:
+		return "temp";
+	case TYPE_UNITS:
+		return "units";
+	default:
+		break;
+	}
+	return "unknown";
+}
@@ -0,0 +1,96 @@
+#ifndef COMMAND_TIMING_H
+#define COMMAND_TIMING_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Timing of the commands, learned from how long the display takes to
+// show a press. Each command type keeps a smoothed latency and its
+// deviation like a TCP retransmission timer: the timeout a press waits
+// for the display is the latency plus four deviations, the delay
+// before a retry covers the slowest recent latency, so a late
+// confirmation is seen before the button is pressed again. A press the
+// display does not show doubles the timeout until the next samples.
+// The press length in button scans grows when presses get lost and is
+// tried shorter after a run without a loss, not below the length that
+// lost one until a much longer run. Times are in ms.
+class CommandTiming
+{
+public:
+	// same order as the command types of SpaState::Command, CommandBenchmark
+	// sweeps the same types
+	enum Type
+	{
+		TYPE_POWER,
+		TYPE_HEATING,
+		TYPE_FILTER,
+		TYPE_BUBBLES,
+		TYPE_TEMPERATURE,
+		TYPE_UNITS,
+		TYPE_COUNT
+	};
+
+	struct Entry
+	{
+		uint32_t samples = 0;
+		uint32_t latency = 0;    // smoothed
+		uint32_t deviation = 0;  // smoothed mean deviation
+		uint32_t maxLatency = 0; // decays with every sample
+		uint32_t timeout = 0;
+		uint32_t delay = 0;
+	};
+
+	// samples before the learned values replace the defaults
+	static const uint32_t minSamples = 8;
+	// refresh and loop() granularity added to the timeout
+	static const uint32_t marginMS = 50;
+	static const uint32_t minTimeoutMS = 100;
+	static const uint32_t maxTimeoutMS = 3000;
+	static const uint32_t maxDelayMS = 2000;
+
+	static const uint8_t defaultPressCycles = 6;
+	static const uint8_t minPressCycles = 2;
+	static const uint8_t maxPressCycles = 12;
+	// presses in a row without a loss before a shorter press is tried
+	static const uint16_t pressProbeStreak = 50;
+	// and before the floor of the press length comes down by one
+	static const uint16_t pressFloorStreak = 500;
+
+	// version of the learned values, files of other versions are ignored
+	static const uint8_t format = 1;
+
+	CommandTiming() { reset(); dirty = false; }
+
+	// back to the measured defaults
+	void reset();
+
+	uint32_t getTimeout(Type type) const { return entries[type].timeout; }
+	uint32_t getDelay(Type type) const { return entries[type].delay; }
+	uint8_t getPressCycles() const { return pressCycles; }
+	const Entry& getEntry(Type type) const { return entries[type]; }
+
+	// press until the display showed it
+	void recordLatency(Type type, uint32_t ms);
+	// a press the display did not show within the timeout, only presses
+	// the display could have shown
+	void recordLoss(Type type);
+
+	// changed since the last load or save
+	bool isDirty() const { return dirty; }
+	bool load(fs::FS& fs, const String& path);
+	bool save(fs::FS& fs, const String& path);
+
+	String toJson() const;
+	static const char* getTypeName(Type type);
+
+private:
+	void update(Type type);
+
+	Entry entries[TYPE_COUNT];
+	uint8_t pressCycles = defaultPressCycles;
+	uint8_t pressFloor = minPressCycles; // one more than the longest press that got lost
+	uint16_t pressStreak = 0;
+	bool dirty = false;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stdint.h>
+
+// Stackless coroutines in the style of protothreads. A coroutine is a
+// member function that returns at every wait and, called again, goes
+// on after it: COROUTINE_BEGIN switches to the line it returned from.
+// Local variables do not survive a wait, the state is kept in members,
+// and a switch statement must not contain a wait. Nothing is allocated,
+// a Coroutine is the line and what it waits for. The scheduler asks
+// isDue() before it calls the function, a coroutine that waits for
+// the display costs a few compares per loop().
+class Coroutine
+{
+public:
+	enum Wait : uint8_t
+	{
+		WAIT_NONE,   // runs at the next call
+		WAIT_TIME,   // until forMS after fromMS
+		WAIT_CHANGE  // until the change count moves, or the time
+	};
+
+	static const uint16_t FINISHED = 0xFFFF;
+
+	// changeCount: counts the changes the waits are woken by, for
+	// SpaState the display refreshes that changed something
+	bool isDue(uint32_t nowMS, uint32_t changeCount) const
+	{
+		switch (wait)
+		{
+		case WAIT_TIME:
+			return nowMS - fromMS >= forMS;
+		case WAIT_CHANGE:
+			return changeCount != changes || nowMS - fromMS >= forMS;
+		default:
+			return true;
+		}
+	}
+
+	// called by the scheduler right before the function
+	void resume(uint32_t now, uint32_t changeCount)
+	{
+		nowMS = now;
+		changes = changeCount;
+		wait = WAIT_NONE;
+	}
+
+	bool isFinished() const { return FINISHED == line; }
+	void restart()
+	{
+		line = 0;
+		wait = WAIT_NONE;
+	}
+	// runs at the next call, whatever it waits for
+	void wake() { wait = WAIT_NONE; }
+
+	// used by the macros
+	void waitFor(Wait what, uint32_t from, uint32_t duration)
+	{
+		wait = what;
+		fromMS = from;
+		forMS = duration;
+	}
+	bool elapsed(uint32_t from, uint32_t duration) const { return nowMS - from >= duration; }
+
+	uint16_t line = 0;
+	Wait wait = WAIT_NONE;
+	uint32_t nowMS = 0;   // of the current call
+	uint32_t changes = 0; // change count of the current call
+	uint32_t fromMS = 0;
+	uint32_t forMS = 0;
+};
+
+#define COROUTINE_BEGIN(co) switch ((co).line) { case 0:
+
+#define COROUTINE_END(co) } (co).line = Coroutine::FINISHED; return
+
+#define COROUTINE_EXIT(co) do { (co).line = Coroutine::FINISHED; return; } while (0)
+
+// until the next call
+#define COROUTINE_YIELD(co) do { (co).line = __LINE__; return; case __LINE__:; } while (0)
+
+// until forMS after fromMS, the arguments are read again on every call
+#define COROUTINE_SLEEP(co, fromMS, forMS) \
+	do { (co).line = __LINE__; case __LINE__: \
+		if (!(co).elapsed(fromMS, forMS)) { (co).waitFor(Coroutine::WAIT_TIME, fromMS, forMS); return; } \
+	} while (0)
+
+// until condition holds or forMS after fromMS, the condition is checked
+// at every change
+#define COROUTINE_AWAIT(co, condition, fromMS, forMS) \
+	do { (co).line = __LINE__; case __LINE__: \
+		if (!(condition) && !(co).elapsed(fromMS, forMS)) { (co).waitFor(Coroutine::WAIT_CHANGE, fromMS, forMS); return; } \
+	} while (0)
+
+// until the next change or forMS after fromMS
+#define COROUTINE_AWAIT_CHANGE(co, fromMS, forMS) \
+	do { (co).waitFor(Coroutine::WAIT_CHANGE, fromMS, forMS); (co).line = __LINE__; return; case __LINE__:; } while (0)
+
+#endif
@@ -0,0 +1,28 @@
+#include "DallasAirTemperatureSensor.h"
+
+void DallasAirTemperatureSensor::begin()
+{
+	sensors.begin();
+	sensors.setWaitForConversion(false);
+}
+
+int DallasAirTemperatureSensor::getDeviceCount()
+{
+	return sensors.getDeviceCount();
+}
+
+uint32_t DallasAirTemperatureSensor::requestTemperature()
+{
+	sensors.requestTemperatures();
+	return sensors.millisToWaitForConversion(12);
+}
+
+bool DallasAirTemperatureSensor::isConversionComplete()
+{
+	return sensors.isConversionComplete();
+}
+
+float DallasAirTemperatureSensor::getTemperature(bool celsius)
+{
+	return celsius ? sensors.getTempCByIndex(0) : sensors.getTempFByIndex(0);
+}
@@ -0,0 +1,26 @@
+#ifndef DALLAS_AIR_TEMPERATURE_SENSOR_H
+#define DALLAS_AIR_TEMPERATURE_SENSOR_H
+
+#include <OneWire.h>
+#include <DallasTemperature.h>
+
+#include "AirTemperatureSensor.h"
+
+// DS18S20 on a OneWire bus
+class DallasAirTemperatureSensor : public AirTemperatureSensor
+{
+public:
+	DallasAirTemperatureSensor(uint8_t pin) : oneWire(pin), sensors(&oneWire) {}
+
+	virtual void begin() override;
+	virtual int getDeviceCount() override;
+	virtual uint32_t requestTemperature() override;
+	virtual bool isConversionComplete() override;
+	virtual float getTemperature(bool celsius) override;
+
+private:
+	OneWire oneWire;
+	DallasTemperature sensors;
+};
+
+#endif
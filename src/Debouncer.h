@@ -0,0 +1,58 @@
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+#include <stdint.h>
+
+// Debounces every bit of a word in parallel using vertical counters.
+// Each bit has its own counter, spread over the counter planes, that
+// counts consecutive samples differing from the debounced state. A bit
+// changes once it differed for Depth samples in a row.
+template<typename T, uint8_t Depth>
+class Debouncer
+{
+	static_assert(Depth >= 1 && Depth <= 15, "Debouncer depth must be 1-15");
+	static const uint8_t planes = Depth < 2 ? 1 : Depth < 4 ? 2 : Depth < 8 ? 3 : 4;
+
+public:
+	// returns the mask of bits whose debounced state changed
+	T update(T sample)
+	{
+		T delta = sample ^ state;
+
+		// increment the counters of differing bits, clear all others
+		T carry = delta;
+		for (uint8_t i = 0; i < planes; ++i)
+		{
+			T plane = counter[i];
+			counter[i] = (plane ^ carry) & delta;
+			carry = plane & carry;
+		}
+
+		// bits whose counter reached Depth
+		T changed = delta;
+		for (uint8_t i = 0; i < planes; ++i)
+			changed &= ((Depth >> i) & 1) ? counter[i] : (T)~counter[i];
+
+		state ^= changed;
+		for (uint8_t i = 0; i < planes; ++i)
+			counter[i] &= ~changed;
+		return changed;
+	}
+
+	T getState() const { return state; }
+
+	// true when no bit is waiting for confirmation
+	bool isSettled() const
+	{
+		T pending = 0;
+		for (uint8_t i = 0; i < planes; ++i)
+			pending |= counter[i];
+		return pending == 0;
+	}
+
+private:
+	T state = 0;
+	T counter[planes] = {};
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef DISPLAY_FRAME_H
+#define DISPLAY_FRAME_H
+
+#include <stdint.h>
+
+#include "SpaProtocol.h"
+
+// number of refreshes a LED has to keep its new state before it is taken over
+#ifndef SPA_LED_DEBOUNCE_DEPTH
+#define SPA_LED_DEBOUNCE_DEPTH 2
+#endif
+
+// One complete refresh of the display: the four digit frames and the
+// LED frame, all received without a gap in between.
+struct DisplayFrame
+{
+	static const uint8_t SLOT_LEDS = 4;
+	static const uint8_t NUM_SLOTS = 5;
+	static const uint8_t ALL_SLOTS = (1 << NUM_SLOTS) - 1;
+
+	// bits of the LED frame, active low
+	enum LEDBits
+	{
+		LED_POWER        = SpaProtocol::LED_POWER,
+		LED_HEATER_RED   = SpaProtocol::LED_HEATER_RED,
+		LED_HEATER_GREEN = SpaProtocol::LED_HEATER_GREEN,
+		LED_BUBBLE       = SpaProtocol::LED_BUBBLE,
+		LED_FILTER       = SpaProtocol::LED_FILTER
+	};
+
+	uint16_t raw[NUM_SLOTS] = {}; // raw frames of digit 0-3 and the LEDs
+	uint32_t timestamp = 0;       // micros() of the first frame's latch
+
+	uint16_t getLEDs() const { return raw[SLOT_LEDS]; }
+
+	// select bit of a slot, it is low in the frames of that slot
+	static uint16_t selectMask(int slot)
+	{
+		static const uint16_t masks[NUM_SLOTS] = {
+			1 << SpaProtocol::SELECT_DIGIT_0, 1 << SpaProtocol::SELECT_DIGIT_1, 1 << SpaProtocol::SELECT_DIGIT_2,
+			1 << SpaProtocol::SELECT_DIGIT_3, 1 << SpaProtocol::SELECT_LEDS };
+		return masks[slot];
+	}
+
+	// display slot of a raw frame, -1 if it is not a display frame
+	static int slotOf(uint16_t msg)
+	{
+		if ((msg & (1 << SpaProtocol::SELECT_DIGIT_0)) == 0)
+			return 0;
+		if ((msg & (1 << SpaProtocol::SELECT_DIGIT_1)) == 0)
+			return 1;
+		if ((msg & (1 << SpaProtocol::SELECT_DIGIT_2)) == 0)
+			return 2;
+		if ((msg & (1 << SpaProtocol::SELECT_DIGIT_3)) == 0)
+			return 3;
+		if ((msg & (1 << SpaProtocol::SELECT_LEDS)) == 0)
+			return SLOT_LEDS;
+		return -1;
+	}
+};
+
+// Collects display frames until one refresh is complete.
+// A refresh is torn when a slot repeats before all slots were seen or
+// when frames were lost in between (short frames, ring overflow).
+class DisplayFrameAssembler
+{
+public:
+	enum Result
+	{
+		RESULT_INCOMPLETE,
+		RESULT_COMPLETE,
+		RESULT_TORN
+	};
+
+	// gap is set when frames were lost since the previous frame
+	Result add(int slot, uint16_t msg, uint32_t latchMicros, bool gap)
+	{
+		Result result = RESULT_INCOMPLETE;
+		if (slotMask != 0 && (gap || (slotMask & (1 << slot))))
+		{
+			slotMask = 0;
+			++tornCount;
+			result = RESULT_TORN;
+		}
+
+		if (slotMask == 0)
+			pending.timestamp = latchMicros;
+		pending.raw[slot] = msg;
+		slotMask |= (1 << slot);
+
+		if (slotMask == DisplayFrame::ALL_SLOTS)
+		{
+			frame = pending;
+			slotMask = 0;
+			++completeCount;
+			result = RESULT_COMPLETE;
+		}
+		return result;
+	}
+
+	// the last complete frame
+	const DisplayFrame& getFrame() const { return frame; }
+
+	uint32_t getCompleteCount() const { return completeCount; }
+	uint32_t getTornCount() const { return tornCount; }
+
+private:
+	DisplayFrame pending;
+	DisplayFrame frame;
+	uint8_t slotMask = 0;
+	uint32_t completeCount = 0;
+	uint32_t tornCount = 0;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Raw display bus capture format
+//
+// header (8 bytes):
+//   "SPAC"      magic
+//   uint8_t     version (1)
+//   uint8_t     record size (7)
+//   uint16_t    reserved
+// records (7 bytes each, little endian):
+//   uint32_t    micros() of the latch interrupt
+//   uint16_t    raw 16 bit frame
+//   uint8_t     flags (CAPTURE_FLAG_*)
+//
+// Compressed capture format, written by CaptureEncoder
+//
+// header (8 bytes):
+//   "SPAC"      magic
+//   uint8_t     version (2)
+//   uint8_t     log2 of the block size (12)
+//   uint16_t    reserved
+// blocks of 4096 bytes, the last one may be shorter. A block decodes
+// without the ones before it, so its header is also the seek index:
+//   "SB"
+//   uint8_t     frames in the history (0-15)
+//   uint8_t     reserved
+//   uint32_t    micros() of the record before the block
+//   uint64_t    micros from the first record to that record
+//   uint32_t    records before the block
+//   uint16_t    history[15], the frames before the block, latest first
+// followed by entries until the end of the block or a 0xFF byte:
+//   literal     01xgdddd varint(micros since the previous record)
+//               [uint16_t frame if dddd is 0] [uint8_t flags if x]
+//               the frame repeats the one dddd records back, g is
+//               CAPTURE_FLAG_GAP when there are no other flags
+//   run         0000dddd varint(records) varint(period, 1/256 micros)
+//               records repeating the frame dddd records back, the n-th
+//               one latched n * period after the record before the run
+// varints are little endian base 128. The times in a run are within
+// CaptureEncoder::maxRunError of the original ones, all others are exact.
+
+struct CaptureRecord
+{
+	uint32_t micros;
+	uint16_t data;
+	uint8_t flags;
+};
+
+class FrameCapture
+{
+public:
+	static const uint8_t version = 1;
+	static const uint8_t compressedVersion = 2;
+	static const size_t headerSize = 8;
+	static const size_t recordSize = 7;
+	static const uint8_t blockSizeLog2 = 12;
+	static const size_t blockSize = 1 << blockSizeLog2;
+	static const size_t blockHeaderSize = 50;
+	static const uint8_t historySize = 15;
+
+	enum Flags
+	{
+		CAPTURE_FLAG_GAP = 1 // frames were lost before this one
+	};
+
+	static void encodeHeader(uint8_t* buf)
+	{
+		buf[0] = 'S';
+		buf[1] = 'P';
+		buf[2] = 'A';
+		buf[3] = 'C';
+		buf[4] = version;
+		buf[5] = recordSize;
+		buf[6] = 0;
+		buf[7] = 0;
+	}
+
+	static bool decodeHeader(const uint8_t* buf)
+	{
+		return buf[0] == 'S' && buf[1] == 'P' && buf[2] == 'A' && buf[3] == 'C' &&
+			buf[4] == version && buf[5] == recordSize;
+	}
+
+	static void encodeCompressedHeader(uint8_t* buf)
+	{
+		encodeHeader(buf);
+		buf[4] = compressedVersion;
+		buf[5] = blockSizeLog2;
+	}
+
+	static bool decodeCompressedHeader(const uint8_t* buf)
+	{
+		return buf[0] == 'S' && buf[1] == 'P' && buf[2] == 'A' && buf[3] == 'C' &&
+			buf[4] == compressedVersion && buf[5] == blockSizeLog2;
+	}
+
+	static void encodeRecord(uint8_t* buf, const CaptureRecord& r)
+	{
+		buf[0] = r.micros;
+		buf[1] = r.micros >> 8;
+		buf[2] = r.micros >> 16;
+		buf[3] = r.micros >> 24;
+		buf[4] = r.data;
+		buf[5] = r.data >> 8;
+		buf[6] = r.flags;
+	}
+
+	static void decodeRecord(const uint8_t* buf, CaptureRecord& r)
+	{
+		r.micros = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+			((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+		r.data = buf[4] | (buf[5] << 8);
+		r.flags = buf[6];
+	}
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "FrameRecorder.h"
+
+bool FrameRecorder::start(fs::FS& fs, const String& newPath, uint32_t newMaxBytes)
+{
+	stop();
+
+	file = fs.open(newPath, "w");
+	if (!file)
+		return false;
+
+	path = newPath;
+	maxBytes = newMaxBytes;
+	bytes = 0;
+	bufferUsed = 0;
+	if (!encoder.begin(this) || !flush())
+	{
+		file.close();
+		return false;
+	}
+
+	recording = true;
+	return true;
+}
+
+void FrameRecorder::stop()
+{
+	if (!recording)
+		return;
+
+	encoder.finish();
+	flush();
+	file.close();
+	recording = false;
+}
+
+void FrameRecorder::add(const CaptureRecord& r)
+{
+	if (!recording)
+		return;
+
+	if (!encoder.add(r))
+		stop();
+}
+
+// called by the encoder
+bool FrameRecorder::write(const uint8_t* data, size_t size)
+{
+	if (bytes + bufferUsed + size > maxBytes)
+		return false;
+
+	while (size > 0)
+	{
+		size_t n = min(size, sizeof(buffer) - bufferUsed);
+		memcpy(buffer + bufferUsed, data, n);
+		bufferUsed += n;
+		data += n;
+		size -= n;
+		if (bufferUsed == sizeof(buffer) && !flush())
+			return false;
+	}
+	return true;
+}
+
+bool FrameRecorder::flush()
+{
+	if (0 == bufferUsed)
+		return true;
+
+	size_t written = file.write(buffer, bufferUsed);
+	bytes += written;
+	bool ok = (written == bufferUsed);
+	bufferUsed = 0;
+	return ok;
+}
+
+
+bool FrameReplay::start(fs::FS& fs, const String& path, uint32_t nowMicros, uint64_t fromMicros)
+{
+	stop();
+
+	file = fs.open(path, "r");
+	if (!file)
+		return false;
+
+	if (!decoder.begin() ||
+		(fromMicros > 0 && !decoder.seek(fromMicros)) ||
+		!decoder.next(pending))
+	{
+		file.close();
+		return false;
+	}
+
+	pendingValid = true;
+	lastMicros = pending.micros;
+	dueMicros = nowMicros;
+	records = 0;
+	running = true;
+	return true;
+}
+
+void FrameReplay::stop()
+{
+	if (!running)
+		return;
+
+	file.close();
+	running = false;
+	pendingValid = false;
+}
+
+bool FrameReplay::next(uint32_t nowMicros, CaptureRecord& r)
+{
+	if (!running)
+		return false;
+
+	if (!pendingValid)
+	{
+		if (!decoder.next(pending))
+		{
+			stop();
+			return false;
+		}
+		pendingValid = true;
+	}
+
+	// the intervals of the capture, a record with an earlier time than
+	// the one before is due right away
+	uint32_t interval = pending.micros - lastMicros;
+	uint32_t due = dueMicros + (interval < 0x80000000UL ? interval : 0);
+	if ((int32_t)(nowMicros - due) < 0)
+		return false;
+
+	lastMicros = pending.micros;
+	dueMicros = due;
+	r = pending;
+	r.micros = due;
+	pendingValid = false;
+	++records;
+	return true;
+}
@@ -0,0 +1,82 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "FrameCapture.h"
+#include "CaptureCodec.h"
+
+// Writes display bus frames to a compressed capture file
+class FrameRecorder : private CaptureSink
+{
+public:
+	bool start(fs::FS& fs, const String& path, uint32_t maxBytes);
+	void stop();
+	bool isRecording() const { return recording; }
+
+	void add(const CaptureRecord& r);
+
+	uint32_t getRecordCount() const { return encoder.getRecordCount(); }
+	uint32_t getBytes() const { return encoder.getBytes(); }
+	const String& getPath() const { return path; }
+
+private:
+	virtual bool write(const uint8_t* data, size_t size) override;
+	bool flush();
+
+	static const size_t bufferSize = 256;
+
+	File file;
+	String path;
+	bool recording = false;
+	CaptureEncoder encoder;
+	uint8_t buffer[bufferSize];
+	size_t bufferUsed = 0;
+	uint32_t bytes = 0;
+	uint32_t maxBytes = 0;
+};
+
+// Reads a capture file of either format back with its original timing
+class FrameReplay
+{
+public:
+	FrameReplay() : reader(file), decoder(reader) {}
+
+	// starts fromMicros after the first record of the capture
+	bool start(fs::FS& fs, const String& path, uint32_t nowMicros, uint64_t fromMicros = 0);
+	void stop();
+	bool isRunning() const { return running; }
+
+	// returns the next record once it is due. Its time is moved so
+	// the first record replayed is due when the replay started.
+	bool next(uint32_t nowMicros, CaptureRecord& r);
+
+	uint32_t getRecordCount() const { return records; }
+
+private:
+	// the decoder reads through this
+	class Reader
+	{
+	public:
+		Reader(File& file) : file(file) {}
+		int read() { return file.read(); }
+		bool seek(uint32_t pos) { return file.seek(pos); }
+		size_t size() const { return file.size(); }
+
+	private:
+		File& file;
+	};
+
+	File file;
+	Reader reader;
+	CaptureDecoder<Reader> decoder;
+	bool running = false;
+	bool pendingValid = false;
+	CaptureRecord pending = {};
+	uint32_t lastMicros = 0; // in the capture, of the last record returned
+	uint32_t dueMicros = 0;  // when the last record was due
+	uint32_t records = 0;
+};
+
+#endif
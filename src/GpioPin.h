@@ -0,0 +1,41 @@
+#ifndef GPIO_PIN_H
+#define GPIO_PIN_H
+
+#include <Arduino.h>
+
+// Direct register access to a GPIO pin known at compile time, so the
+// interrupt handlers use constant masks instead of runtime shifts.
+template<uint8_t Pin>
+struct GpioPin
+{
+	static_assert(Pin < 16, "use GpioPin<16> for GPIO16");
+	static const uint8_t pin = Pin;
+	static const uint32_t mask = 1UL << Pin;
+
+	static inline ICACHE_RAM_ATTR uint16_t read() { return (GPI >> Pin) & 1; }
+	static inline ICACHE_RAM_ATTR void set() { GPOS = mask; }
+	static inline ICACHE_RAM_ATTR void clear() { GPOC = mask; }
+};
+
+// GPIO16 (D0) is in the RTC block and has its own registers
+template<>
+struct GpioPin<16>
+{
+	static const uint8_t pin = 16;
+
+	static inline ICACHE_RAM_ATTR uint16_t read() { return GP16I & 1; }
+	static inline ICACHE_RAM_ATTR void set() { GP16O |= 1; }
+	static inline ICACHE_RAM_ATTR void clear() { GP16O &= ~1; }
+};
+
+// The pins the display bus is connected to
+template<uint8_t ClockPin, uint8_t LatchPin, uint8_t DataInPin, uint8_t DataOutPin>
+struct SpaBusPins
+{
+	typedef GpioPin<ClockPin> Clock;
+	typedef GpioPin<LatchPin> Latch;
+	typedef GpioPin<DataInPin> DataIn;
+	typedef GpioPin<DataOutPin> DataOut;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "LatencyStats.h"
+
+static uint32_t bucketLowerBound(uint8_t index)
+{
+	if (index < 2)
+		return index;
+	uint8_t msb = index >> 1;
+	return (1UL << msb) | ((uint32_t)(index & 1) << (msb - 1));
+}
+
+uint8_t LatencyHistogram::bucketIndex(uint32_t us)
+{
+	if (us < 2)
+		return us;
+	uint8_t msb = 31 - __builtin_clz(us);
+	return (msb << 1) | ((us >> (msb - 1)) & 1);
+}
+
+uint32_t LatencyHistogram::getBucketUpperBound(uint8_t index)
+{
+	if (index + 1 >= numBuckets)
+		return 0xFFFFFFFF;
+	return bucketLowerBound(index + 1) - 1;
+}
+
+void LatencyHistogram::record(uint32_t us)
+{
+	++buckets[bucketIndex(us)];
+	if (count == 0 || us < minValue)
+		minValue = us;
+	if (us > maxValue)
+		maxValue = us;
+	sum += us;
+	++count;
+}
+
+void LatencyHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	minValue = 0;
+	maxValue = 0;
+	sum = 0;
+}
+
+uint32_t LatencyHistogram::getPercentile(uint8_t percentile) const
+{
+	if (count == 0)
+		return 0;
+
+	uint32_t rank = ((uint64_t)count * percentile + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+
+	uint32_t seen = 0;
+	for (uint8_t i = 0; i < numBuckets; ++i)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+			return min(getBucketUpperBound(i), maxValue);
+	}
+	return maxValue;
+}
+
+
+void LatencyStats::reset()
+{
+	for (int i = 0; i < STAGE_COUNT; ++i)
+		histograms[i].reset();
+}
+
+const char* LatencyStats::getStageName(Stage stage)
+{
+	switch (stage)
+	{
+	case STAGE_RING:
+		return "ring";
+	case STAGE_DECODE:
+		return "decode";
+	case STAGE_DISPATCH:
+		return "dispatch";
+	case STAGE_PUBLISH:
+		return "publish";
+	case STAGE_TOTAL:
+		return "total";
+	case STAGE_TARGET_DETECT:
+		return "target";
+	case STAGE_CURRENT_DETECT:
+		return "current";
+	default:
+		break;
+	}
+	return "unknown";
+}
+
+String LatencyStats::toString() const
+{
+	String str = "Latency (us): count p50 p95 p99 max\n";
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		const LatencyHistogram& h = histograms[i];
+		str += getStageName((Stage)i);
+		str += ": " + String(h.getCount());
+		str += " " + String(h.getPercentile(50));
+		str += " " + String(h.getPercentile(95));
+		str += " " + String(h.getPercentile(99));
+		str += " " + String(h.getMax());
+		str += "\n";
+	}
+	return str;
+}
+
+String LatencyStats::toJson() const
+{
+	String str = "{";
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		const LatencyHistogram& h = histograms[i];
+		if (i > 0)
+			str += ",";
+		str += "\"";
+		str += getStageName((Stage)i);
+		str += "\":{\"count\":" + String(h.getCount());
+		str += ",\"p50\":" + String(h.getPercentile(50));
+		str += ",\"p95\":" + String(h.getPercentile(95));
+		str += ",\"p99\":" + String(h.getPercentile(99));
+		str += ",\"max\":" + String(h.getMax());
+		str += "}";
+	}
+	str += "}";
+	return str;
+}
@@ -0,0 +1,67 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <Arduino.h>
+
+// Log-scale histogram of durations in microseconds.
+// Each power of two is split into two buckets, so percentiles are
+// reported with about 25% resolution using 64 counters.
+class LatencyHistogram
+{
+public:
+	static const uint8_t numBuckets = 64;
+
+	void record(uint32_t us);
+	void reset();
+
+	uint32_t getCount() const { return count; }
+	uint32_t getMin() const { return count ? minValue : 0; }
+	uint32_t getMax() const { return maxValue; }
+	uint32_t getAverage() const { return count ? (uint32_t)(sum / count) : 0; }
+	// upper bound of the bucket holding the given percentile (0-100)
+	uint32_t getPercentile(uint8_t percentile) const;
+
+	uint32_t getBucketCount(uint8_t index) const { return buckets[index]; }
+	static uint32_t getBucketUpperBound(uint8_t index);
+
+private:
+	static uint8_t bucketIndex(uint32_t us);
+
+	uint32_t buckets[numBuckets] = {};
+	uint32_t count = 0;
+	uint32_t minValue = 0;
+	uint32_t maxValue = 0;
+	uint64_t sum = 0;
+};
+
+// Latency of a display change from the latch interrupt to MQTT
+// and of the temperature detection on the display
+class LatencyStats
+{
+public:
+	enum Stage
+	{
+		STAGE_RING,     // latch interrupt until popped by loop()
+		STAGE_DECODE,   // popped until the change is emitted
+		STAGE_DISPATCH, // emitted until the listener starts publishing
+		STAGE_PUBLISH,  // time spent in mqtt publish
+		STAGE_TOTAL,    // latch of the refresh's first frame until published
+		STAGE_TARGET_DETECT,  // display left steady until target temp detected
+		STAGE_CURRENT_DETECT, // value first shown until taken as current temp
+		STAGE_COUNT
+	};
+
+	void record(Stage stage, uint32_t us) { histograms[stage].record(us); }
+	const LatencyHistogram& getHistogram(Stage stage) const { return histograms[stage]; }
+	void reset();
+
+	static const char* getStageName(Stage stage);
+
+	String toString() const;
+	String toJson() const;
+
+private:
+	LatencyHistogram histograms[STAGE_COUNT];
+};
+
+#endif
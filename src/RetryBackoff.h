@@ -0,0 +1,38 @@
+#ifndef RETRY_BACKOFF_H
+#define RETRY_BACKOFF_H
+
+#include <stdint.h>
+
+// Time between reconnect attempts. It doubles after every attempt and
+// starts over at resetMS once it reaches limitMS.
+class RetryBackoff
+{
+public:
+	RetryBackoff(uint32_t firstMS, uint32_t resetMS, uint32_t limitMS) :
+		intervalMS(firstMS), resetMS(resetMS), limitMS(limitMS) {}
+
+	// something changed, the next attempt waits the interval from now
+	void restart(uint32_t nowMS) { lastMS = nowMS; }
+	bool isDue(uint32_t nowMS) const { return nowMS - lastMS > intervalMS; }
+
+	void attempted(uint32_t nowMS)
+	{
+		lastMS = nowMS;
+		++attempts;
+		intervalMS = intervalMS * 2;
+		if (intervalMS >= limitMS)
+			intervalMS = resetMS;
+	}
+
+	uint32_t getInterval() const { return intervalMS; }
+	uint32_t getAttempts() const { return attempts; }
+
+private:
+	uint32_t intervalMS;
+	const uint32_t resetMS;
+	const uint32_t limitMS;
+	uint32_t lastMS = 0;
+	uint32_t attempts = 0;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Single producer / single consumer ring buffer.
+// The producer (latch interrupt) only writes head, the consumer (loop)
+// only writes tail, so no locking is required. Both indices run freely
+// and are masked on access, which lets the buffer use every slot.
+// When full, push() drops the new value and counts an overflow instead
+// of overwriting data the consumer may be reading.
+template<typename T, uint32_t Capacity>
+class RingBuffer
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+		"RingBuffer capacity must be a power of two");
+
+public:
+	ICACHE_RAM_ATTR bool push(T value)
+	{
+		uint32_t h = head;
+		uint32_t used = h - tail;
+		if (used >= Capacity)
+		{
+			++overflows;
+			return false;
+		}
+
+		buffer[h & mask] = value;
+		// make sure the value is written before the consumer can see it
+		std::atomic_signal_fence(std::memory_order_release);
+		head = h + 1;
+
+		if (used + 1 > highWaterMark)
+			highWaterMark = used + 1;
+		return true;
+	}
+
+	bool pop(T& value)
+	{
+		uint32_t t = tail;
+		if (t == head)
+			return false;
+
+		std::atomic_signal_fence(std::memory_order_acquire);
+		value = buffer[t & mask];
+		// make sure the slot is read before the producer can reuse it
+		std::atomic_signal_fence(std::memory_order_release);
+		tail = t + 1;
+		return true;
+	}
+
+	uint32_t size() const { return head - tail; }
+	bool empty() const { return head == tail; }
+
+	// number of values dropped because the buffer was full
+	uint32_t getOverflowCount() const { return overflows; }
+	// largest number of values that were waiting at once
+	uint32_t getHighWaterMark() const { return highWaterMark; }
+	void resetHighWaterMark() { highWaterMark = size(); }
+
+private:
+	static const uint32_t mask = Capacity - 1;
+
+	T buffer[Capacity];
+	volatile uint32_t head = 0;
+	volatile uint32_t tail = 0;
+	volatile uint32_t overflows = 0;
+	volatile uint32_t highWaterMark = 0;
+};
+
+#endif
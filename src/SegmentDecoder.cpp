@@ -0,0 +1,29 @@
+#include "SegmentDecoder.h"
+
+constexpr char SegmentDecoder::glyphTable[128];
+
+bool SegmentDecoder::encode(char c, uint16_t& frame)
+{
+	// frame bit of segment a to g
+	static const uint8_t segmentBits[7] = {
+		SpaProtocol::SEG_A, SpaProtocol::SEG_B, SpaProtocol::SEG_C, SpaProtocol::SEG_D,
+		SpaProtocol::SEG_E, SpaProtocol::SEG_F, SpaProtocol::SEG_G };
+
+	if (0 == c)
+		return false;
+
+	for (uint8_t gfedcba = 0; gfedcba < 128; ++gfedcba)
+	{
+		if (glyphTable[gfedcba] != c)
+			continue;
+
+		frame = 0xFFFF;
+		for (int i = 0; i < 7; ++i)
+		{
+			if (gfedcba & (1 << i))
+				frame &= ~(1 << segmentBits[i]);
+		}
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,83 @@
+#ifndef SEGMENT_DECODER_H
+#define SEGMENT_DECODER_H
+
+#include <stdint.h>
+
+#include "SpaProtocol.h"
+
+// Decodes the 7 segment digit frames of the display bus.
+// Shared by the firmware and the host side tools so both decode
+// the exact same way.
+class SegmentDecoder
+{
+public:
+	// moves a segment bit of the frame to bit i of the gfedcba pattern,
+	// one of the shifts is by 0. Frame is uint16_t or a vector of them.
+	template<int frameBit, int i, class Frame>
+	static inline Frame segment(Frame msg)
+	{
+		return ((msg >> (frameBit > i ? frameBit - i : 0)) << (frameBit < i ? i - frameBit : 0)) & (1 << i);
+	}
+
+	// gfedcba pattern of the lit segments, they are low in the frame at
+	// the SpaProtocol::SEG_ bits
+	static inline uint8_t segments(uint16_t frame)
+	{
+		return segmentPattern<uint16_t>(~frame);
+	}
+
+	// the same for an inverted frame, the lit segments high
+	template<class Frame>
+	static inline Frame segmentPattern(Frame msg)
+	{
+		return segment<SpaProtocol::SEG_A, 0>(msg) |
+			segment<SpaProtocol::SEG_B, 1>(msg) |
+			segment<SpaProtocol::SEG_C, 2>(msg) |
+			segment<SpaProtocol::SEG_D, 3>(msg) |
+			segment<SpaProtocol::SEG_E, 4>(msg) |
+			segment<SpaProtocol::SEG_F, 5>(msg) |
+			segment<SpaProtocol::SEG_G, 6>(msg);
+	}
+
+	// glyph for the segment pattern, 0 if the pattern is unknown
+	static inline char glyph(uint8_t gfedcba)
+	{
+		return glyphTable[gfedcba & 0x7F];
+	}
+
+	// returns false and leaves c untouched if the glyph is unknown
+	static inline bool decode(uint16_t frame, char& c)
+	{
+		char g = glyph(segments(frame));
+		if (0 == g)
+			return false;
+		c = g;
+		return true;
+	}
+
+	// frame bits of a glyph: the lit segments low, all other bits high.
+	// returns false and leaves frame untouched if there is no glyph for c
+	static bool encode(char c, uint16_t& frame);
+
+	// indexed by the gfedcba segment pattern
+	static constexpr char glyphTable[128] = {
+		' ', 0  , 0  , 0  , 0  , 0  , '1', '7', // 0x00
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x08
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x10
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x18
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x20
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x28
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x30
+		0  , 'C', 0  , 0  , 0  , 0  , 0  , '0', // 0x38
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , 0  , // 0x40
+		0  , 0  , 0  , 0  , 0  , 0  , 0  , '3', // 0x48
+		0  , 0  , 0  , 0  , 'n', 0  , 0  , 0  , // 0x50
+		0  , 0  , 0  , '2', 0  , 0  , 'd', 0  , // 0x58
+		0  , 0  , 0  , 0  , 0  , 0  , '4', '9', // 0x60
+		0  , 0  , 0  , 0  , 0  , '5', 0  , '9', // 0x68
+		0  , 'F', 0  , 0  , 0  , 0  , 0  , 0  , // 0x70
+		0  , 'E', 0  , 0  , 0  , '6', 0  , '8', // 0x78
+	};
+};
+
+#endif
@@ -18,6 +18,9 @@ extern Log logger;
 #define topic_temp "temp"
 #define topic_air_temp "air_temp"
 #define topic_temp_units "temp_units"
+#define topic_diagnostics "diagnostics"
+#define topic_desired_state "desired_state" // set: power=on,heating_enabled=on,target_temp=38
+#define topic_reconcile "reconcile"   // result of the last desired_state
 
 // topics specific for home assistant mqtt climate platform
 #define topic_ha_action   "ha_action"  // idle heating off
@@ -32,8 +35,12 @@ SpaMQTT::SpaMQTT(class SpaState* state) :
 	self = this;
 
 	mqttClient.setClient(wifiClient);
-	mqttClient.setServer(mqtt_server, 1883); //CHANGE PORT HERE IF NEEDED
+	setServer(mqtt_server, 1883); //CHANGE PORT HERE IF NEEDED
 	mqttClient.setCallback(static_callback);
+	// the diagnostics are larger than the 256 byte default, with every
+	// counter at 10 digits the payload is 795 bytes, the topic up to 75
+	// with a 63 character device name and the header 7
+	mqttClient.setBufferSize(1024);
 
 	if (spaState)
 	{
@@ -42,7 +49,14 @@ SpaMQTT::SpaMQTT(class SpaState* state) :
 }
 
 
-void SpaMQTT::sendHAMode()
+void SpaMQTT::setServer(const String& host, uint16_t port)
+{
+	// PubSubClient keeps the pointer
+	server = host;
+	mqttClient.setServer(server.c_str(), port);
+}
+
+String SpaMQTT::getHAMode() const
 {
 	String value = "off";
 
@@ -59,12 +73,10 @@ void SpaMQTT::sendHAMode()
 			value = "dry";
 		}
 	}
-		
-	mqttClient.publish((name+topic_ha_mode).c_str(), value.c_str(), true);
-
+	return value;
 }
 
-void SpaMQTT::sendHAAction()
+String SpaMQTT::getHAAction() const
 {
 	// idle heating off
 	//off, heating, cooling, drying
@@ -88,10 +100,69 @@ void SpaMQTT::sendHAAction()
 			value = "drying";
 		}
 	}
-	mqttClient.publish((name+topic_ha_action).c_str(), value.c_str(), true);
+	return value;
+}
+
+void SpaMQTT::sendHAMode()
+{
+	mqttClient.publish((name+topic_ha_mode).c_str(), getHAMode().c_str(), true);
+}
+
+void SpaMQTT::sendHAAction()
+{
+	mqttClient.publish((name+topic_ha_action).c_str(), getHAAction().c_str(), true);
 }
 
 
+bool SpaMQTT::formatChange(SpaState::ChangeEvent::ChangeType type, String& topic, String& payload) const
+{
+	switch(type)
+	{
+	case SpaState::ChangeEvent::CHANGE_TYPE_POWER:
+		topic = name + topic_power;
+		payload = spaState->getPowerEnabled() ? "on" : "off";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_HEATING_ENABLED:
+		topic = name + topic_heating_enabled;
+		payload = spaState->getHeatingEnabled() ? "true" : "false";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_HEATING:
+		topic = name + topic_heating;
+		payload = spaState->getIsHeating() ? "on" : "off";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_FILTER:
+		topic = name + topic_filter;
+		payload = spaState->getFilterEnabled() ? "on" : "off";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_BUBBLES:
+		topic = name + topic_bubbles;
+		payload = spaState->getBubblesEnabled() ? "on" : "off";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_TEMP:
+		topic = name + topic_temp;
+		payload = String(spaState->getCurrentTemperature());
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_TARGET_TEMP:
+		topic = name + topic_target_temp;
+		payload = String(spaState->getTargetTemperature());
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_AIR_TEMP:
+		topic = name + topic_air_temp;
+		payload = String(spaState->getExternalTemperature());
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_TEMP_UNITS:
+		topic = name + topic_temp_units;
+		payload = spaState->getIsTempInC() ? "C" : "F";
+		return true;
+	case SpaState::ChangeEvent::CHANGE_TYPE_RECONCILE:
+		topic = name + topic_reconcile;
+		payload = spaState->getReconciler().toJson();
+		return true;
+	default:
+		return false;
+	}
+}
+
 void SpaMQTT::handleSpaStateChange(const SpaState::ChangeEvent& c)
 {
 	if (!mqttClient.connected())
@@ -100,76 +171,58 @@ void SpaMQTT::handleSpaStateChange(const SpaState::ChangeEvent& c)
 		return;
 	}
 
+	uint32_t publishStart = micros();
 	bool published = false;
+	String topic;
+	String payload;
+	if (formatChange(c.getType(), topic, payload))
+		published = mqttClient.publish(topic.c_str(), payload.c_str(), true);
+
 	switch(c.getType())
 	{
 	case SpaState::ChangeEvent::CHANGE_TYPE_POWER:
-		{
-			published = mqttClient.publish((name+topic_power).c_str(), spaState->getPowerEnabled() ? "on" : "off", true);
-			sendHAMode();
-			sendHAAction();
-		}
-		break;
 	case SpaState::ChangeEvent::CHANGE_TYPE_HEATING_ENABLED:
-		{
-			published = mqttClient.publish((name+topic_heating_enabled).c_str(), spaState->getHeatingEnabled() ? "true" : "false", true);
-			sendHAMode();
-			sendHAAction();
-		}
-		break;
 	case SpaState::ChangeEvent::CHANGE_TYPE_HEATING:
-		{
-			published = mqttClient.publish((name+topic_heating).c_str(), spaState->getIsHeating() ? "on" : "off", true);
-			sendHAMode();
-			sendHAAction();
-		}
-		break;
 	case SpaState::ChangeEvent::CHANGE_TYPE_FILTER:
-		{
-			published = mqttClient.publish((name+topic_filter).c_str(), String(spaState->getFilterEnabled()) ? "on" : "off", true);
-			sendHAMode();
-			sendHAAction();
-		}
-		break;
-	case SpaState::ChangeEvent::CHANGE_TYPE_BUBBLES:
-		{
-			published = mqttClient.publish((name+topic_bubbles).c_str(), spaState->getBubblesEnabled() ? "on" : "off", true);
-		}
-		break;
-
-	case SpaState::ChangeEvent::CHANGE_TYPE_TEMP:
-		{
-			published = mqttClient.publish((name+topic_temp).c_str(), String(spaState->getCurrentTemperature()).c_str(), true);
-		}
-		break;
-	case SpaState::ChangeEvent::CHANGE_TYPE_TARGET_TEMP:
-		{
-			published = mqttClient.publish((name+topic_target_temp).c_str(), String(spaState->getTargetTemperature()).c_str(), true);
-		}
-		break;
-	case SpaState::ChangeEvent::CHANGE_TYPE_AIR_TEMP:
-		{
-			published = mqttClient.publish((name+topic_air_temp).c_str(), String(spaState->getExternalTemperature()).c_str(), true);
-		}
-		break;
-	case SpaState::ChangeEvent::CHANGE_TYPE_TEMP_UNITS:
-		{
-			published = mqttClient.publish((name+topic_temp_units).c_str(), spaState->getIsTempInC() ? "C" : "F", true );
-		}
+		sendHAMode();
+		sendHAAction();
 		break;
 	default:
 		break;
 	}
+
+	if (published && c.isTraced())
+	{
+		LatencyStats& stats = spaState->getLatencyStats();
+		uint32_t publishEnd = micros();
+		stats.record(LatencyStats::STAGE_DISPATCH, publishStart - c.getEmitMicros());
+		stats.record(LatencyStats::STAGE_PUBLISH, publishEnd - publishStart);
+		stats.record(LatencyStats::STAGE_TOTAL, publishEnd - c.getLatchMicros());
+	}
 }
 
+String SpaMQTT::getDiagnostics() const
+{
+	SpaState::BusStats bus = spaState->getBusStats();
+	String value = "{\"frames\":" + String(bus.frames);
+	value += ",\"fps\":" + String(bus.framesPerSecond);
+	value += ",\"short\":" + String(bus.shortFrames);
+	value += ",\"long\":" + String(bus.longFrames);
+	value += ",\"dropped\":" + String(bus.droppedFrames);
+	value += ",\"latency\":" + spaState->getLatencyStats().toJson();
+	value += "}";
+	return value;
+}
 
-void SpaMQTT::loop()
+void SpaMQTT::sendDiagnostics()
 {
-	static uint32_t lastServiceTime = 0;
-	static uint32_t lastServiceTimeMQTT = 0;
-	static uint32_t lastPushTime = 0;
+	mqttClient.publish((name+topic_diagnostics).c_str(), getDiagnostics().c_str(), false);
+}
+
 
-	uint32_t now = millis();
+void SpaMQTT::loop()
+{
+	uint32_t now = clock->millis();
 	if (now - lastServiceTime > 1000)
 	{
 		lastServiceTime = now;
@@ -185,8 +238,13 @@ void SpaMQTT::loop()
 	{
 		for (int i = 0 ; i  < SpaState::ChangeEvent::CHANGE_TYPE_FENCE; ++i)
 		{
+			// the result of a desired state is only published when it is reached
+			if (SpaState::ChangeEvent::CHANGE_TYPE_RECONCILE == i)
+				continue;
 			handleSpaStateChange(SpaState::ChangeEvent((SpaState::ChangeEvent::ChangeType)i));
 		}
+		if (mqttClient.connected())
+			sendDiagnostics();
 		lastPushTime = now;
 	}
 
@@ -205,6 +263,8 @@ void SpaMQTT::loop()
 		if (now - lastServiceTimeMQTT > 25) 
 		{
 			lastServiceTimeMQTT = now;
+			// the callback is static, it goes to the instance polling
+			self = this;
 			mqttClient.loop();
 		}
 	}
@@ -213,9 +273,7 @@ void SpaMQTT::loop()
 
 void SpaMQTT::reconnect()
 {
-	static uint32_t lastConnectAttempt = 0;
-
-	uint32_t now = millis();
+	uint32_t now = clock->millis();
 
 	if (now - lastConnectAttempt > 1000)
 	{
@@ -263,13 +321,14 @@ void SpaMQTT::subscribe()
 	mqttClient.subscribe((name + topic_target_temp"/set").c_str());
 	mqttClient.subscribe((name + topic_temp_units"/set").c_str());
 	mqttClient.subscribe((name + topic_ha_mode"/set").c_str());
+	mqttClient.subscribe((name + topic_desired_state"/set").c_str());
 }
 
 void SpaMQTT::callback(char* topic_, byte* payload, unsigned int length)
 {
-	char msg_buff[64];
+	char msg_buff[128];
 	
-	if (length >= 63)
+	if (length >= sizeof(msg_buff))
 		return;
 
 
@@ -290,25 +349,39 @@ void SpaMQTT::callback(char* topic_, byte* payload, unsigned int length)
 	}
 	else if (topic.endsWith(topic_ha_mode"/set"))
 	{
+		// the modes change several switches, planned together
+		SpaReconciler::DesiredState desired;
 		if (msg.equalsIgnoreCase("off"))
-			spaState->setPowerEnabled(false);
+		{
+			desired.set(SpaReconciler::FIELD_POWER, false);
+		}
 		else if (msg.equalsIgnoreCase("heat"))
 		{
-			spaState->setPowerEnabled(true);
-			spaState->setHeatingEnabled(true);
+			desired.set(SpaReconciler::FIELD_POWER, true);
+			desired.set(SpaReconciler::FIELD_HEATER, true);
 		}
 		else if (msg.equalsIgnoreCase("cool"))
 		{
-			spaState->setPowerEnabled(true);
-			spaState->setHeatingEnabled(false);
-			spaState->setFilterEnabled(false);
+			desired.set(SpaReconciler::FIELD_POWER, true);
+			desired.set(SpaReconciler::FIELD_HEATER, false);
+			desired.set(SpaReconciler::FIELD_FILTER, false);
 		}
 		else if (msg.equalsIgnoreCase("dry"))
 		{
-			spaState->setPowerEnabled(true);
-			spaState->setHeatingEnabled(false);
-			spaState->setFilterEnabled(true);
+			desired.set(SpaReconciler::FIELD_POWER, true);
+			desired.set(SpaReconciler::FIELD_HEATER, false);
+			desired.set(SpaReconciler::FIELD_FILTER, true);
 		}
+		if (!desired.empty())
+			spaState->setDesiredState(desired);
+	}
+	else if (topic.endsWith(topic_desired_state"/set"))
+	{
+		SpaReconciler::DesiredState desired;
+		if (desired.parse(msg))
+			spaState->setDesiredState(desired);
+		else
+			logger.addLine("MQTT: bad desired state " + msg);
 	}
 	else if (topic.endsWith(topic_heating_enabled"/set"))
 	{
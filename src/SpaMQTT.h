@@ -2,6 +2,7 @@
 #define MQTT_H
 
 #include "SpaState.h"
+#include "Clock.h"
 
 #include <ESP8266WiFi.h>
 #include <PubSubClient.h>
@@ -13,12 +14,24 @@ public:
 
 	virtual void handleSpaStateChange(const SpaState::ChangeEvent& c) override;
 	void setName(String n) { name = n + "/"; } 
+	void setServer(const String& host, uint16_t port);
+	void setClock(Clock* newClock) { clock = newClock ? newClock : &SystemClock::instance(); }
 	void loop();
 	void reconnect();
+	size_t getPendingChangeCount() const { return pendingChangeEvents.size(); }
+	bool isConnected() { return mqttClient.connected(); }
 
 	void sendHAMode();
 	void sendHAAction();
 	void sendHAFanMode();
+	void sendDiagnostics();
+
+	// topic and payload published for a state change,
+	// false for changes that have no topic
+	bool formatChange(SpaState::ChangeEvent::ChangeType type, String& topic, String& payload) const;
+	String getHAMode() const;
+	String getHAAction() const;
+	String getDiagnostics() const;
 
 
 	static void static_callback(char* topic, byte* payload, unsigned int length);
@@ -30,11 +43,18 @@ private:
 	void subscribe();
 private:
 	String name = String("default/");
+	String server;
 	SpaState* spaState;
+	Clock* clock = &SystemClock::instance();
 	WiFiClient wifiClient;
 	PubSubClient mqttClient;
 	std::set<SpaState::ChangeEvent> pendingChangeEvents;
 
+	uint32_t lastServiceTime = 0;
+	uint32_t lastServiceTimeMQTT = 0;
+	uint32_t lastPushTime = 0;
+	uint32_t lastConnectAttempt = 0;
+
 };
 
 #endif // MQTT_H
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef SPA_PROTOCOL_H
+#define SPA_PROTOCOL_H
+
+#include <stdint.h>
+
+// Board models of the display bus, the build flag picks one
+enum SpaModel
+{
+	SPA_MODEL_SBH10,  // -DSBH10, the default
+	SPA_MODEL_C17GH3  // -DC17GH3
+};
+
+// Everything of the display bus protocol that depends on the board
+// model. Each model is a specialization with the same members, all of
+// them compile time constants, so the decoder, the button presses and
+// the host tools are built for exactly one model. A new model needs a
+// specialization here and a build flag below.
+template<SpaModel Model>
+struct SpaProtocolTraits;
+
+template<>
+struct SpaProtocolTraits<SPA_MODEL_SBH10>
+{
+	static const char* name() { return "SB-H10"; }
+
+	// frames the main board sends to scan the buttons, the data line is
+	// pulled low during the next frame to press one. The buzzer bit is
+	// set, it is masked before comparing.
+	enum ButtonCode
+	{
+		CODE_POWER  = 0xFBFF,
+		CODE_UP     = 0xEFFF,
+		CODE_DOWN   = 0xFF7F,
+		CODE_FILTER = 0xFFFD,
+		CODE_HEATER = 0x7FFF,
+		CODE_BUBBLE = 0xFFF7,
+		CODE_FC     = 0xDFFF,
+		BUZZER_MASK = 0x0100
+	};
+
+	// select bits of the display slots, low in the frames of the slot
+	enum SelectBit
+	{
+		SELECT_DIGIT_0 = 6,
+		SELECT_DIGIT_1 = 5,
+		SELECT_DIGIT_2 = 11,
+		SELECT_DIGIT_3 = 2,
+		SELECT_LEDS    = 14
+	};
+
+	// bits of the LED frame, active low
+	enum LEDBit
+	{
+		LED_POWER        = 0,
+		LED_HEATER_RED   = 7,
+		LED_HEATER_GREEN = 9,
+		LED_BUBBLE       = 10,
+		LED_FILTER       = 12
+	};
+
+	// bits of the 7 segments in a digit frame, active low
+	// 15 14 13 12 11 10  9  8  7  6  5  4  3  2  1  0
+	// dp     a  b     d  c     e        g  f
+	enum SegmentBit
+	{
+		SEG_A = 13,
+		SEG_B = 12,
+		SEG_C = 9,
+		SEG_D = 10,
+		SEG_E = 7,
+		SEG_F = 3,
+		SEG_G = 4
+	};
+
+	// range of the target temperature
+	enum TemperatureLimit
+	{
+		MIN_CELSIUS    = 20,
+		MAX_CELSIUS    = 40,
+		MIN_FAHRENHEIT = 68,
+		MAX_FAHRENHEIT = 104
+	};
+	static int minTemperature(bool celsius) { return celsius ? MIN_CELSIUS : MIN_FAHRENHEIT; }
+	static int maxTemperature(bool celsius) { return celsius ? MAX_CELSIUS : MAX_FAHRENHEIT; }
+};
+
+// the C17GH3 builds have always used the SB-H10 tables, no difference
+// on the bus is known
+template<>
+struct SpaProtocolTraits<SPA_MODEL_C17GH3> : SpaProtocolTraits<SPA_MODEL_SBH10>
+{
+	static const char* name() { return "C17GH3"; }
+};
+
+#if defined(C17GH3)
+typedef SpaProtocolTraits<SPA_MODEL_C17GH3> SpaProtocol;
+#else
+typedef SpaProtocolTraits<SPA_MODEL_SBH10> SpaProtocol;
+#endif
+
+#endif
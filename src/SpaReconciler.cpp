@@ -0,0 +1,413 @@
+#include "SpaReconciler.h"
+#include "SpaState.h"
+#include "Log.h"
+
+extern Log logger;
+
+static bool parseSwitch(const String& value, bool& result)
+{
+	if (value.equalsIgnoreCase("on") || value.equalsIgnoreCase("true"))
+		result = true;
+	else if (value.equalsIgnoreCase("off") || value.equalsIgnoreCase("false"))
+		result = false;
+	else
+		return false;
+	return true;
+}
+
+void SpaReconciler::DesiredState::set(Field field, bool value)
+{
+	fields |= field;
+	if (value)
+		switches |= field;
+	else
+		switches &= ~field;
+}
+
+void SpaReconciler::DesiredState::setTarget(int value)
+{
+	fields |= FIELD_TARGET;
+	target = value;
+}
+
+bool SpaReconciler::DesiredState::set(const String& key, const String& value)
+{
+	bool on = false;
+	if (key == "target_temp")
+	{
+		if (0 == value.toInt())
+			return false;
+		setTarget(value.toInt());
+		return true;
+	}
+	if (key == "temp_units")
+	{
+		if (!value.equalsIgnoreCase("C") && !value.equalsIgnoreCase("F"))
+			return false;
+		set(FIELD_CELSIUS, value.equalsIgnoreCase("C"));
+		return true;
+	}
+	if (!parseSwitch(value, on))
+		return false;
+	if (key == "power")
+		set(FIELD_POWER, on);
+	else if (key == "filter")
+		set(FIELD_FILTER, on);
+	else if (key == "heating_enabled")
+		set(FIELD_HEATER, on);
+	else if (key == "bubbles")
+		set(FIELD_BUBBLES, on);
+	else
+		return false;
+	return true;
+}
+
+bool SpaReconciler::DesiredState::parse(const String& text)
+{
+	int from = 0;
+	while (from < (int)text.length())
+	{
+		int comma = text.indexOf(',', from);
+		if (comma < 0)
+			comma = text.length();
+		String pair = text.substring(from, comma);
+		int equals = pair.indexOf('=');
+		if (equals < 0)
+			return false;
+		String key = pair.substring(0, equals);
+		String value = pair.substring(equals + 1);
+		key.trim();
+		value.trim();
+		if (!set(key, value))
+			return false;
+		from = comma + 1;
+	}
+	return !empty();
+}
+
+String SpaReconciler::DesiredState::toString() const
+{
+	static const struct { Field field; const char* key; } switchKeys[] = {
+		{ FIELD_POWER, "power" }, { FIELD_FILTER, "filter" }, { FIELD_HEATER, "heating_enabled" },
+		{ FIELD_BUBBLES, "bubbles" } };
+
+	String str;
+	for (size_t i = 0; i < sizeof(switchKeys) / sizeof(switchKeys[0]); ++i)
+	{
+		if (!(fields & switchKeys[i].field))
+			continue;
+		if (str.length())
+			str += ",";
+		str += switchKeys[i].key;
+		str += (switches & switchKeys[i].field) ? "=on" : "=off";
+	}
+	if (fields & FIELD_CELSIUS)
+	{
+		if (str.length())
+			str += ",";
+		str += (switches & FIELD_CELSIUS) ? "temp_units=C" : "temp_units=F";
+	}
+	if (fields & FIELD_TARGET)
+	{
+		if (str.length())
+			str += ",";
+		str += "target_temp=" + String(target);
+	}
+	return str;
+}
+
+uint8_t SpaReconciler::readSwitches(SpaState& state)
+{
+	uint8_t switches = 0;
+	if (state.getPowerEnabled())
+		switches |= FIELD_POWER;
+	if (state.getFilterEnabled())
+		switches |= FIELD_FILTER;
+	if (state.getHeatingEnabled())
+		switches |= FIELD_HEATER;
+	if (state.getBubblesEnabled())
+		switches |= FIELD_BUBBLES;
+	if (state.getIsTempInC())
+		switches |= FIELD_CELSIUS;
+	return switches;
+}
+
+uint8_t SpaReconciler::press(uint8_t switches, uint8_t button)
+{
+	if (SpaState::BTN_POWER == button)
+	{
+		// everything is off after switching the power
+		return (switches ^ FIELD_POWER) & (FIELD_POWER | FIELD_CELSIUS);
+	}
+	if (!(switches & FIELD_POWER))
+		return switches;
+
+	switch (button)
+	{
+	case SpaState::BTN_FILTER:
+		// the heater needs the filter pump
+		switches ^= FIELD_FILTER;
+		if (!(switches & FIELD_FILTER))
+			switches &= ~FIELD_HEATER;
+		break;
+	case SpaState::BTN_HEATER:
+		switches ^= FIELD_HEATER;
+		if (switches & FIELD_HEATER)
+			switches |= FIELD_FILTER;
+		break;
+	case SpaState::BTN_BUBBLE:
+		switches ^= FIELD_BUBBLES;
+		break;
+	case SpaState::BTN_FC:
+		switches ^= FIELD_CELSIUS;
+		break;
+	default:
+		break;
+	}
+	return switches;
+}
+
+int SpaReconciler::plan(uint8_t switches, const DesiredState& desired, uint8_t* buttons, uint8_t* expected)
+{
+	static const uint8_t candidates[] = {
+		SpaState::BTN_POWER, SpaState::BTN_FILTER, SpaState::BTN_HEATER, SpaState::BTN_BUBBLE, SpaState::BTN_FC };
+	const uint8_t stateCount = SWITCH_FIELDS + 1;
+	const uint8_t mask = desired.fields & SWITCH_FIELDS;
+
+	// breadth first over all switch states, the first match is the
+	// shortest sequence
+	uint8_t parent[stateCount];
+	uint8_t via[stateCount];
+	bool seen[stateCount] = {};
+	uint8_t queue[stateCount];
+	uint8_t head = 0;
+	uint8_t tail = 0;
+	switches &= SWITCH_FIELDS;
+	seen[switches] = true;
+	queue[tail++] = switches;
+
+	while (head < tail)
+	{
+		uint8_t s = queue[head++];
+		if ((s & mask) == (desired.switches & mask))
+		{
+			int length = 0;
+			for (uint8_t t = s; t != switches; t = parent[t])
+				++length;
+			if (length > maxPlanLength)
+				return -1;
+			int i = length;
+			for (uint8_t t = s; t != switches; t = parent[t])
+			{
+				--i;
+				buttons[i] = via[t];
+				expected[i] = t;
+			}
+			return length;
+		}
+		for (size_t b = 0; b < sizeof(candidates); ++b)
+		{
+			uint8_t next = press(s, candidates[b]);
+			if (seen[next])
+				continue;
+			seen[next] = true;
+			parent[next] = s;
+			via[next] = candidates[b];
+			queue[tail++] = next;
+		}
+	}
+	return -1;
+}
+
+bool SpaReconciler::start(SpaState& state, const DesiredState& newDesired, uint32_t nowMS)
+{
+	desired = newDesired;
+	startMS = nowMS;
+	presses = 0;
+	replans = 0;
+	failure = nullptr;
+	status = STATUS_RUNNING;
+
+	if (desired.fields & FIELD_TARGET)
+	{
+		// the target temperature is only shown and set while the spa is on
+		if ((desired.fields & FIELD_POWER) && !(desired.switches & FIELD_POWER))
+		{
+			failure = "target temperature with the power off";
+			finish(STATUS_FAILED, nowMS);
+			return false;
+		}
+		desired.set(FIELD_POWER, true);
+		bool celsius = (desired.fields & FIELD_CELSIUS) ? (desired.switches & FIELD_CELSIUS) : state.getIsTempInC();
+		desired.target = constrain(desired.target, SpaProtocol::minTemperature(celsius), SpaProtocol::maxTemperature(celsius));
+	}
+
+	int length = plan(readSwitches(state), desired, buttons, expected);
+	if (length < 0)
+	{
+		failure = "no button sequence reaches the state";
+		finish(STATUS_FAILED, nowMS);
+		return false;
+	}
+	planLength = length;
+	plannedPresses = length;
+	step = 0;
+	phase = PHASE_PRESS;
+	phaseStartMS = nowMS;
+	logger.addLine("Reconcile " + desired.toString() + ": " + String(planLength) + " presses");
+	return true;
+}
+
+void SpaReconciler::stop()
+{
+	if (!isRunning())
+		return;
+	failure = "stopped";
+	status = STATUS_FAILED;
+	logger.addLine("Reconcile stopped");
+}
+
+bool SpaReconciler::replan(SpaState& state, uint32_t nowMS)
+{
+	if (replans >= maxReplans)
+	{
+		failure = "the display does not follow the presses";
+		finish(STATUS_FAILED, nowMS);
+		return false;
+	}
+	++replans;
+	int length = plan(readSwitches(state), desired, buttons, expected);
+	if (length < 0)
+	{
+		failure = "no button sequence reaches the state";
+		finish(STATUS_FAILED, nowMS);
+		return false;
+	}
+	planLength = length;
+	step = 0;
+	phase = PHASE_PRESS;
+	phaseStartMS = nowMS;
+	return true;
+}
+
+bool SpaReconciler::matches(SpaState& state) const
+{
+	uint8_t mask = desired.fields & SWITCH_FIELDS;
+	if ((readSwitches(state) & mask) != (desired.switches & mask))
+		return false;
+	return !(desired.fields & FIELD_TARGET) || state.getTargetTemperature() == desired.target;
+}
+
+void SpaReconciler::finish(Status newStatus, uint32_t nowMS)
+{
+	status = newStatus;
+	elapsedMS = nowMS - startMS;
+	if (STATUS_CONVERGED == status)
+	{
+		logger.addLine("Reconciled in " + String(presses) + " presses, " + String(elapsedMS) + " ms");
+	}
+	else
+	{
+		logger.addLine("Reconcile failed after " + String(presses) + " presses: " + failure);
+	}
+}
+
+bool SpaReconciler::loop(SpaState& state, uint32_t nowMS)
+{
+	if (!isRunning())
+		return false;
+
+	switch (phase)
+	{
+	case PHASE_PRESS:
+		// the previous press or one of a command is still sent
+		if (0 != state.btnRequest)
+			return false;
+		if (step < planLength)
+		{
+			state.writeButton((SpaState::ButtonT)buttons[step]);
+			++presses;
+			phase = PHASE_VERIFY;
+			phaseStartMS = nowMS;
+			return false;
+		}
+		if ((readSwitches(state) & desired.fields & SWITCH_FIELDS) != (desired.switches & desired.fields & SWITCH_FIELDS))
+			return !replan(state, nowMS);
+		if (matches(state))
+		{
+			finish(STATUS_CONVERGED, nowMS);
+			return true;
+		}
+		// the command queue steps the temperature and checks the display
+		if (!state.setTargetTemperature(desired.target))
+		{
+			failure = "the temperature command was refused";
+			finish(STATUS_FAILED, nowMS);
+			return true;
+		}
+		phase = PHASE_TEMPERATURE;
+		phaseStartMS = nowMS;
+		return false;
+
+	case PHASE_VERIFY:
+		if (readSwitches(state) == expected[step])
+		{
+			++step;
+			phase = PHASE_PRESS;
+			return false;
+		}
+		if (nowMS - phaseStartMS < pressTimeoutMS)
+			return false;
+		return !replan(state, nowMS);
+
+	case PHASE_TEMPERATURE:
+		if (matches(state))
+		{
+			finish(STATUS_CONVERGED, nowMS);
+			return true;
+		}
+		if (nowMS - phaseStartMS < temperatureTimeoutMS && state.getPendingCommandCount() > 0)
+			return false;
+		failure = "the target temperature was not reached";
+		finish(STATUS_FAILED, nowMS);
+		return true;
+	}
+	return false;
+}
+
+String SpaReconciler::toJson() const
+{
+	String str = "{\"status\":\"";
+	str += getStatusName(status);
+	str += "\",\"desired\":\"" + desired.toString() + "\"";
+	str += ",\"planned\":" + String(plannedPresses);
+	str += ",\"presses\":" + String(presses);
+	str += ",\"replans\":" + String(replans);
+	str += ",\"ms\":" + String(elapsedMS);
+	if (STATUS_FAILED == status && failure)
+	{
+		str += ",\"error\":\"";
+		str += failure;
+		str += "\"";
+	}
+	str += "}";
+	return str;
+}
+
+const char* SpaReconciler::getStatusName(Status status)
+{
+	switch (status)
+	{
+	case STATUS_IDLE:
+		return "idle";
+	case STATUS_RUNNING:
+		return "running";
+	case STATUS_CONVERGED:
+		return "converged";
+	case STATUS_FAILED:
+		return "failed";
+	default:
+		break;
+	}
+	return "unknown";
+}
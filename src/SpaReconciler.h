@@ -0,0 +1,124 @@
+#ifndef SPA_RECONCILER_H
+#define SPA_RECONCILER_H
+
+#include <Arduino.h>
+
+class SpaState;
+
+// Brings the spa to a desired state with as few button presses as
+// possible. The switches are planned together on a model of the main
+// board (the power turns everything off, the heater needs the filter),
+// so "filter off" with the heater on is one press and not two. Every
+// press waits until the display shows the state the model predicts,
+// a press that does not get there is planned again from what the
+// display shows. The target temperature is set last by the command
+// queue, the units have to be right before.
+class SpaReconciler
+{
+public:
+	// the fields a desired state sets, the others are left as they come
+	enum Field
+	{
+		FIELD_POWER   = 1 << 0,
+		FIELD_FILTER  = 1 << 1,
+		FIELD_HEATER  = 1 << 2,
+		FIELD_BUBBLES = 1 << 3,
+		FIELD_CELSIUS = 1 << 4,
+		FIELD_TARGET  = 1 << 5,
+		SWITCH_FIELDS = FIELD_POWER | FIELD_FILTER | FIELD_HEATER | FIELD_BUBBLES | FIELD_CELSIUS
+	};
+
+	struct DesiredState
+	{
+		uint8_t fields = 0;   // Field bits that are set
+		uint8_t switches = 0; // values of the switch fields, same bits
+		int target = 0;
+
+		void set(Field field, bool value);
+		void setTarget(int value);
+		// key power, filter, heating_enabled, bubbles, temp_units or
+		// target_temp with on/off, true/false, C/F or a number, false if
+		// unknown
+		bool set(const String& key, const String& value);
+		// comma separated key=value pairs
+		bool parse(const String& text);
+		bool empty() const { return 0 == fields; }
+		String toString() const;
+	};
+
+	enum Status
+	{
+		STATUS_IDLE,
+		STATUS_RUNNING,
+		STATUS_CONVERGED,
+		STATUS_FAILED
+	};
+
+	// a press waits this long for the display before the plan is redone
+	static const uint32_t pressTimeoutMS = 1500;
+	// plans after the first one before giving up
+	static const uint8_t maxReplans = 3;
+	// the temperature command gets this long
+	static const uint32_t temperatureTimeoutMS = 30000;
+	// more presses than this are never needed on the model
+	static const uint8_t maxPlanLength = 8;
+
+	// false if no button sequence reaches the state
+	bool start(SpaState& state, const DesiredState& desired, uint32_t nowMS);
+	void stop();
+	bool isRunning() const { return STATUS_RUNNING == status; }
+	// the command queue waits while the switches are pressed
+	bool isPressing() const { return isRunning() && PHASE_TEMPERATURE != phase; }
+
+	// advances the presses, called from SpaState::loop(), true when
+	// the status changed to converged or failed
+	bool loop(SpaState& state, uint32_t nowMS);
+
+	Status getStatus() const { return status; }
+	const DesiredState& getDesired() const { return desired; }
+	uint8_t getPlannedPresses() const { return plannedPresses; }
+	uint8_t getPresses() const { return presses; }
+	uint8_t getReplans() const { return replans; }
+	uint32_t getElapsedMS() const { return elapsedMS; }
+	String toJson() const;
+
+	static const char* getStatusName(Status status);
+
+	// the switch bits of the spa as the display shows them
+	static uint8_t readSwitches(SpaState& state);
+	// the switches after pressing a button, on the model of the main board
+	static uint8_t press(uint8_t switches, uint8_t button);
+	// shortest sequence of buttons from switches to the desired ones,
+	// the length or -1 if there is none
+	static int plan(uint8_t switches, const DesiredState& desired, uint8_t* buttons, uint8_t* expected);
+
+private:
+	enum Phase
+	{
+		PHASE_PRESS,      // waits until the bus is free, then presses
+		PHASE_VERIFY,     // for the display to show the predicted switches
+		PHASE_TEMPERATURE // the command queue sets the target temperature
+	};
+
+	bool replan(SpaState& state, uint32_t nowMS);
+	bool matches(SpaState& state) const;
+	void finish(Status newStatus, uint32_t nowMS);
+
+	DesiredState desired;
+	Status status = STATUS_IDLE;
+	Phase phase = PHASE_PRESS;
+	uint32_t startMS = 0;
+	uint32_t phaseStartMS = 0;
+	uint32_t elapsedMS = 0;
+
+	uint8_t buttons[maxPlanLength];
+	uint8_t expected[maxPlanLength];
+	uint8_t planLength = 0;
+	uint8_t step = 0;
+	uint8_t plannedPresses = 0; // of the first plan
+	uint8_t presses = 0;
+	uint8_t replans = 0;
+	const char* failure = nullptr;
+};
+
+#endif
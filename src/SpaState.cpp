@@ -1,45 +1,21 @@
 #include "SpaState.h"
 #include "Log.h"
+#include "SegmentDecoder.h"
 
-#include <OneWire.h>
-#include <DallasTemperature.h>
-#define PIN_DS18S20 D2
+#include <LittleFS.h>
 
-OneWire oneWireSpa(PIN_DS18S20);
-
-DallasTemperature externalTempSensor(&oneWireSpa);
-
-extern SpaState state;
 extern Log logger;
 
+const uint16_t SpaState::buttonCodes[7] = {
+	SpaProtocol::CODE_POWER,
+	SpaProtocol::CODE_UP,
+	SpaProtocol::CODE_DOWN,
+	SpaProtocol::CODE_FILTER,
+	SpaProtocol::CODE_HEATER,
+	SpaProtocol::CODE_BUBBLE,
+	SpaProtocol::CODE_FC };
 
-#define GPIO_IN ((volatile uint32_t*) 0x60000318)     //GPIO Read Register
-#define GPIO_OUT ((volatile uint32_t*) 0x60000300)    //GPIO Write Register
-
-#define GPIO_SET(pin) GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, 1 << pin)
-#define GPIO_CLR(pin) GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, 1 << pin)
-#define GPIO_READ_OUTPUT(pin) (GPIO_REG_READ(GPIO_OUT_ADDRESS) & (1 << pin))
-#define GPIO_READ(pin) (GPIO_REG_READ(GPIO_IN_ADDRESS) & (1 << pin))
-
-//#define GPIO16_SET() GPIO_SET(D8)
-//#define GPIO16_CLR() GPIO_CLR(D8)
-
-#define GPIO16_SET() (GP16O |=  1)
-#define GPIO16_CLR() (GP16O &= ~1)
-
-// clock the data bits into the buffer
-static void ICACHE_RAM_ATTR handleClockInterrupt()
-{
-	state.handleClockInterrupt();
-}
-
-static void ICACHE_RAM_ATTR handleLatchInterrupt()
-{
-	state.handleLatchInterrupt();
-}
-
-
-void SpaState::init(uint8_t clockPin, uint8_t latchPin, uint8_t dataInPin, uint8_t dataOutPin)
+void SpaState::initPins(uint8_t clockPin, uint8_t latchPin, uint8_t dataInPin, uint8_t dataOutPin)
 {
 	pinClock = clockPin;
 	pinLatch = latchPin;
@@ -53,19 +29,30 @@ void SpaState::init(uint8_t clockPin, uint8_t latchPin, uint8_t dataInPin, uint8
 
 	digitalWrite(D8, HIGH);
 	digitalWrite(pinDataOut, HIGH);
+}
 
-	attachInterrupt(digitalPinToInterrupt(pinClock), ::handleClockInterrupt, RISING);
-	attachInterrupt(digitalPinToInterrupt(pinLatch), ::handleLatchInterrupt, RISING);
-	
+void SpaState::initSensors()
+{
 	initialized = true;
-	externalTempSensor.begin();
-	int deviceCount = externalTempSensor.getDeviceCount();
-	logger.addLine("Temperature Sensors available: " + String(deviceCount));
-
-
-	externalTempSensor.setWaitForConversion(false);
-	//externalTempSensor.requestTemperatures();
+	initMS = clock->millis();
+	timingSavedMS = initMS;
+	if (timingPath.length())
+	{
+		bool loaded = commandTiming.load(LittleFS, timingPath);
+		logger.addLine(loaded ? "Command timing loaded" : "Command timing: defaults");
+	}
+	if (airTemperatureSensor)
+	{
+		airTemperatureSensor->begin();
+		int deviceCount = airTemperatureSensor->getDeviceCount();
+		logger.addLine("Temperature Sensors available: " + String(deviceCount));
+	}
+}
 
+void SpaState::enableInterrupts()
+{
+	if (interruptAttach)
+		(this->*interruptAttach)();
 }
 
 void SpaState::disableInterrupts()
@@ -74,115 +61,41 @@ void SpaState::disableInterrupts()
 	detachInterrupt(digitalPinToInterrupt(pinLatch));
 }
 
-void SpaState::handleClockInterrupt()
+// same as handleClockInterrupt, but with the data pin read at runtime
+// as it was before the handlers were specialized, for benchmarking
+void SpaState::handleClockInterruptReference()
 {
 	clkCount++;
 	clkBuf = clkBuf << 1; //Shift buffer along
 
-	if (bitRead(*GPIO_IN, pinDataIn) == 1)
+	if (bitRead(GPI, pinDataIn) == 1)
 		bitSet(clkBuf, 0); //Flip data bit in buffer if needed.
 }
 
-void SpaState::handleLatchInterrupt()
-{
-	// called at each latch
-	if (btnPulse)
-	{
-		// reset pulse
-		GPIO16_SET(); // pinDataOut
-		btnPulse = false;
-	} 
-	else if (clkCount == 16)
-	{
-		ringBufferPush(clkBuf);
-		simulateButtonPress();
-	}
-	// reset buffer
-	clkBuf = 0;
-	clkCount = 0;
-}
-
-bool SpaState::simulateButtonPress()
-{
-	if (0 != btnRequest)
-	{
-		uint16_t b = clkBuf | 0x0100; // mask buzzer
-
-		if (btnRequest == b)
-		{
-			// start button pulse (until next latch)
-			GPIO16_CLR();
-			btnPulse = true;
-			if (--btnCount <= 0)
-			{
-				btnRequest = 0;
-			}
-			return true;
-		}
-	}
-	return false;
-}
-
 void SpaState::readSegment(uint16_t msg, int seg)
 {
-	msg = ~msg;
-
-	// 7 seg bits
-	// 15 14 13 12 11 10  9  8  7  6  5  4  3  2  1  0
-	// dp     a  b     d  c     e        g  f
-
-	uint8_t gfedcba = 0;
-	gfedcba |= ((msg >> (13 - 0)) & 0x1); // a
-	gfedcba |= ((msg >> (12 - 1)) & 0x2); // b
-	gfedcba |= ((msg >> (9  - 2)) & 0x4); // c
-	gfedcba |= ((msg >> (10 - 3)) & 0x8); // d
-	gfedcba |= ((msg >> (7  - 4)) & 0x10); // e
-	gfedcba |= ((msg << (-3 + 5)) & 0x20); // f
-	gfedcba |= ((msg << (-4 + 6)) & 0x40); // g
-
-	if (gfedcba == 0x3F)
-		digit[seg] = '0';
-	else if (gfedcba == 0x06)
-		digit[seg] = '1';
-	else if (gfedcba == 0x5B)
-		digit[seg] = '2';
-	else if (gfedcba == 0x4F)
-		digit[seg] = '3';
-	else if (gfedcba == 0x66)
-		digit[seg] = '4';
-	else if (gfedcba == 0x6D)
-		digit[seg] = '5';
-	else if (gfedcba == 0x7D)
-		digit[seg] = '6';
-	else if (gfedcba == 0x07)
-		digit[seg] = '7';
-	else if (gfedcba == 0x7F)
-		digit[seg] = '8';
-	else if (gfedcba == 0x6F)
-		digit[seg] = '9';
-	else if (gfedcba == 0x67)
-		digit[seg] = '9';
-	else if (gfedcba == 0x39)
-		digit[seg] = 'C';
-	else if (gfedcba == 0x71)
-		digit[seg] = 'F';
-	else if (gfedcba == 0x79)
-		digit[seg] = 'E';
-	else if (gfedcba == 0x00)
-		digit[seg] = ' '; //blank
-
-	// if this is the last digit, decide what temp value this is
-	if (seg == 3)
-		classifyTemperature();
+	if (!SegmentDecoder::decode(msg, digit[seg]))
+		++unknownGlyphCount;
 }
 
 void SpaState::readLEDStates(uint16_t msg)
 {
-	setPowerEnabledInternal(bitRead(msg, LED_POWER) == 0); // LED_POWER
-	setBubblesEnabledInternal(bitRead(msg, LED_BUBBLE) == 0 ); // LED_BUBBLES
-	setIsHeatingInternal(bitRead(msg, LED_HEATER_RED) == 0);
-	setHeatingEnabledInternal(bitRead(msg, LED_HEATER_RED) == 0 || bitRead(msg, LED_HEATER_GREEN) == 0);
-	setFilterEnabledInternal(bitRead(msg, LED_FILTER) == 0);
+	// LEDs are active low
+	bool wasHeatingEnabled = getHeatingEnabled();
+	uint16_t changed = ledDebouncer.update(~msg);
+	if (0 == changed)
+		return;
+
+	if (bitRead(changed, LED_POWER))
+		emitChange(ChangeEvent::CHANGE_TYPE_POWER);
+	if (bitRead(changed, LED_BUBBLE))
+		emitChange(ChangeEvent::CHANGE_TYPE_BUBBLES);
+	if (bitRead(changed, LED_HEATER_RED))
+		emitChange(ChangeEvent::CHANGE_TYPE_HEATING);
+	if (wasHeatingEnabled != getHeatingEnabled())
+		emitChange(ChangeEvent::CHANGE_TYPE_HEATING_ENABLED);
+	if (bitRead(changed, LED_FILTER))
+		emitChange(ChangeEvent::CHANGE_TYPE_FILTER);
 }
 
 /*
@@ -242,129 +155,93 @@ functions are disabled.
 
 */
 
-void SpaState::classifyTemperature()
+uint8_t SpaState::classifyTemperature(uint32_t timestamp)
 {
-	if (digit[0] != ' ')
-	{ // non blank display
-		// remember the last valid temp reading
-		char tmpDigit[5];
-		for (int i = 0 ; i < 5; ++i)
-			tmpDigit[i] = digit[i];
-		lstTemp = atoi(tmpDigit);
+	uint8_t result = temperatureClassifier.update(digit, timestamp);
 
-		--dispCycles;
+	if (result & TemperatureClassifier::RESULT_UNITS)
+		setTemperatureUnitsInternal(temperatureClassifier.getIsCelsius());
 
-		if (dispCycles > 20 && dispCycles < 80)
-		{
-			targTempTmp = lstTemp;
-			targTempTmpValid = true;
-		}
-		else if (dispCycles <= 0)
-		{
-			// temperature, that is not followed by an empty display for 90 (>82) cycles, is the current temperature
-			if (curTempTmpValid)
-			{
-				if (curTemp != curTempTmp)
-					curTemp = curTempTmp;
-				// controller_current_temperature_changed_event(curTemp);
-				for (int i = 0; i < 4; ++i)
-				{
-					if ('F' == digit[i] || 'C' == digit[i])
-					{
-						setTemperatureUnitsInternal('C' == digit[i]);
-					}	
-				}
-			}
-			dispCycles = 0;
-			curTempTmp = lstTemp;
-			curTempTmpValid = true;
-			targTempTmpValid = false;
-		}
-		blankCount = 0;
+	if (result & TemperatureClassifier::RESULT_CURRENT)
+	{
+		latencyStats.record(LatencyStats::STAGE_CURRENT_DETECT, temperatureClassifier.getCurrentLatency());
+		setCurrentTemperatureInternal(temperatureClassifier.getCurrentTemperature());
 	}
-	else
-	{ 
-		if (blankCount > 0)
-		{
-			// blank display during blinking
-			// temperature before an blank display is the target temperature
-			int minTemp = getIsTempInC() ? 20 : 68;
-			int maxTemp = getIsTempInC() ? 40 : 104;
 
-			if (targTempTmpValid && minTemp <= targTempTmp && targTempTmp <= maxTemp)
-			{
-				setTargetTemperatureInternal(targTempTmp);
-			}
+	if (result & TemperatureClassifier::RESULT_TARGET)
+	{
+		int minTemp = SpaProtocol::minTemperature(getIsTempInC());
+		int maxTemp = SpaProtocol::maxTemperature(getIsTempInC());
+		int newTarget = temperatureClassifier.getTargetTemperature();
 
-			dispCycles = reqCycles;
-			curTempTmpValid = false;
+		if (minTemp <= newTarget && newTarget <= maxTemp)
+		{
+			latencyStats.record(LatencyStats::STAGE_TARGET_DETECT, temperatureClassifier.getTargetLatency());
+			setTargetTemperatureInternal(newTarget);
 		}
-		++blankCount;
 	}
+
+	return result;
 }
 
-void SpaState::writeButton(ButtonT button)
+void SpaState::writeButton(ButtonT button, uint8_t releaseScans)
 {
 	if (btnRequest == 0)
 	{
+		btnRelease = releaseScans;
+		btnCount = commandTiming.getPressCycles();
 		btnRequest = buttonCodes[button];
-		btnCount = btnCycles;
 	}
 }
 
 // controller: power_state_set, power_state_get, power_state_changed_event
-void SpaState::setPowerEnabled(bool power)
+bool SpaState::setPowerEnabled(bool power)
 {
-	Command c(Command::COMMAND_SET_POWER, power);
-	commands.push_back(c);
+	return queueCommand(Command(Command::COMMAND_SET_POWER, power));
 }
 
 
 bool SpaState::getPowerEnabled() const
 {
-	return isPowerEnabled;
+	return bitRead(ledDebouncer.getState(), LED_POWER);
 }
 
 // controller: pump_state_set, pump_state_get, pump_state_changed_event
-void SpaState::setFilterEnabled(bool newValue)
+bool SpaState::setFilterEnabled(bool newValue)
 {
-	Command c(Command::COMMAND_SET_FILTER, newValue);
-	commands.push_back(c);
+	return queueCommand(Command(Command::COMMAND_SET_FILTER, newValue));
 }
 
 bool SpaState::getFilterEnabled()
 {
-	return isFilterEnabled;
+	return bitRead(ledDebouncer.getState(), LED_FILTER);
 }
 
 // controller: current_heating_state_get, current_heating_state_changed_event
 bool SpaState::getIsHeating() const
 {
-	return isHeating;
+	return bitRead(ledDebouncer.getState(), LED_HEATER_RED);
 }
 
 // controller: target_heating_state_set, target_heating_state_get, target_heating_state_changed_event
 bool SpaState::getHeatingEnabled() const
 {
-	return isHeatingEnabled;
+	return (ledDebouncer.getState() & (bit(LED_HEATER_RED) | bit(LED_HEATER_GREEN))) != 0;
 }
 
-void SpaState::setHeatingEnabled(bool newValue)
+bool SpaState::setHeatingEnabled(bool newValue)
 {
-	Command c(Command::COMMAND_SET_HEATING, newValue);
-	commands.push_back(c);
-
+	return queueCommand(Command(Command::COMMAND_SET_HEATING, newValue));
 }
 
 bool SpaState::getBubblesEnabled() const
 {
-	return areBubblesEnabled;
+	return bitRead(ledDebouncer.getState(), LED_BUBBLE);
 }
 
-void SpaState::setBubblesEnabled(bool newValue)
+bool SpaState::setBubblesEnabled(bool newValue)
 {
-	Command c(Command::COMMAND_SET_BUBBLES, newValue);
-	commands.push_back(c);
+	return queueCommand(Command(Command::COMMAND_SET_BUBBLES, newValue));
 }
 
 void SpaState::setTemperatureUnitsInternal(bool isC)
@@ -375,7 +252,7 @@ void SpaState::setTemperatureUnitsInternal(bool isC)
 		
 		emitChange(ChangeEvent::CHANGE_TYPE_TEMP_UNITS);
 		
-		uint32_t timeNow = millis();
+		uint32_t timeNow = clock->millis();
 		if (timeNow - lastTemperatureUnitChangeMS < 500)
 		{
 			++numQuickTempUnitChanges;
@@ -405,10 +282,21 @@ bool SpaState::getIsTempInF() const
 	return !isCelsius;
 }
 
-void SpaState::setTempInC(bool newValue)
+bool SpaState::setTempInC(bool newValue)
 {
-	Command c(Command::COMMAND_SET_UNITS, newValue);
-	commands.push_back(c);
+	return queueCommand(Command(Command::COMMAND_SET_UNITS, newValue));
+}
+
+bool SpaState::getIsHibernating() const
+{
+	return 'E' == digit[0] && 'n' == digit[1] && 'd' == digit[2];
+}
+
+bool SpaState::wakeFromHibernation(bool heating)
+{
+	if (!getIsHibernating())
+		return false;
+	return queueCommand(Command(Command::COMMAND_WAKE, heating));
 }
 
 // controller: current_temperature_get, current_temperature_changed_event
@@ -423,114 +311,98 @@ float SpaState::getExternalTemperature() const
 }
 
 // controller: target_temperature_get,set,changed_event
-void SpaState::setTargetTemperature(int newValue)
+bool SpaState::setTargetTemperature(int newValue)
 {
-	if (getIsTempInC())
-	{
-		newValue = constrain(newValue, 20, 40);
-	}
-	else
-	{
-		newValue = constrain(newValue, 68, 104);
-	}
-	
-	if (getPowerEnabled())
-	{
-		Command c(Command::COMMAND_SET_TEMPERATURE, newValue);
-		commands.push_back(c);
-	}
-}
+	newValue = constrain(newValue, SpaProtocol::minTemperature(getIsTempInC()), SpaProtocol::maxTemperature(getIsTempInC()));
 
-int SpaState::getTargetTemperature() const
-{
-	return targTemp;
+	if (!getPowerEnabled())
+		return false;
+	return queueCommand(Command(Command::COMMAND_SET_TEMPERATURE, newValue));
 }
 
-
-void SpaState::setPowerEnabledInternal(bool newValue)
+bool SpaState::queueCommand(const Command& command)
 {
-	// make sure the value is the same two times
-	// in a row before allowing change
-	if (isPowerEnabledTmp != newValue)
-	{
-		isPowerEnabledTmp = newValue;
-		return;
-	}
-
-	if (isPowerEnabled != newValue)
+	if (command.isPowerOff())
 	{
-		isPowerEnabled = newValue;
-		emitChange(ChangeEvent::CHANGE_TYPE_POWER);
+		// the spa does not take the other buttons once it is off
+		for (int i = commands.size() - 1; i >= 0; --i)
+		{
+			if (commands[i].needsPower())
+			{
+				commands.removeAt(i);
+				++commandStats.preempted;
+			}
+		}
 	}
-}
 
-void SpaState::setIsHeatingInternal(bool newValue)
-{
-	// make sure the value is the same two times
-	// in a row before allowing change
-	if (isHeatingTmp != newValue)
+	// a burst of set temperature messages ends up as one command
+	for (uint8_t i = 0; i < commands.size(); ++i)
 	{
-		isHeatingTmp = newValue;
-		return;
+		if (commands[i].getType() == command.getType())
+		{
+			commands[i].retarget(command);
+			++commandStats.coalesced;
+			return true;
+		}
 	}
 
-	if (isHeating != newValue)
+	Command timed(command);
+	timed.applyTiming(commandTiming);
+	bool queued = command.isPowerOff() ? commands.pushFront(timed) : commands.pushBack(timed);
+	if (!queued)
 	{
-		isHeating = newValue;
-		emitChange(ChangeEvent::CHANGE_TYPE_HEATING);
+		++commandStats.rejected;
+		logger.addLine("Command queue full");
+		return false;
 	}
+	++commandStats.queued;
+	return true;
 }
 
-void SpaState::setHeatingEnabledInternal(bool newValue)
+bool SpaState::setDesiredState(const SpaReconciler::DesiredState& desired)
 {
-	// make sure the value is the same two times
-	// in a row before allowing change
-	if (isHeatingEnabledTmp != newValue)
-	{
-		isHeatingEnabledTmp = newValue;
-		return;
-	}
+	if (commandBenchmark.isRunning())
+		return false;
 
-	if (isHeatingEnabled != newValue)
+	// the reconciler plans these fields together
+	static const struct { uint8_t field; Command::CommandType type; } covered[] = {
+		{ SpaReconciler::FIELD_POWER, Command::COMMAND_SET_POWER },
+		{ SpaReconciler::FIELD_FILTER, Command::COMMAND_SET_FILTER },
+		{ SpaReconciler::FIELD_HEATER, Command::COMMAND_SET_HEATING },
+		{ SpaReconciler::FIELD_BUBBLES, Command::COMMAND_SET_BUBBLES },
+		{ SpaReconciler::FIELD_CELSIUS, Command::COMMAND_SET_UNITS },
+		{ SpaReconciler::FIELD_TARGET, Command::COMMAND_SET_TEMPERATURE } };
+	for (int i = commands.size() - 1; i >= 0; --i)
 	{
-		isHeatingEnabled = newValue;
-		emitChange(ChangeEvent::CHANGE_TYPE_HEATING_ENABLED);
+		for (size_t f = 0; f < sizeof(covered) / sizeof(covered[0]); ++f)
+		{
+			if ((desired.fields & covered[f].field) && commands[i].getType() == covered[f].type)
+			{
+				commands.removeAt(i);
+				++commandStats.coalesced;
+				break;
+			}
+		}
 	}
-}
 
+	bool started = reconciler.start(*this, desired, clock->millis());
+	if (!started)
+		emitChange(ChangeEvent::CHANGE_TYPE_RECONCILE);
+	return started;
+}
 
-void SpaState::setFilterEnabledInternal(bool newValue)
+int SpaState::getTargetTemperature() const
 {
-	// make sure the value is the same two times
-	// in a row before allowing change
-	if (isFilterEnabledTmp != newValue)
-	{
-		isFilterEnabledTmp = newValue;
-		return;
-	}
-
-	if (isFilterEnabled != newValue)
-	{
-		isFilterEnabled = newValue;
-		emitChange(ChangeEvent::CHANGE_TYPE_FILTER);
-	}
+	return targTemp;
 }
 
 
-void SpaState::setBubblesEnabledInternal(bool newValue)
+void SpaState::setCurrentTemperatureInternal(int newValue)
 {
-	// make sure the value is the same two times
-	// in a row before allowing change
-	if (areBubblesEnabledTmp != newValue)
-	{
-		areBubblesEnabledTmp = newValue;
-		return;
-	}
-
-	if (areBubblesEnabled != newValue)
+	if (curTemp != newValue)
 	{
-		areBubblesEnabled = newValue;
-		emitChange(ChangeEvent::CHANGE_TYPE_BUBBLES);
+		curTemp = newValue;
+		emitChange(ChangeEvent::CHANGE_TYPE_TEMP);
 	}
 }
 
@@ -554,218 +426,197 @@ void SpaState::setAirTemperatureInternal(float newValue)
 }
 
 
-void SpaState::processMessages()
+void SpaState::processDisplayFrame(const DisplayFrame& frame)
 {
-	// process messages
-	uint16_t msg = 0;
+	bool changed = false;
 
-	while (ringBufferPop(msg))
+	// only decode the slots that changed since the previous refresh
+	for (int seg = 0; seg < 4; ++seg)
 	{
-		uint16_t b = msg | 0x0100;                       // mask buzzer
-
-		bool isButton = false;
-		for (int i = 0; i < 7; ++i)
+		if (!lastDisplayFrameValid || frame.raw[seg] != lastDisplayFrame.raw[seg])
 		{
-			if (b == buttonCodes[i])
-				isButton = true;
+			readSegment(frame.raw[seg], seg);
+			changed = true;
 		}
-		if (!isButton)
+		else
 		{
-			if (bitRead(msg, 6) == 0)
-				readSegment(msg, 0);
-			else if (bitRead(msg, 5) == 0)
-				readSegment(msg, 1);
-			else if (bitRead(msg, 11) == 0)
-				readSegment(msg, 2);
-			else if (bitRead(msg, 2) == 0)
-				readSegment(msg, 3);
-			else if (bitRead(msg, 14) == 0)
-				readLEDStates(msg);
+			++cachedFrameCount;
 		}
 	}
-}
 
-void SpaState::startStopTest(String type)
-{
-	if (type == "power")
-		testType = OPERATION_SET_POWER;
-	else if (type == "units")
-		testType = OPERATION_SET_UNITS;
-	else if (type == "temp")
-		testType = OPERATION_SET_TEMPERATURE;
+	// decide what temp value this is, the state also changes with time
+	TemperatureClassifier::DisplayState displayState = temperatureClassifier.getState();
+	int blinkingValue = temperatureClassifier.getBlinkingValue();
+	int shownValue = temperatureClassifier.getShownValue();
+	// a commit can come with a refresh that repeats the previous one,
+	// the units are taken on the second frame of the new glyph
+	if (classifyTemperature(frame.timestamp) != 0 ||
+		temperatureClassifier.getState() != displayState || temperatureClassifier.getBlinkingValue() != blinkingValue ||
+		temperatureClassifier.getShownValue() != shownValue)
+		changed = true;
 
-	if (!testRunning)
+	// a repeated LED frame changes nothing once the debouncer settled
+	bool ledsRepeated = lastDisplayFrameValid && frame.getLEDs() == lastDisplayFrame.getLEDs();
+	if (ledsRepeated && ledDebouncer.isSettled())
 	{
-		testRunning = true;
+		++cachedFrameCount;
 	}
 	else
 	{
-		testRunning = false;
+		readLEDStates(frame.getLEDs());
+		changed = true;
 	}
-	
+
+	if (changed)
+		++displayChangeCount;
+
+	lastDisplayFrame = frame;
+	lastDisplayFrameValid = true;
 }
 
-class SpaTest
+void SpaState::processMessages()
 {
-public:
-	void setTestType(SpaState::OperationType type)
+	// process messages
+	BusFrame frame;
+	uint32_t baseCycles = ESP.getCycleCount();
+	uint32_t baseMicros = micros();
+
+	while (ringBuffer.pop(frame))
 	{
-		testType = type;
+		// convert cycle counts to micros() so events can be traced
+		// after the cycle counter wrapped
+		uint32_t popCycles = ESP.getCycleCount();
+		framePopMicros = baseMicros + (popCycles - baseCycles) / clockCyclesPerMicrosecond();
+		frameLatchMicros = framePopMicros - (popCycles - frame.cycles) / clockCyclesPerMicrosecond();
+		frameTraced = true;
+		latencyStats.record(LatencyStats::STAGE_RING, framePopMicros - frameLatchMicros);
+
+		CaptureRecord record = { frameLatchMicros, frame.data, (uint8_t)(frame.gap ? FrameCapture::CAPTURE_FLAG_GAP : 0) };
+		if (frameRecorder.isRecording())
+			frameRecorder.add(record);
+		processFrame(record);
 	}
+	frameTraced = false;
+}
+
+void SpaState::processFrame(const CaptureRecord& record)
+{
+	uint16_t msg = record.data;
+	displayGap = displayGap || (record.flags & FrameCapture::CAPTURE_FLAG_GAP);
+
+	uint16_t b = msg | SpaProtocol::BUZZER_MASK;
 
-	void reset(bool all)
+	bool isButton = false;
+	for (int i = 0; i < 7; ++i)
 	{
-		testNumTries = 0;
-		testSuccessCount = 0;
-		testFailCount = 0;
-		cmdTimeAvg = 0;
-		cmdTimeMin = 0;
-		cmdTimeMax = 0;
-		if (all)
-		{
-			testItr = 0;
-			cmdDelay = 0;
-		}
+		if (b == buttonCodes[i])
+			isButton = true;
 	}
-
-	bool loop()
+	if (isButton)
 	{
-		if (testType!= SpaState::OPERATION_SET_POWER &&
-		testType != SpaState::OPERATION_SET_TEMPERATURE &&
-		testType!= SpaState::OPERATION_SET_UNITS)
-			return false;
-		// test results:
-		// power: 200 timeout, 500 delay
-		// C/F:  500 timeout 300 delay
-		// set temp: 550 timeout, 0 delay
-		bool running = true;
-		uint32_t timeNow = millis();
+		++buttonEchoCount;
+	}
+	else
+	{
+		int slot = DisplayFrame::slotOf(msg);
+		if (slot < 0)
+			return;
 
-		if (!testTryStarted)
+		DisplayFrameAssembler::Result result = displayAssembler.add(slot, msg, record.micros, displayGap);
+		displayGap = false;
+		if (DisplayFrameAssembler::RESULT_COMPLETE == result)
 		{
-			if ((timeNow - cmdLastMS) > cmdDelay)
-			{
-				bool bVal = false;
-				int iVal = 0;
-				if (testType == SpaState::OPERATION_SET_POWER)
-					bVal = state.getPowerEnabled();
-				else if (testType == SpaState::OPERATION_SET_TEMPERATURE)
-					iVal = state.getTargetTemperature();
-				else if (testType == SpaState::OPERATION_SET_UNITS)
-					bVal = state.getIsTempInC();
-					
-				testValueExpectedBool = !bVal;
-				if (iVal % 2 == 0)
-					testValueExpectedInt = iVal + 1;
-				else
-					testValueExpectedInt = iVal - 1;
-				//logger.addLine("TargetTemp: " + String(testValueExpectedInt));
-				
-				cmdLastMS = timeNow;
-				testTryStarted = true;
-
-				//logger.addLine("TEST START: " + String(timeNow));
-
-				if (testType == SpaState::OPERATION_SET_POWER)
-					state.setPowerEnabled(testValueExpectedBool);
-				else if (testType == SpaState::OPERATION_SET_TEMPERATURE)
-					state.setTargetTemperature(testValueExpectedInt);
-				else if (testType == SpaState::OPERATION_SET_UNITS)
-					state.setTempInC(testValueExpectedBool);
-				
-			}
+			refreshLatchMicros = displayAssembler.getFrame().timestamp;
+			processDisplayFrame(displayAssembler.getFrame());
 		}
-		else
-		{
-			uint32_t testTime = timeNow - cmdLastMS;
-			
-			if (testTime < cmdTimeout)
-			{
-				bool matches = false;
-				if (testType == SpaState::OPERATION_SET_POWER)
-					matches = (state.getPowerEnabled() == testValueExpectedBool);
-				else if (testType == SpaState::OPERATION_SET_TEMPERATURE)
-					matches = (state.getTargetTemperature() == testValueExpectedInt);
-				else if (testType == SpaState::OPERATION_SET_UNITS)
-					matches = (state.getIsTempInC() == testValueExpectedBool);
-
-				if (matches)
-				{
-					// success
-					++testSuccessCount;
-					++testNumTries;
-					testTryStarted = false;
-					cmdLastMS = timeNow;
-
-					if (testTime < cmdTimeMin || cmdTimeMin == 0)
-						cmdTimeMin = testTime;
-					if (testTime > cmdTimeMax)
-						cmdTimeMax = testTime;
-					cmdTimeAvg += testTime;
-
+	}
+}
 
-					//logger.addLine("TEST: Success to " + String(testValueExpectedBool));
+void SpaState::processReplay()
+{
+	CaptureRecord record;
+	while (frameReplay.next(micros(), record))
+		processFrame(record);
 
-				}
-			}
-			else
-			{
-				//logger.addLine("TEST: timeout");
-				//logger.addLine("TEST END: " + String(timeNow));
+	if (!frameReplay.isRunning())
+	{
+		logger.addLine("Replay finished: " + String(frameReplay.getRecordCount()) + " frames");
+		displayGap = true;
+		enableInterrupts();
+	}
+}
 
-				++testFailCount;
-				++testNumTries;
-				testTryStarted = false;
-				cmdLastMS = 0;
-			}
-		}
-		
-		if (testNumTries >= testMaxTries)
-		{
-			// print test results
-			String testStr = "TEST " + String(testItr) + ": ";
-			testStr += "Success = " + String(testSuccessCount) + ", ";
-			testStr += "Fail = " + String(testFailCount) + ", ";
-			testStr += "AvgTime = " + (testSuccessCount ? String( cmdTimeAvg/testSuccessCount ) : String("N/A")) + ", ";
-			testStr += "MinTime = " + String(cmdTimeMin) + ", ";
-			testStr += "MaxTime = " + String(cmdTimeMax) + ", " ;
-			testStr += "Delay = " + String(cmdDelay) ;
+bool SpaState::startCapture(const String& path)
+{
+	if (frameReplay.isRunning())
+		return false;
+	bool started = frameRecorder.start(LittleFS, path, SPA_CAPTURE_MAX_BYTES);
+	logger.addLine(String(started ? "Capture started: " : "Capture failed: ") + path);
+	return started;
+}
 
-			logger.addLine(testStr);
+void SpaState::stopCapture()
+{
+	if (!frameRecorder.isRecording())
+		return;
+	frameRecorder.stop();
+	logger.addLine("Capture stopped: " + String(frameRecorder.getRecordCount()) + " frames, " +
+		String(frameRecorder.getBytes()) + " bytes");
+}
 
-			++testItr;
-			cmdDelay += 50;
+bool SpaState::startReplay(const String& path, uint32_t fromSeconds)
+{
+	stopCapture();
+	if (!frameReplay.start(LittleFS, path, micros(), fromSeconds * 1000000ULL))
+	{
+		logger.addLine("Replay failed: " + path);
+		return false;
+	}
 
-			reset(false);
+	// the capture replaces the bus until it is finished
+	disableInterrupts();
+	displayGap = true;
+	logger.addLine("Replay started: " + path + (fromSeconds ? " at " + String(fromSeconds) + " s" : String()));
+	return true;
+}
 
+void SpaState::stopReplay()
+{
+	if (!frameReplay.isRunning())
+		return;
+	frameReplay.stop();
+	processReplay();
+}
 
-			if (testItr == 6)
-			{
-				reset(true);
-				running = false;
-			}
-			testTryStarted = false;
-		}
-		return running;
-	}
+SpaState::BusStats SpaState::getBusStats() const
+{
+	BusStats stats;
+	stats.frames = frameCount;
+	stats.shortFrames = shortFrameCount;
+	stats.longFrames = longFrameCount;
+	stats.droppedFrames = ringBuffer.getOverflowCount();
+	stats.framesPerSecond = framesPerSecond;
+	stats.buttonEchoes = buttonEchoCount;
+	stats.injectedPresses = injectedPressCount;
+	stats.unknownGlyphs = unknownGlyphCount;
+	stats.cachedFrames = cachedFrameCount;
+	stats.displayFrames = displayAssembler.getCompleteCount();
+	stats.tornDisplayFrames = displayAssembler.getTornCount();
+	return stats;
+}
 
-	SpaState::OperationType testType = SpaState::OPERATION_NONE;
-	bool testTryStarted = false;
-	uint32_t cmdTimeout = 1500;
-	uint32_t cmdDelay = 0;
-	uint32_t cmdLastMS = 0;
-	int testItr = 0;
-	int testNumTries = 0;
-	const int testMaxTries = 20;
-	int testFailCount = 0;
-	int testSuccessCount = 0;
-	bool testValueExpectedBool = false;
-	int testValueExpectedInt = 0;
-	uint32_t cmdTimeMin = 0;
-	uint32_t cmdTimeMax = 0;
-	uint32_t cmdTimeAvg = 0;
+void SpaState::resetCommandTiming()
+{
+	commandTiming.reset();
+	logger.addLine("Command timing reset");
+}
 
-};
+bool SpaState::startBenchmark(const CommandBenchmark::Config& config)
+{
+	if (commandBenchmark.isRunning())
+		return false;
+	return commandBenchmark.start(config, clock->millis());
+}
 
 
 void SpaState::loop()
@@ -773,187 +624,353 @@ void SpaState::loop()
 	if (!initialized)
 		return;
 
-	if (!targetTempInitialized && millis() > 10000)
+	if (!targetTempInitialized && clock->millis() - initMS > 10000)
 	{
 		// this will cause target temp
 		writeButton(BTN_DOWN);
 		targetTempInitialized = true;
 	}
 
-	processMessages();
+	if (frameReplay.isRunning())
+		processReplay();
+	else
+		processMessages();
 
-	// process commands
-	if (!commands.empty())
 	{
-		commands.front().process();
-		
-		if (commands.front().isFinished())
-			commands.erase(commands.begin());
+		uint32_t timeNow = clock->millis();
+		if (timeNow - fpsLastMS >= 1000)
+		{
+			uint32_t frames = frameCount;
+			framesPerSecond = (frames - fpsFrameCount) * 1000 / (timeNow - fpsLastMS);
+			fpsFrameCount = frames;
+			fpsLastMS = timeNow;
+		}
 	}
 
+	if (reconciler.loop(*this, clock->millis()))
+		emitChange(ChangeEvent::CHANGE_TYPE_RECONCILE);
+
+	// process commands, they wait while the reconciler presses
+	if (!commands.empty() && !reconciler.isPressing() && 0 == btnRequest)
 	{
-		const int tempCheckInterval = 10000;
-		static uint32_t airTempWaitTime = tempCheckInterval;
-		uint32_t timeNow = millis();
+		if (commands.front().needsPower() && !getPowerEnabled())
+		{
+			// the spa went off since it was queued
+			commands.popFront();
+			++commandStats.preempted;
+		}
+		else
+		{
+			commands.front().process(*this, clock->millis());
+
+			if (commands.front().isFinished())
+				commands.popFront();
+		}
+	}
+
+	if (airTemperatureSensor)
+	{
+		uint32_t timeNow = clock->millis();
 		if (timeNow - timeLastAirTempCmd > airTempWaitTime)
 		{
-			if (airTempWaitTime == tempCheckInterval)
+			if (airTempWaitTime == airTempCheckInterval)
 			{
-				externalTempSensor.requestTemperatures();
-				airTempWaitTime = externalTempSensor.millisToWaitForConversion(12);
+				airTempWaitTime = airTemperatureSensor->requestTemperature();
 			}
 			else
 			{
-				if (externalTempSensor.isConversionComplete())
+				if (airTemperatureSensor->isConversionComplete())
 				{
-					float airtemp = isCelsius ? externalTempSensor.getTempCByIndex(0) :
-						externalTempSensor.getTempFByIndex(0);
-					setAirTemperatureInternal(airtemp);
+					setAirTemperatureInternal(airTemperatureSensor->getTemperature(isCelsius));
 				}
 				
-				airTempWaitTime = tempCheckInterval;
+				airTempWaitTime = airTempCheckInterval;
 			}
 			timeLastAirTempCmd = timeNow;
 		}
 	}
 	
-	static SpaTest spaTest;
-	if (testRunning)
+	commandBenchmark.loop(*this, clock->millis());
+
+	if (timingPath.length() && commandTiming.isDirty() && clock->millis() - timingSavedMS > SPA_TIMING_SAVE_INTERVAL_MS)
 	{
-		spaTest.setTestType(testType);
-		testRunning = spaTest.loop();
+		// a few writes an hour at most, the flash wears
+		if (!commandTiming.save(LittleFS, timingPath))
+			logger.addLine("ERROR: unable to save " + timingPath);
+		timingSavedMS = clock->millis();
 	}
-	else
+}
+
+
+
+
+void SpaState::Command::press(SpaState& state, ButtonT button, uint8_t releaseScans)
+{
+	pressShowable = canShowPress(state);
+	state.writeButton(button, releaseScans);
+	commandStartTime = coroutine.nowMS;
+	commandTries++;
+}
+
+bool SpaState::Command::canShowPress(SpaState& state) const
+{
+	if (COMMAND_SET_POWER == commandType)
+		return true;
+	if (!state.getPowerEnabled())
+		return false;
+	return COMMAND_WAKE == commandType || !state.getIsHibernating();
+}
+
+void SpaState::Command::recordLatency(SpaState& state, uint32_t ms)
+{
+	if (!timingFixed)
+		state.commandTiming.recordLatency(getTimingType(), ms);
+}
+
+// a press the spa could not show says nothing about the timing
+void SpaState::Command::recordLoss(SpaState& state)
+{
+	if (timingFixed || !pressShowable)
+		return;
+	state.commandTiming.recordLoss(getTimingType());
+	applyTiming(state.commandTiming);
+}
+
+bool SpaState::Command::readSwitch(SpaState& state) const
+{
+	switch (commandType)
 	{
-		spaTest.reset(true);
+	case COMMAND_SET_POWER:
+		return state.getPowerEnabled();
+	case COMMAND_SET_HEATING:
+		return state.getHeatingEnabled();
+	case COMMAND_SET_FILTER:
+		return state.getFilterEnabled();
+	case COMMAND_SET_BUBBLES:
+		return state.getBubblesEnabled();
+	case COMMAND_SET_UNITS:
+		return state.getIsTempInC();
+	default:
+		return commandBoolValue;
+	}
+}
+
+SpaState::ButtonT SpaState::Command::getSwitchButton() const
+{
+	switch (commandType)
+	{
+	case COMMAND_SET_POWER:
+		return BTN_POWER;
+	case COMMAND_SET_HEATING:
+		return BTN_HEATER;
+	case COMMAND_SET_FILTER:
+		return BTN_FILTER;
+	case COMMAND_SET_BUBBLES:
+		return BTN_BUBBLE;
+	default:
+		return BTN_FC;
 	}
-	
 }
 
+// Presses the button of the switch until the display shows the value.
+void SpaState::Command::runSwitch(SpaState& state)
+{
+	COROUTINE_BEGIN(coroutine);
+	while (readSwitch(state) != commandBoolValue && commandTries < commandRetries)
+	{
+		// a late confirmation of the previous press shows before the next one
+		COROUTINE_SLEEP(coroutine, commandStartTime, getRetryPause());
+		if (readSwitch(state) == commandBoolValue)
+			break;
+		press(state, getSwitchButton());
+		COROUTINE_AWAIT(coroutine, readSwitch(state) == commandBoolValue, commandStartTime, commandTimeout);
+		if (readSwitch(state) == commandBoolValue)
+			recordLatency(state, coroutine.nowMS - commandStartTime);
+		else
+			recordLoss(state);
+	}
+	COROUTINE_END(coroutine);
+}
 
-void SpaState::Command::process()
+bool SpaState::Command::isAwake(SpaState& state) const
 {
-	if (state.btnRequest != 0)
-		return;
+	return !state.getIsHibernating() && state.getFilterEnabled();
+}
 
-	if (finished)
-		return;
+// After 72 hours of heating the board hibernates and shows END, the
+// filter button wakes it with the filter on. The heater stays off, it
+// is switched on again if the command value is set. The presses use the
+// filter timing.
+void SpaState::Command::runWake(SpaState& state)
+{
+	COROUTINE_BEGIN(coroutine);
+	while (!isAwake(state) && commandTries < commandRetries)
+	{
+		COROUTINE_SLEEP(coroutine, commandStartTime, getRetryPause());
+		if (isAwake(state))
+			break;
+		press(state, BTN_FILTER);
+		COROUTINE_AWAIT(coroutine, isAwake(state), commandStartTime, commandTimeout);
+		if (isAwake(state))
+			recordLatency(state, coroutine.nowMS - commandStartTime);
+		else
+			recordLoss(state);
+	}
+	if (!isAwake(state))
+		COROUTINE_EXIT(coroutine);
 
-	uint32_t timeNow = millis();
+	commandTries = 0;
+	while (commandBoolValue && !state.getHeatingEnabled() && commandTries < commandRetries)
+	{
+		COROUTINE_SLEEP(coroutine, commandStartTime, getRetryPause());
+		if (state.getHeatingEnabled())
+			break;
+		press(state, BTN_HEATER);
+		COROUTINE_AWAIT(coroutine, state.getHeatingEnabled(), commandStartTime, commandTimeout);
+		if (state.getHeatingEnabled())
+			recordLatency(state, coroutine.nowMS - commandStartTime);
+		else
+			recordLoss(state);
+	}
+	COROUTINE_END(coroutine);
+}
 
-	if (!commandTryStarted)
+// The first up or down press makes the display blink the target
+// temperature, each further press changes it by one. Instead of waiting
+// for every step, up to burstWindow presses are sent back to back and
+// the blinking value on the display tells how many of them the board
+// took. Presses that are not shown within the timeout are taken as
+// lost, the window is halved then, so the presses follow the rate the
+// board takes them. A value past the target is corrected in the other
+// direction once the presses in flight are shown. The command is done
+// when the target is committed.
+void SpaState::Command::runTemperature(SpaState& state)
+{
+	COROUTINE_BEGIN(coroutine);
+	for (;;)
 	{
-		if (timeNow - commandStartTime > commandDelay)
+		// a press in flight may still make the display blink
+		COROUTINE_AWAIT(coroutine, isSettingMode(state), commandStartTime,
+			commandTimeout > setModeTimeoutMS ? commandTimeout : setModeTimeoutMS);
+		if (!isSettingMode(state))
 		{
-			bool bVal = commandBoolValue;
-			int iVal = commandIntValue;
-			ButtonT button = BTN_DOWN;
-			if (commandType == COMMAND_SET_TEMPERATURE)
-			{
-				iVal = state.getTargetTemperature();
-			
-				if (iVal > commandIntValue)
-				{
-					button = BTN_DOWN;
-					commandIntStepValue = iVal - 1;
-				}
-				else if (iVal < commandIntValue)
-				{
-					button = BTN_UP;
-					commandIntStepValue = iVal + 1;
-				}
-
-			}
-			else if (commandType == COMMAND_SET_POWER)
-			{
-				bVal = state.getPowerEnabled();
-				button = BTN_POWER;
-			}
-			else if (commandType == COMMAND_SET_UNITS)
-			{
-				bVal = state.getIsTempInC();
-				button = BTN_FC;
-			}
-			else if (commandType == COMMAND_SET_BUBBLES)
-			{
-				bVal = state.getBubblesEnabled();
-				button = BTN_BUBBLE;
-			}
-			else if (commandType == COMMAND_SET_FILTER)
-			{
-				bVal = state.getFilterEnabled();
-				button = BTN_FILTER;
-			}
-			else if (commandType == COMMAND_SET_HEATING)
-			{
-				bVal = state.getHeatingEnabled();
-				button = BTN_HEATER;
-			}
+			if (state.getTargetTemperature() == commandIntValue || commandTries >= commandRetries)
+				COROUTINE_EXIT(coroutine);
+			// the board is not in the setting mode, the press shows the target
+			press(state, commandIntValue > state.getTargetTemperature() ? BTN_UP : BTN_DOWN, 1);
+			continue;
+		}
 
-			if (bVal != commandBoolValue || iVal != commandIntValue)
-			{
-				commandTryStarted = true;
-				state.writeButton(button);
-				commandStartTime = timeNow;
-				commandTries++;
-			}
+		shownValue = state.getBlinkingTemperature();
+		burstPending = 0;
+		burstProgressTime = coroutine.nowMS;
+		burstBlank = false;
+		// until the board leaves the setting mode
+		while (followBurst(state))
+		{
+			if (isBurstDone(state))
+				COROUTINE_EXIT(coroutine);
+			if (pressBurst(state))
+				COROUTINE_YIELD(coroutine);
+			else if (!coroutine.elapsed(commandStartTime, commandDelay))
+				COROUTINE_AWAIT_CHANGE(coroutine, commandStartTime, commandDelay);
 			else
-			{
-				finished = true;
-			}
-			
+				COROUTINE_AWAIT_CHANGE(coroutine, burstProgressTime, commandTimeout);
 		}
 	}
-	else
-	{
-		uint32_t elapsedTime = timeNow - commandStartTime;
-		
-		if (elapsedTime < commandTimeout)
-		{
-			bool matches = false;
-			bool matchesStep = false;
-			if (commandType == COMMAND_SET_POWER)
-				matches = (state.getPowerEnabled() == commandBoolValue);
-			else if (commandType == COMMAND_SET_TEMPERATURE)
-			{
-				matches = (state.getTargetTemperature() == commandIntValue);
-				matchesStep = (state.getTargetTemperature() == commandIntStepValue);
-			}
-			else if (commandType == COMMAND_SET_UNITS)
-				matches = (state.getIsTempInC() == commandBoolValue);
-			else if (commandType == COMMAND_SET_BUBBLES)
-				matches = (state.getBubblesEnabled() == commandBoolValue);
-			else if (commandType == COMMAND_SET_FILTER)
-				matches = (state.getFilterEnabled() == commandBoolValue);
-			else if (commandType == COMMAND_SET_HEATING)
-				matches = (state.getHeatingEnabled() == commandBoolValue);
-
-			if (matches)
-			{
-				// success
-				finished = true;
-				//logger.addLine("Matched: " + String(commandTries));
+	COROUTINE_END(coroutine);
+}
 
-			}
-			else if (matchesStep)
-			{
-				commandTryStarted = false;
-				commandStartTime = timeNow;
-				
-				if (commandTries  == commandRetries)
-					finished = true;
+// the display blinks and no other value is lit, without presses in
+// flight a lit value that is not the blinking one is the current
+// temperature after the board left the setting mode
+bool SpaState::Command::isSettingMode(SpaState& state) const
+{
+	int blinking = state.getBlinkingTemperature();
+	int lit = state.temperatureClassifier.getShownValue();
+	return blinking >= 0 && (lit < 0 || lit == blinking);
+}
 
-				//logger.addLine("Matched Step: " + String(commandTries));
+// counts the presses the blinking display shows, false once it does
+// not blink anymore
+bool SpaState::Command::followBurst(SpaState& state)
+{
+	int blinking = state.getBlinkingTemperature();
+	if (blinking < 0)
+	{
+		// the next press shows the setting mode again
+		burstPending = 0;
+		return false;
+	}
 
+	// the blinking value is taken at the blank, the presses show before.
+	// The board stays in the setting mode while they are in flight, a lit
+	// value that moved toward the target by no more than the presses in
+	// flight is them, any other may be the current temperature.
+	bool blank = TemperatureClassifier::DISPLAY_BLINK_OFF == state.temperatureClassifier.getState();
+	int shown = shownValue;
+	int lit = state.temperatureClassifier.getShownValue();
+	int litMoved = (lit - shownValue) * burstDirection;
+	if (blank)
+		shown = blinking;
+	else if (lit >= 0 && litMoved > 0 && litMoved <= burstPending)
+		shown = lit;
 
-			}
-		}
-		else
+	uint32_t timeNow = coroutine.nowMS;
+	if (shown != shownValue)
+	{
+		int moved = shown - shownValue;
+		if (moved * burstDirection > 0)
 		{
-			//logger.addLine("Timeout: " + String(commandTries));
-			commandTryStarted = false;
-			if (commandTries  == commandRetries)
-				finished = true;
+			if (burstPending > 0)
+				recordLatency(state, timeNow - burstProgressTime);
+			int taken = moved * burstDirection;
+			burstPending = taken >= burstPending ? 0 : burstPending - taken;
 		}
+		shownValue = shown;
+		burstProgressTime = timeNow;
+	}
+
+	// a blank display can not show the presses, the time does not count
+	if (blank || burstBlank)
+		burstProgressTime = timeNow;
+	burstBlank = blank;
+
+	if (burstPending > 0 && timeNow - burstProgressTime > commandTimeout)
+	{
+		// presses the board did not take
+		recordLoss(state);
+		burstPending = 0;
+		burstWindow = burstWindow > 1 ? burstWindow / 2 : 1;
+		burstProgressTime = timeNow;
 	}
-}
\ No newline at end of file
+	return true;
+}
+
+// the presses go out one after the other, the timeout counts from the last
+bool SpaState::Command::pressBurst(SpaState& state)
+{
+	int projected = shownValue + burstDirection * burstPending;
+	if (projected == commandIntValue)
+		return false;
+
+	int8_t direction = commandIntValue > projected ? 1 : -1;
+	if (burstPending > 0 && direction != burstDirection)
+		return false;
+	if (burstPending >= burstWindow || !coroutine.elapsed(commandStartTime, commandDelay) || commandTries >= commandRetries)
+		return false;
+
+	burstProgressTime = coroutine.nowMS;
+	burstDirection = direction;
+	++burstPending;
+	press(state, direction > 0 ? BTN_UP : BTN_DOWN, 1);
+	return true;
+}
+
+bool SpaState::Command::isBurstDone(SpaState& state) const
+{
+	if (burstPending > 0)
+		return false;
+	return commandTries >= commandRetries ||
+		(shownValue == commandIntValue && state.getTargetTemperature() == commandIntValue);
+}
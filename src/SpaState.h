@@ -3,8 +3,45 @@
 
 #include <Arduino.h>
 #include <set>
+#include <vector>
 #include <sys/time.h>
 
+#include "RingBuffer.h"
+#include "BoundedQueue.h"
+#include "LatencyStats.h"
+#include "DisplayFrame.h"
+#include "Debouncer.h"
+#include "TemperatureClassifier.h"
+#include "GpioPin.h"
+#include "FrameRecorder.h"
+#include "AirTemperatureSensor.h"
+#include "Clock.h"
+#include "CommandBenchmark.h"
+#include "CommandTiming.h"
+#include "SpaReconciler.h"
+#include "Coroutine.h"
+
+// number of display frames buffered between the latch interrupt and loop()
+#ifndef SPA_RING_BUFFER_SIZE
+#define SPA_RING_BUFFER_SIZE 64
+#endif
+
+// commands waiting for the main board, a new command replaces a waiting
+// one of the same type, so more than one per type is never needed
+#ifndef SPA_COMMAND_QUEUE_SIZE
+#define SPA_COMMAND_QUEUE_SIZE 8
+#endif
+
+// largest capture file written by startCapture
+#ifndef SPA_CAPTURE_MAX_BYTES
+#define SPA_CAPTURE_MAX_BYTES (512 * 1024)
+#endif
+
+// the learned command timing is written at most this often
+#ifndef SPA_TIMING_SAVE_INTERVAL_MS
+#define SPA_TIMING_SAVE_INTERVAL_MS (15 * 60000UL)
+#endif
+
 
 class MessageInterface
 {
@@ -21,11 +58,78 @@ class SpaState
 public:
 	SpaState() {}
 
-	void init(uint8_t clockPin, uint8_t latchPin, uint8_t dataInPin, uint8_t dataOutPin);
+	// Pins is a SpaBusPins<> type, the interrupt handlers are
+	// compiled for exactly these pins
+	template<class Pins>
+	void init()
+	{
+		initPins(Pins::Clock::pin, Pins::Latch::pin, Pins::DataIn::pin, Pins::DataOut::pin);
+		interruptAttach = &SpaState::attachInterrupts<Pins>;
+		interruptBenchmark = &SpaState::benchmarkInterrupts<Pins>;
+		enableInterrupts();
+		initSensors();
+	}
+	void enableInterrupts();
 	void disableInterrupts();
 	void loop();
-	ICACHE_RAM_ATTR void handleClockInterrupt();
-	ICACHE_RAM_ATTR void handleLatchInterrupt();
+
+	// clock the data bits into the buffer
+	template<class Pins>
+	inline ICACHE_RAM_ATTR void handleClockInterrupt()
+	{
+		clkCount++;
+		clkBuf = (clkBuf << 1) | Pins::DataIn::read();
+	}
+
+	template<class Pins>
+	inline ICACHE_RAM_ATTR void handleLatchInterrupt()
+	{
+		// called at each latch
+		if (btnPulse)
+		{
+			// reset pulse
+			Pins::DataOut::set();
+			btnPulse = false;
+			// the frame clocked during the pulse is not used
+			frameGap = true;
+		}
+		else if (clkCount == 16)
+		{
+			++frameCount;
+			BusFrame frame = { clkBuf, frameGap, ESP.getCycleCount() };
+			frameGap = !ringBuffer.push(frame);
+			if (simulateButtonPress())
+			{
+				// start button pulse (until next latch)
+				Pins::DataOut::clear();
+				++injectedPressCount;
+			}
+		}
+		else if (clkCount < 16)
+		{
+			++shortFrameCount;
+			frameGap = true;
+		}
+		else
+		{
+			++longFrameCount;
+			frameGap = true;
+		}
+		// reset buffer
+		clkBuf = 0;
+		clkCount = 0;
+	}
+
+	// cycles spent in the interrupt handlers of this build, as text
+	String benchmarkInterrupts() { return interruptBenchmark ? (this->*interruptBenchmark)() : String("not initialized"); }
+
+	// set before init(), without a sensor the air temperature is not polled
+	void setAirTemperatureSensor(AirTemperatureSensor* sensor) { airTemperatureSensor = sensor; }
+	// set before init(), the timers of loop() and the commands use it
+	void setClock(Clock* newClock) { clock = newClock ? newClock : &SystemClock::instance(); }
+	// set before init(), the learned command timing is kept in this
+	// file on LittleFS, without one it is learned again after a restart
+	void setTimingFile(const String& path) { timingPath = path; }
 
 	void setTimeAvailable(bool available) { timeAvailable = available; }
 	bool getTimeAvailable() const { return timeAvailable; }
@@ -36,31 +140,93 @@ public:
 		wifiConfigCallback = cb;
 	}
 
+	// the setters queue a command for the main board, false if the
+	// queue is full
 	bool getPowerEnabled() const;
-	void setPowerEnabled(bool power);
+	bool setPowerEnabled(bool power);
 
 	bool getFilterEnabled();
-	void setFilterEnabled(bool newValue);
+	bool setFilterEnabled(bool newValue);
 
 	bool getIsHeating() const;
 
 	bool getHeatingEnabled() const;
-	void setHeatingEnabled(bool newValue);
+	bool setHeatingEnabled(bool newValue);
 
 	bool getBubblesEnabled() const;
-	void setBubblesEnabled(bool newValue);
+	bool setBubblesEnabled(bool newValue);
 
 	bool getIsTempInC() const;
 	bool getIsTempInF() const;
 	String getTemperatureUnitString() const { return( isCelsius ? "C" : "F" );}
 
-	void setTempInC(bool c);
+	bool setTempInC(bool c);
+
+	// END on the display: the board hibernates after 72 hours of
+	// heating with the filter and the heater off
+	bool getIsHibernating() const;
+	// presses the filter button until END is gone and switches the
+	// heater on again if heating is set, false if the spa does not
+	// hibernate or the queue is full
+	bool wakeFromHibernation(bool heating = true);
+
+	uint32_t getDroppedFrameCount() const { return ringBuffer.getOverflowCount(); }
+	uint32_t getFrameBufferHighWaterMark() const { return ringBuffer.getHighWaterMark(); }
+
+	// display bus health counters, all counting since boot
+	struct BusStats
+	{
+		uint32_t frames = 0;            // complete 16 bit frames received
+		uint32_t shortFrames = 0;       // latches with less than 16 clocks
+		uint32_t longFrames = 0;        // latches with more than 16 clocks
+		uint32_t droppedFrames = 0;     // frames lost because the ring buffer was full
+		uint32_t framesPerSecond = 0;   // frames received during the last second
+		uint32_t buttonEchoes = 0;      // button scan frames seen on the bus
+		uint32_t injectedPresses = 0;   // simulated button presses sent to the main board
+		uint32_t unknownGlyphs = 0;     // digit frames with an unknown segment pattern
+		uint32_t cachedFrames = 0;      // frames skipped because they did not change
+		uint32_t displayFrames = 0;     // complete display refreshes decoded
+		uint32_t tornDisplayFrames = 0; // display refreshes rejected because frames were lost
+	};
+	BusStats getBusStats() const;
+
+	LatencyStats& getLatencyStats() { return latencyStats; }
+
+	// record the raw bus frames to a capture file on LittleFS
+	bool startCapture(const String& path);
+	void stopCapture();
+	bool isCapturing() const { return frameRecorder.isRecording(); }
+	const String& getCapturePath() const { return frameRecorder.getPath(); }
+	uint32_t getCaptureRecordCount() const { return frameRecorder.getRecordCount(); }
+	uint32_t getCaptureBytes() const { return frameRecorder.getBytes(); }
+
+	// feed a capture file through the decoder instead of the bus,
+	// starting fromSeconds into the capture
+	bool startReplay(const String& path, uint32_t fromSeconds = 0);
+	void stopReplay();
+	bool isReplaying() const { return frameReplay.isRunning(); }
 
 	int getCurrentTemperature() const;
 	float getExternalTemperature() const;
 
 	int getTargetTemperature() const;
-	void setTargetTemperature(int newValue);
+	// the target temperature while it is being set and blinks, before
+	// it is committed, -1 if the display is steady
+	int getBlinkingTemperature() const { return temperatureClassifier.getBlinkingValue(); }
+	// false if the spa is off or the queue is full
+	bool setTargetTemperature(int newValue);
+
+	// commands waiting for or being sent to the main board
+	size_t getPendingCommandCount() const { return commands.size(); }
+
+	struct CommandStats
+	{
+		uint32_t queued = 0;     // commands added to the queue
+		uint32_t coalesced = 0;  // commands that replaced a queued one of the same type
+		uint32_t preempted = 0;  // commands dropped because the spa is off
+		uint32_t rejected = 0;   // commands refused because the queue was full
+	};
+	const CommandStats& getCommandStats() const { return commandStats; }
 
 	String toString()
 	{
@@ -99,12 +265,37 @@ public:
 		    String("TargetTemp: ") + String(getTargetTemperature()) + getTemperatureUnitString() + "\n" +
 		    String("Temp: ") + String(getCurrentTemperature()) + getTemperatureUnitString() + "\n" +
 		    String("Air Temp: ") + String(getExternalTemperature()) + getTemperatureUnitString() +
-			String("\n\n");
+			String("\n");
+
+		BusStats stats = getBusStats();
+		str += "Frames: " + String(stats.frames) + " (" + String(stats.framesPerSecond) + "/s)\n";
+		str += "Short/Long Frames: " + String(stats.shortFrames) + "/" + String(stats.longFrames) + "\n";
+		str += "Dropped Frames: " + String(stats.droppedFrames) +
+			" (buffer peak " + String(getFrameBufferHighWaterMark()) + "/" + String(SPA_RING_BUFFER_SIZE) + ")\n";
+		str += "Display Refreshes: " + String(stats.displayFrames) + " (torn " + String(stats.tornDisplayFrames) + ")\n";
+		str += "Unknown Glyphs: " + String(stats.unknownGlyphs) + "\n";
+		str += "Button Echoes: " + String(stats.buttonEchoes) + "\n";
+		str += "Button Presses Sent: " + String(stats.injectedPresses) + "\n";
+		str += "Commands: " + String(commands.size()) + " pending, " + String(commandStats.queued) + " queued, " +
+			String(commandStats.coalesced) + " coalesced, " + String(commandStats.preempted) + " preempted, " +
+			String(commandStats.rejected) + " rejected\n\n";
 		return str;
 	}
 
-	bool testRunning = false;
-	void startStopTest(String testType);
+	// brings the spa to the fields set in desired with the fewest
+	// presses, replaces the queued commands of these fields, see
+	// SpaReconciler. False if the state can not be reached.
+	bool setDesiredState(const SpaReconciler::DesiredState& desired);
+	const SpaReconciler& getReconciler() const { return reconciler; }
+
+	// timing of the commands learned from the display, see CommandTiming
+	const CommandTiming& getCommandTiming() const { return commandTiming; }
+	void resetCommandTiming();
+
+	// sweep the command timing, see CommandBenchmark
+	bool startBenchmark(const CommandBenchmark::Config& config);
+	void stopBenchmark() { commandBenchmark.stop(); }
+	const CommandBenchmark& getBenchmark() const { return commandBenchmark; }
 
 	class ChangeEvent
 	{
@@ -121,12 +312,22 @@ public:
 			CHANGE_TYPE_TEMP,
 			CHANGE_TYPE_AIR_TEMP,
 			CHANGE_TYPE_TEMP_UNITS,
+			CHANGE_TYPE_RECONCILE,  // a desired state converged or failed
 			CHANGE_TYPE_FENCE
 		};
 	public:
 		ChangeEvent(ChangeType t) : type (t) {}
+		ChangeEvent(ChangeType t, uint32_t latchUS, uint32_t emitUS) :
+			type(t), traced(true), latchMicros(latchUS), emitMicros(emitUS) {}
 		ChangeType getType() const { return type; }
 
+		// traced events originate from a display refresh and carry the
+		// micros() of the latch interrupt of its first frame and of the
+		// emitChange call
+		bool isTraced() const { return traced; }
+		uint32_t getLatchMicros() const { return latchMicros; }
+		uint32_t getEmitMicros() const { return emitMicros; }
+
 		bool operator==(const ChangeEvent& other) const
 		{
 			return type == other.type;
@@ -137,6 +338,9 @@ public:
 		}
 	private:
 		ChangeType type = CHANGE_TYPE_NONE;
+		bool traced = false;
+		uint32_t latchMicros = 0;
+		uint32_t emitMicros = 0;
 	};
 
 	class Listener
@@ -157,6 +361,17 @@ protected:
 
 	virtual void emitChange(const ChangeEvent& c)
 	{
+		if (frameTraced)
+		{
+			ChangeEvent e(c.getType(), refreshLatchMicros, micros());
+			latencyStats.record(LatencyStats::STAGE_DECODE, e.getEmitMicros() - framePopMicros);
+			for(auto l : listeners)
+			{
+				l->handleSpaStateChange(e);
+			}
+			return;
+		}
+
 		for(auto l : listeners)
 		{
 			l->handleSpaStateChange(c);
@@ -202,25 +417,74 @@ protected:
 
 	void readSegment(uint16_t msg, int seg);
 	void readLEDStates(uint16_t msg);
-	void classifyTemperature();
-	void writeButton(ButtonT button);
-	inline ICACHE_RAM_ATTR bool simulateButtonPress();
+	// returns the TemperatureClassifier results of the frame
+	uint8_t classifyTemperature(uint32_t timestamp);
+	// releaseScans: scans of the button to let pass before pulling,
+	// the board takes a press again only after it saw the button released
+	void writeButton(ButtonT button, uint8_t releaseScans = 0);
+	inline ICACHE_RAM_ATTR bool simulateButtonPress()
+	{
+		if (0 != btnRequest)
+		{
+			uint16_t b = clkBuf | SpaProtocol::BUZZER_MASK;
+
+			if (btnRequest == b)
+			{
+				if (btnRelease > 0)
+				{
+					--btnRelease;
+					return false;
+				}
+				btnPulse = true;
+				if (--btnCount <= 0)
+				{
+					btnRequest = 0;
+				}
+				return true;
+			}
+		}
+		return false;
+	}
 
 	void setTemperatureUnitsInternal(bool isC);
 	uint32_t lastTemperatureUnitChangeMS = 0;
 	uint32_t numQuickTempUnitChanges = 0;
 
-	void setPowerEnabledInternal(bool newValue);
-	void setIsHeatingInternal(bool newValue);
-	void setHeatingEnabledInternal(bool newValue);
-	void setFilterEnabledInternal(bool newValue);
-	void setBubblesEnabledInternal(bool newValue);
+	void setCurrentTemperatureInternal(int newValue);
 	void setTargetTemperatureInternal(int newValue);
 	void setAirTemperatureInternal(float newValue);
 
 
 
 private:
+	void initPins(uint8_t clockPin, uint8_t latchPin, uint8_t dataInPin, uint8_t dataOutPin);
+	void initSensors();
+
+	template<class Pins>
+	static ICACHE_RAM_ATTR void clockInterrupt(void* self)
+	{
+		static_cast<SpaState*>(self)->handleClockInterrupt<Pins>();
+	}
+
+	template<class Pins>
+	static ICACHE_RAM_ATTR void latchInterrupt(void* self)
+	{
+		static_cast<SpaState*>(self)->handleLatchInterrupt<Pins>();
+	}
+
+	template<class Pins>
+	void attachInterrupts()
+	{
+		attachInterruptArg(digitalPinToInterrupt(Pins::Clock::pin), &SpaState::clockInterrupt<Pins>, this, RISING);
+		attachInterruptArg(digitalPinToInterrupt(Pins::Latch::pin), &SpaState::latchInterrupt<Pins>, this, RISING);
+	}
+	void (SpaState::*interruptAttach)() = nullptr;
+
+	template<class Pins>
+	String benchmarkInterrupts();
+	ICACHE_RAM_ATTR void handleClockInterruptReference();
+	String (SpaState::*interruptBenchmark)() = nullptr;
+
 	std::set<Listener*> listeners;
 	WifiConfigCallback wifiConfigCallback;
 	bool timeAvailable = false;
@@ -231,104 +495,97 @@ private:
 	uint8_t pinDataOut = 0;
 
 	char digit[5] = {};
-	int  lstTemp = 0;                 //last valid display reading
-	int  curTempTmp = 0;              //current temperature candidate
-	bool curTempTmpValid = false; //current temperature candidate is valid / has not timed out
+
+	DisplayFrameAssembler displayAssembler;
+	bool displayGap = false; // frames were lost since the last display frame
+	// the previous refresh, unchanged slots skip decoding
+	DisplayFrame lastDisplayFrame;
+	bool lastDisplayFrameValid = false;
+	TemperatureClassifier temperatureClassifier;
 	int  curTemp = 15;            //current temperature
-	int  targTempTmp = 0;              //target temperature candidate
-	bool targTempTmpValid = false; //target temperature candidate is valid
 	int  targTemp = 25;            //target temperature
 	float externalTemperature = 0.f;
+	AirTemperatureSensor* airTemperatureSensor = nullptr;
 	bool isCelsius = true;
-	bool blankCount = 0;
 	bool targetTempInitialized = false;
+	static const uint32_t airTempCheckInterval = 10000;
 	uint32_t timeLastAirTempCmd = 0;
-	uint32_t airTempWaitTime = 0;
-
-	volatile uint16_t buttonCodes[7] = {
-		0xFBFF, // BTN_POWER
-		0xEFFF, //BTN_UP
-		0xFF7F, // BTN_DOWN; //65407
-		0xFFFD, // BTN_FILTER; //65533
-		0x7FFF, // BTN_HEATER; //32767
-		0xFFF7, // BTN_BUBBLE; //65527
-		0xDFFF }; // BTN_FC;buttonCode
+	uint32_t airTempWaitTime = airTempCheckInterval;
+
+	Clock* clock = &SystemClock::instance();
+	uint32_t initMS = 0; // clock at init()
+
+	// scan frames of the buttons, indexed by ButtonT
+	static const uint16_t buttonCodes[7];
 	volatile uint16_t btnRequest = 0;
 	volatile uint8_t  btnCount = 0;
+	volatile uint8_t  btnRelease = 0;
 
-	volatile uint8_t  ringBufferSize = 64;
-	volatile uint8_t  ringBufferStart = 0;
-	volatile uint8_t  ringBufferEnd = 0;
-	volatile uint16_t ringBuffer[64];
+	struct BusFrame
+	{
+		uint16_t data;
+		bool gap;        // frames were lost before this one
+		uint32_t cycles; // cpu cycle count at the latch interrupt
+	};
+	RingBuffer<BusFrame, SPA_RING_BUFFER_SIZE> ringBuffer;
 
-	bool ringBufferPop(uint16_t &value)
-	{	
-		if (ringBufferStart != ringBufferEnd)
-		{
-			value = ringBuffer[ringBufferStart];
-   			ringBufferStart = (ringBufferStart + 1) % ringBufferSize;
-			return true;
-		}
-		return false;
-	}
+	// timing of the frame currently being decoded
+	bool frameTraced = false;
+	uint32_t frameLatchMicros = 0;
+	uint32_t framePopMicros = 0;
+	// latch of the first frame of the refresh it completes, the changes
+	// of a refresh count from there
+	uint32_t refreshLatchMicros = 0;
+	LatencyStats latencyStats;
 
-	ICACHE_RAM_ATTR void ringBufferPush(uint16_t data)
-	{
-		ringBuffer[ringBufferEnd] = data;
-		ringBufferEnd = (ringBufferEnd + 1)  % ringBufferSize;
-		if (ringBufferEnd == ringBufferStart)
-		{
-			ringBufferStart = (ringBufferStart + 1)  % ringBufferSize;
-		}
-	}
+	FrameRecorder frameRecorder;
+	FrameReplay frameReplay;
 
 	void processMessages();
-
-	int btnCycles  = 6;
+	void processFrame(const CaptureRecord& record);
+	void processReplay();
+	void processDisplayFrame(const DisplayFrame& frame);
 
 	volatile bool btnPulse = false;
 	volatile uint8_t clkCount = 0;
 	volatile uint16_t clkBuf = 0;
+	volatile bool frameGap = true;
+
+	// written by the latch interrupt only
+	volatile uint32_t frameCount = 0;
+	volatile uint32_t shortFrameCount = 0;
+	volatile uint32_t longFrameCount = 0;
+	volatile uint32_t injectedPressCount = 0;
+
+	// written by loop() only
+	uint32_t buttonEchoCount = 0;
+	uint32_t unknownGlyphCount = 0;
+	uint32_t cachedFrameCount = 0;
+	// display refreshes that changed a digit, the LEDs or the temperature
+	// classification, the commands wait for these
+	uint32_t displayChangeCount = 0;
+	uint32_t framesPerSecond = 0;
+	uint32_t fpsFrameCount = 0;
+	uint32_t fpsLastMS = 0;
 
 	enum LEDBits {
-	LED_POWER        =0,
-	LED_BUBBLE       =10,
-	LED_HEATER_GREEN =9,
-	LED_HEATER_RED   =7,
-	LED_FILTER       =12  
+	LED_POWER        = DisplayFrame::LED_POWER,
+	LED_BUBBLE       = DisplayFrame::LED_BUBBLE,
+	LED_HEATER_GREEN = DisplayFrame::LED_HEATER_GREEN,
+	LED_HEATER_RED   = DisplayFrame::LED_HEATER_RED,
+	LED_FILTER       = DisplayFrame::LED_FILTER
 	};
 	
-	bool isPowerEnabledTmp    = false;
-	bool isPowerEnabled       = false;
-	bool isFilterEnabledTmp   = false;
-	bool isFilterEnabled      = false;
-	bool isHeatingTmp         = false;
-	bool isHeating            = false;
-	bool isHeatingEnabledTmp  = false;
-	bool isHeatingEnabled     = false;
-	bool areBubblesEnabledTmp = false;
-	bool areBubblesEnabled    = false;
-	
+	// debounced LED states, active high
+	Debouncer<uint16_t, SPA_LED_DEBOUNCE_DEPTH> ledDebouncer;
 
-	const int reqCycles = 90;
-	int dispCycles = reqCycles; //non blank display cycles
-
-	enum OperationType {
-		OPERATION_NONE            = 0,
-		OPERATION_SET_POWER       = 1,
-		OPERATION_SET_HEATING     = 2,
-		OPERATION_SET_FILTER      = 3,
-		OPERATION_SET_BUBBLES     = 4,
-		OPERATION_SET_TEMPERATURE = 5,
-		OPERATION_SET_UNITS       = 6,
-	};
 
+	// Every command is a coroutine, see Coroutine.h: it presses, awaits
+	// the display or the timeout and presses again as sequential code.
+	// process() is the scheduler, it calls the routine only when what
+	// it waits for happened.
 	class Command
 	{
-			// test results:
-			// power: 200 timeout, 500 delay
-			// C/F:  500 timeout 300 delay
-			// set temp: 550 timeout, 0 delay
 	public:
 		enum CommandType {
 			COMMAND_NONE            = 0,
@@ -338,59 +595,199 @@ private:
 			COMMAND_SET_BUBBLES     = 4,
 			COMMAND_SET_TEMPERATURE = 5,
 			COMMAND_SET_UNITS       = 6,
+			COMMAND_WAKE            = 7,
 		};
+		Command() {}
+		// the timing comes from CommandTiming when it is queued
 		Command(CommandType type, bool value) :
 			commandType(type), commandBoolValue(value)
 		{
-			if (COMMAND_SET_POWER == commandType)
-			{
-				commandTimeout = 200;
-				commandDelay = 500;
-			}
-			else if (COMMAND_SET_UNITS == commandType)
-			{
-				commandTimeout = 500;
-				commandDelay = 300;
-			}
 			commandRetries = 2;
+			routine = COMMAND_WAKE == type ? &Command::runWake : &Command::runSwitch;
 		}
 		
 		Command(CommandType type, int value) :
 			commandType(type), commandIntValue(value)
 		{
-			if (COMMAND_SET_TEMPERATURE == commandType)
-			{
-				commandTimeout = 550;
-				commandDelay = 0;
-			}
-			commandRetries = 30;
+			// every step of the widest range, and as many to correct
+			commandRetries = 2 * (SpaProtocol::MAX_FAHRENHEIT - SpaProtocol::MIN_FAHRENHEIT);
+			routine = &Command::runTemperature;
+		}
+
+		// the display blinks at 1 Hz, the setting mode shows at the first
+		// blank after the press
+		static const uint32_t setModeTimeoutMS = 1000;
+		// presses of a temperature burst that may wait for the display
+		static const uint8_t maxBurstPresses = 4;
+
+		// delay between button presses and time a press waits for the display
+		// fixed instead of the learned timing, the command is not learned from
+		void setTiming(uint32_t delay, uint32_t timeout)
+		{
+			commandDelay = delay;
+			commandTimeout = timeout;
+			timingFixed = true;
+		}
+		void applyTiming(const CommandTiming& timing)
+		{
+			if (timingFixed)
+				return;
+			commandDelay = timing.getDelay(getTimingType());
+			commandTimeout = timing.getTimeout(getTimingType());
+		}
+		// waking presses the filter button first
+		CommandTiming::Type getTimingType() const
+		{
+			return COMMAND_WAKE == commandType ? CommandTiming::TYPE_FILTER : (CommandTiming::Type)(commandType - COMMAND_SET_POWER);
 		}
 
-		void process();
+		// called while the bus is free
+		void process(SpaState& state, uint32_t timeNow)
+		{
+			if (!routine || !coroutine.isDue(timeNow, state.displayChangeCount))
+				return;
+			coroutine.resume(timeNow, state.displayChangeCount);
+			(this->*routine)(state);
+		}
 
-		bool isFinished() { return finished; }
+		bool isFinished() const { return coroutine.isFinished(); }
+		CommandType getType() const { return commandType; }
+		bool isPowerOff() const { return COMMAND_SET_POWER == commandType && !commandBoolValue; }
+		// all buttons but power do nothing while the spa is off
+		bool needsPower() const { return COMMAND_SET_POWER != commandType; }
+		// takes the value of a newer command of the same type, the
+		// command checks the display before every press, so it can
+		// change its goal at any time
+		void retarget(const Command& newer)
+		{
+			commandBoolValue = newer.commandBoolValue;
+			commandIntValue = newer.commandIntValue;
+			commandTries = 0;
+			// the presses in flight still count for the new value
+			burstWindow = maxBurstPresses;
+			// the temperature routine follows the display from where it
+			// is, the others start over and wait for a press in flight
+			if (COMMAND_SET_TEMPERATURE == commandType)
+				coroutine.wake();
+			else
+				coroutine.restart();
+		}
 	private:
-		bool commandTryStarted = false;
+		// the routines
+		void runSwitch(SpaState& state);
+		void runTemperature(SpaState& state);
+		void runWake(SpaState& state);
+
+		void press(SpaState& state, ButtonT button, uint8_t releaseScans = 0);
+		// an off or hibernating spa does not show most presses
+		bool canShowPress(SpaState& state) const;
+		// a press the display showed after ms or did not show
+		void recordLatency(SpaState& state, uint32_t ms);
+		void recordLoss(SpaState& state);
+		// a retry waits for the timeout and the delay from the last press
+		uint32_t getRetryPause() const { return commandDelay > commandTimeout ? commandDelay : commandTimeout; }
+		bool readSwitch(SpaState& state) const;
+		ButtonT getSwitchButton() const;
+		// END is gone and the filter runs
+		bool isAwake(SpaState& state) const;
+
+		// temperature burst, see runTemperature
+		bool isSettingMode(SpaState& state) const;
+		bool followBurst(SpaState& state);
+		bool pressBurst(SpaState& state);
+		bool isBurstDone(SpaState& state) const;
+
 		CommandType commandType = COMMAND_NONE;
-		uint32_t commandStartTime = 0;
-		uint32_t commandCompleteTime = 0;
+		void (Command::*routine)(SpaState& state) = nullptr;
+		Coroutine coroutine;
+		uint32_t commandStartTime = 0; // of the last press
 		uint32_t commandDelay = 600;
 		uint32_t commandTimeout = 600;
 		bool commandBoolValue = false;
 		int commandIntValue = 0;
-		int commandIntStepValue = 0;
 		int commandTries = 0;
 		int commandRetries = 2;
-		bool finished = false;
+		bool timingFixed = false;
+		bool pressShowable = false; // the spa could show the last press
+
+		// temperature burst
+		int shownValue = 0;          // last value the display blinked
+		int8_t burstDirection = 0;   // of the presses in flight
+		uint8_t burstPending = 0;    // presses not shown yet
+		uint8_t burstWindow = maxBurstPresses;
+		uint32_t burstProgressTime = 0;
+		bool burstBlank = false;     // the display was blank at the last call
 	};
 
-	std::vector<Command> commands;
+	bool queueCommand(const Command& command);
+	BoundedQueue<Command, SPA_COMMAND_QUEUE_SIZE> commands;
+	CommandStats commandStats;
+	CommandTiming commandTiming;
+	String timingPath;
+	uint32_t timingSavedMS = 0;
+	CommandBenchmark commandBenchmark;
+	SpaReconciler reconciler;
 
 	bool initialized = false;
 
-	friend class SpaTest;
-	OperationType testType = OPERATION_NONE;
+	friend class CommandBenchmark;
+	friend class SpaReconciler;
+	friend class SpaBenchmark;
 };
 
+template<class Pins>
+String SpaState::benchmarkInterrupts()
+{
+	const int iterations = 1000;
+	uint32_t start;
+
+	if (btnPulse || btnRequest)
+		return "ISR benchmark skipped, button press in progress";
+
+	noInterrupts();
+	uint16_t savedBuf = clkBuf;
+	uint8_t savedCount = clkCount;
+	uint32_t savedShortFrames = shortFrameCount;
+	uint32_t savedLongFrames = longFrameCount;
+	bool savedGap = frameGap;
+
+	start = ESP.getCycleCount();
+	for (int i = 0; i < iterations; ++i)
+		__asm__ __volatile__("" ::: "memory");
+	uint32_t loopCycles = ESP.getCycleCount() - start;
+
+	start = ESP.getCycleCount();
+	for (int i = 0; i < iterations; ++i)
+		handleClockInterrupt<Pins>();
+	uint32_t clockCycles = ESP.getCycleCount() - start;
+
+	start = ESP.getCycleCount();
+	for (int i = 0; i < iterations; ++i)
+		handleClockInterruptReference();
+	uint32_t referenceCycles = ESP.getCycleCount() - start;
+
+	// an empty latch takes the short frame path, the clock loop left
+	// clkCount far past 16
+	clkCount = 0;
+	start = ESP.getCycleCount();
+	for (int i = 0; i < iterations; ++i)
+		handleLatchInterrupt<Pins>();
+	uint32_t latchCycles = ESP.getCycleCount() - start;
+
+	clkBuf = savedBuf;
+	clkCount = savedCount;
+	shortFrameCount = savedShortFrames;
+	longFrameCount = savedLongFrames;
+	frameGap = savedGap;
+	interrupts();
+
+	String str = "ISR cycles @" + String(ESP.getCpuFreqMHz()) + "MHz";
+	str += " (clk=" + String(Pins::Clock::pin) + " lat=" + String(Pins::Latch::pin);
+	str += " in=" + String(Pins::DataIn::pin) + " out=" + String(Pins::DataOut::pin) + "): ";
+	str += "clock " + String((clockCycles - loopCycles) / iterations);
+	str += ", clock runtime pin " + String((referenceCycles - loopCycles) / iterations);
+	str += ", latch " + String((latchCycles - loopCycles) / iterations);
+	return str;
+}
 
 #endif
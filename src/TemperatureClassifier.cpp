@@ -0,0 +1,144 @@
+#include "TemperatureClassifier.h"
+
+static bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static char findUnit(const char* digits)
+{
+	char unit = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if ('F' == digits[i] || 'C' == digits[i])
+			unit = digits[i];
+	}
+	return unit;
+}
+
+bool TemperatureClassifier::updateUnits(const char* digits)
+{
+	char unit = findUnit(digits);
+
+	if (unit != unitCandidate)
+	{
+		unitCandidate = unit;
+		unitFrames = 1;
+		return false;
+	}
+	if (0 == unit)
+		return false;
+
+	if (unitFrames < confirmFrames)
+		++unitFrames;
+	if (unitFrames < confirmFrames)
+		return false;
+
+	bool isC = ('C' == unit);
+	if (unitsKnown && isC == celsius)
+		return false;
+
+	unitsKnown = true;
+	celsius = isC;
+	return true;
+}
+
+uint8_t TemperatureClassifier::update(const char* digits, uint32_t timestamp)
+{
+	uint8_t result = RESULT_NONE;
+	if (updateUnits(digits))
+		result |= RESULT_UNITS;
+
+	if (' ' == digits[0])
+	{
+		// blank display during blinking
+		if (blankFrames < confirmFrames)
+			++blankFrames;
+		if (blankFrames == confirmFrames && DISPLAY_BLINK_OFF != state)
+		{
+			// a value followed by a blank display is the target temperature
+			if (DISPLAY_BLINK_ON == state && runFrames >= confirmFrames)
+			{
+				blinkValue = runValue;
+				if (timestamp - litStart > litMicros)
+					litMicros = timestamp - litStart;
+				if (!runCommitted)
+				{
+					target = runValue;
+					targetLatency = timestamp - blinkStart;
+					runCommitted = true;
+					result |= RESULT_TARGET;
+				}
+			}
+			else if (DISPLAY_BLINK_ON != state)
+			{
+				blinkStart = timestamp;
+			}
+			state = DISPLAY_BLINK_OFF;
+		}
+		return result;
+	}
+
+	if (!isDigit(digits[0]))
+	{
+		// error code or END, nothing to classify
+		state = DISPLAY_UNKNOWN;
+		blinkValue = -1;
+		runValue = -1;
+		runFrames = 0;
+		blankFrames = 0;
+		return result;
+	}
+
+	// the slots are refreshed one after the other, digits without the
+	// unit are a refresh caught between a value and a blank
+	if (0 == findUnit(digits))
+		return result;
+
+	int value = 0;
+	for (int i = 0; i < 4 && isDigit(digits[i]); ++i)
+		value = value * 10 + (digits[i] - '0');
+
+	blankFrames = 0;
+	if (DISPLAY_BLINK_ON != state)
+		litStart = timestamp;
+	if (value != runValue)
+	{
+		if (DISPLAY_STEADY == state || DISPLAY_UNKNOWN == state)
+			blinkStart = timestamp;
+		runValue = value;
+		runFrames = 1;
+		runStart = timestamp;
+		runCommitted = false;
+		state = DISPLAY_BLINK_ON;
+	}
+	else if (DISPLAY_BLINK_OFF == state)
+	{
+		// same value shown again after a blank
+		runFrames = 1;
+		runStart = timestamp;
+		state = DISPLAY_BLINK_ON;
+	}
+	else if (runFrames < confirmFrames)
+	{
+		++runFrames;
+	}
+
+	// a new value without a blank before it may as well be a changed
+	// current temperature, the blinking value is only taken at a blank.
+	// A display that stays lit much longer than it did while blinking
+	// does not blink anymore.
+	if (blinkValue >= 0 && timestamp - litStart > 2 * litMicros)
+		blinkValue = -1;
+
+	// a value that is shown long enough without blanking is the current temperature
+	if (DISPLAY_BLINK_ON == state && timestamp - runStart >= steadyMicros)
+	{
+		state = DISPLAY_STEADY;
+		blinkValue = -1;
+		current = runValue;
+		currentLatency = timestamp - runStart;
+		result |= RESULT_CURRENT;
+	}
+	return result;
+}
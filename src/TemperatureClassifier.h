@@ -0,0 +1,88 @@
+#ifndef TEMPERATURE_CLASSIFIER_H
+#define TEMPERATURE_CLASSIFIER_H
+
+#include <stdint.h>
+
+// Tells the current water temperature from the target temperature by
+// the way the display shows them. The current temperature is shown
+// steadily, the target temperature blinks. Driven by the timestamps
+// of complete display refreshes, so the result does not depend on the
+// refresh rate.
+class TemperatureClassifier
+{
+public:
+	enum DisplayState
+	{
+		DISPLAY_UNKNOWN,   // nothing seen yet, or an error code is shown
+		DISPLAY_STEADY,    // the current temperature is shown
+		DISPLAY_BLINK_ON,  // a value is shown that is not steady (yet)
+		DISPLAY_BLINK_OFF  // the display is blank
+	};
+
+	enum Result
+	{
+		RESULT_NONE    = 0,
+		RESULT_CURRENT = 1, // current temperature committed
+		RESULT_TARGET  = 2, // target temperature committed
+		RESULT_UNITS   = 4  // temperature units changed
+	};
+
+	// steadyMS: how long a value has to be shown without blanking
+	// before it is taken as the current temperature
+	TemperatureClassifier(uint32_t steadyMS = 2000) :
+		steadyMicros(steadyMS * 1000UL) {}
+
+	// digits: the 4 decoded digits of one display refresh
+	// returns a combination of Result flags
+	uint8_t update(const char* digits, uint32_t timestampMicros);
+
+	DisplayState getState() const { return state; }
+	int getCurrentTemperature() const { return current; }
+	int getTargetTemperature() const { return target; }
+	// value shown while the display blinks, the target temperature
+	// being set before it is committed, -1 while it is steady. Taken at
+	// the blank after a value, a new value without a blank before it
+	// may as well be a changed current temperature. Back to -1 once the
+	// display stays lit for twice as long as it did while blinking.
+	int getBlinkingValue() const { return blinkValue; }
+	// value the display shows, -1 while it is blank or not confirmed yet
+	int getShownValue() const { return DISPLAY_BLINK_ON == state && runFrames >= confirmFrames ? runValue : -1; }
+	bool getIsCelsius() const { return celsius; }
+
+	// micros from the value first being shown until it was committed
+	uint32_t getCurrentLatency() const { return currentLatency; }
+	// micros from the display leaving the steady state until the
+	// target temperature was committed
+	uint32_t getTargetLatency() const { return targetLatency; }
+
+private:
+	// refreshes a value, blank or unit has to be seen in a row
+	static const uint8_t confirmFrames = 2;
+
+	bool updateUnits(const char* digits);
+
+	const uint32_t steadyMicros;
+	DisplayState state = DISPLAY_UNKNOWN;
+
+	int runValue = -1;           // value currently shown
+	uint8_t runFrames = 0;       // refreshes it has been shown in a row
+	uint32_t runStart = 0;       // when it was first shown after a blank
+	bool runCommitted = false;   // run already taken as target temperature
+	uint8_t blankFrames = 0;
+	uint32_t blinkStart = 0;     // when the display left the steady state
+	uint32_t litStart = 0;       // when the display was lit after a blank or steady value
+	uint32_t litMicros = 0;      // longest lit phase followed by a blank
+
+	char unitCandidate = 0;
+	uint8_t unitFrames = 0;
+	bool unitsKnown = false;
+
+	int current = -1;
+	int target = -1;
+	int blinkValue = -1;
+	bool celsius = true;
+	uint32_t currentLatency = 0;
+	uint32_t targetLatency = 0;
+};
+
+#endif
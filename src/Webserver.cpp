@@ -8,8 +8,12 @@
 
 #include "Log.h"
 
+#include <LittleFS.h>
+
 extern Log logger;
 
+static const char* captureFile = "/capture.bin";
+
 void Webserver::init(SpaState* state_, String devName)
 {
 	state = state_;
@@ -21,6 +25,11 @@ void Webserver::init(SpaState* state_, String devName)
 	server->on("/console", HTTP_GET,std::bind(&Webserver::handleConsole, this));
 	server->on("/console", HTTP_POST,std::bind(&Webserver::handleConsole, this));
 	server->on("/restart", HTTP_GET, std::bind(&Webserver::handleRestart, this)); 
+	server->on("/stats", HTTP_GET, std::bind(&Webserver::handleStats, this));
+	server->on("/capture", HTTP_GET, std::bind(&Webserver::handleCapture, this));
+	server->on("/benchmark", HTTP_GET, std::bind(&Webserver::handleBenchmark, this));
+	server->on("/state", HTTP_GET, std::bind(&Webserver::handleState, this));
+	server->on("/timing", HTTP_GET, std::bind(&Webserver::handleTiming, this));
 	server->onNotFound(std::bind(&Webserver::handleRoot, this));
 	server->begin();
 
@@ -38,6 +47,7 @@ void Webserver::handleRoot()
 	msg += state->toString();
 	msg += "</pre>";
 	
+	msg += "<a href=\"/stats\">Statistics</a><br>";
 	msg += "<a href=\"/update\">Update firmware</a>";
 	msg += String("</body></html>");
 	server->send(200, "text/html", msg);
@@ -83,12 +93,55 @@ void Webserver::handleConsole()
 		}
 		else if (cmd == "test")
 		{
-			state->startStopTest("");
+			if (state->getBenchmark().isRunning())
+				state->stopBenchmark();
+			else
+				state->startBenchmark(CommandBenchmark::Config());
+		}
+		else if (cmd.startsWith("state="))
+		{
+			SpaReconciler::DesiredState desired;
+			if (desired.parse(cmd.substring(6)))
+				state->setDesiredState(desired);
 		}
 		else if (cmd.startsWith("test="))
 		{
-			String testType =  cmd.substring(5);
-			state->startStopTest(testType);
+			CommandBenchmark::Config config;
+			config.types = CommandBenchmark::parseTypes(cmd.substring(5));
+			state->startBenchmark(config);
+		}
+		else if (cmd == "wake")
+		{
+			if (!state->wakeFromHibernation())
+				logger.addLine("The spa does not hibernate");
+		}
+		else if (cmd == "timing reset")
+		{
+			state->resetCommandTiming();
+		}
+		else if (cmd == "isrbench")
+		{
+			logger.addLine(state->benchmarkInterrupts());
+		}
+		else if (cmd == "capture start")
+		{
+			state->startCapture(captureFile);
+		}
+		else if (cmd == "capture stop")
+		{
+			state->stopCapture();
+		}
+		else if (cmd == "replay")
+		{
+			state->startReplay(captureFile);
+		}
+		else if (cmd.startsWith("replay="))
+		{
+			state->startReplay(captureFile, cmd.substring(7).toInt());
+		}
+		else if (cmd == "replay stop")
+		{
+			state->stopReplay();
 		}
 	}
 	String msg("<html><head><title>Wifi Spa</title>");
@@ -114,6 +167,159 @@ void Webserver::handleRestart()
 	delay(10000);
 }
 
+void Webserver::handleStats()
+{
+	String msg = state->getLatencyStats().toString();
+	if (server->hasArg("reset"))
+		state->getLatencyStats().reset();
+	server->send(200, "text/plain", msg);
+}
+
+// GET /capture downloads the last capture,
+// /capture?start, ?stop and ?replay control recording and replay,
+// ?replay=seconds starts that far into the capture
+void Webserver::handleCapture()
+{
+	String msg;
+	if (server->hasArg("start"))
+	{
+		msg = state->startCapture(captureFile) ? "capture started" : "capture failed";
+	}
+	else if (server->hasArg("stop"))
+	{
+		state->stopCapture();
+		msg = "capture stopped";
+	}
+	else if (server->hasArg("replay"))
+	{
+		msg = state->startReplay(captureFile, server->arg("replay").toInt()) ? "replay started" : "replay failed";
+	}
+	else
+	{
+		if (state->isCapturing())
+		{
+			server->send(409, "text/plain", "capture running");
+			return;
+		}
+
+		File file = LittleFS.open(captureFile, "r");
+		if (!file)
+		{
+			server->send(404, "text/plain", "no capture");
+			return;
+		}
+		server->streamFile(file, "application/octet-stream");
+		file.close();
+		return;
+	}
+	server->send(200, "text/plain", msg);
+}
+
+// counts of the benchmark, tries and sweep steps, are kept in a byte
+static bool isCount(long value)
+{
+	return value >= 1 && value <= UINT8_MAX;
+}
+
+// "start,step,count" of a sweep argument, false if it is not one
+static bool parseSweep(const String& arg, CommandBenchmark::Sweep& sweep)
+{
+	int first = arg.indexOf(',');
+	int second = first < 0 ? -1 : arg.indexOf(',', first + 1);
+	if (second < 0)
+		return false;
+	long start = arg.substring(0, first).toInt();
+	long step = arg.substring(first + 1, second).toInt();
+	long count = arg.substring(second + 1).toInt();
+	if (start < 0 || step < 0 || !isCount(count))
+		return false;
+	sweep.start = start;
+	sweep.step = step;
+	sweep.count = count;
+	return true;
+}
+
+// GET /benchmark returns the command benchmark results as JSON,
+// /benchmark?start=power,temp starts one, with &tries=N,
+// &delays=start,step,count and &timeouts=start,step,count in ms,
+// counts from 1 to 255, /benchmark?stop stops it
+void Webserver::handleBenchmark()
+{
+	if (server->hasArg("start"))
+	{
+		CommandBenchmark::Config config;
+		String types = server->arg("start");
+		if (types.length())
+			config.types = CommandBenchmark::parseTypes(types);
+		if (server->hasArg("tries"))
+		{
+			long tries = server->arg("tries").toInt();
+			if (!isCount(tries))
+			{
+				server->send(400, "text/plain", "bad value of tries");
+				return;
+			}
+			config.tries = tries;
+		}
+		if (server->hasArg("delays") && !parseSweep(server->arg("delays"), config.delays))
+		{
+			server->send(400, "text/plain", "bad value of delays");
+			return;
+		}
+		if (server->hasArg("timeouts") && !parseSweep(server->arg("timeouts"), config.timeouts))
+		{
+			server->send(400, "text/plain", "bad value of timeouts");
+			return;
+		}
+		if (state->startBenchmark(config))
+			server->send(200, "text/plain", "benchmark started");
+		else
+			server->send(409, "text/plain", "benchmark running or sweep too large");
+		return;
+	}
+	if (server->hasArg("stop"))
+	{
+		state->stopBenchmark();
+		server->send(200, "text/plain", "benchmark stopped");
+		return;
+	}
+	server->send(200, "application/json", state->getBenchmark().toJson());
+}
+
+// GET /state returns the result of the last desired state as JSON,
+// /state?power=on&heating_enabled=on&target_temp=38 sets one, the keys
+// are those of the MQTT topics
+void Webserver::handleState()
+{
+	if (server->args() > 0)
+	{
+		SpaReconciler::DesiredState desired;
+		for (int i = 0; i < server->args(); ++i)
+		{
+			if (!desired.set(server->argName(i), server->arg(i)))
+			{
+				server->send(400, "text/plain", "bad value of " + server->argName(i));
+				return;
+			}
+		}
+		if (!state->setDesiredState(desired))
+		{
+			server->send(409, "application/json", state->getReconciler().toJson());
+			return;
+		}
+	}
+	server->send(200, "application/json", state->getReconciler().toJson());
+}
+
+// GET /timing returns the learned command timing as JSON,
+// /timing?reset goes back to the defaults
+void Webserver::handleTiming()
+{
+	if (server->hasArg("reset"))
+		state->resetCommandTiming();
+	server->send(200, "application/json", state->getCommandTiming().toJson());
+}
+
 void Webserver::start()
 {
 	server->begin();
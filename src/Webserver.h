@@ -18,6 +18,11 @@ public:
 	void handleNotFound();
 	void handleConsole();
 	void handleRestart();
+	void handleStats();
+	void handleCapture();
+	void handleBenchmark();
+	void handleState();
+	void handleTiming();
 	void process();
 
 	virtual void handleSpaStateChange(const SpaState::ChangeEvent& c) override;
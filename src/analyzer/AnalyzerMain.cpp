@@ -0,0 +1,157 @@
+// Offline analyzer of plain or compressed capture files taken with
+// startCapture, for Linux.
+// Decodes the capture like the firmware and prints the state changes,
+// the glyphs seen per digit and the anomalies on the bus.
+//
+//   analyzer [-j threads] [-n anomalies] [-i intervalUS] [-o sections] capture
+//     -j  decoding threads (default all cores)
+//     -n  anomalies listed (default 100), all are counted
+//     -i  latch interval taken as an anomaly (default 5000)
+//     -o  sections to print, any of t(imeline) g(lyphs) a(nomalies)
+//         s(ummary) (default tgas)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+
+#include "CaptureAnalyzer.h"
+#include "SegmentDecoder.h"
+#include "SegmentGather.h"
+
+static void printTimeline(const CaptureAnalyzer& analyzer)
+{
+	printf("# timeline\n");
+	for (const CaptureAnalyzer::Event& e : analyzer.getTimeline())
+		printf("%10.3f %s\n", e.micros / 1e6, e.text.c_str());
+}
+
+static void printGlyphs(const CaptureAnalyzer& analyzer)
+{
+	printf("# glyphs\n%-4s %-7s %-7s %12s\n", "slot", "glyph", "pattern", "frames");
+	for (int slot = 0; slot < 4; ++slot)
+	{
+		for (int pattern = 0; pattern < 128; ++pattern)
+		{
+			uint64_t count = analyzer.getPatternCount(slot, pattern);
+			if (0 == count)
+				continue;
+			char glyph = SegmentDecoder::glyph(pattern);
+			char name[8];
+			snprintf(name, sizeof(name), glyph ? "'%c'" : "unknown", glyph);
+			printf("%-4d %-7s 0x%02x    %12llu\n", slot, name, pattern, (unsigned long long)count);
+		}
+	}
+}
+
+static void printAnomalies(const CaptureAnalyzer& analyzer)
+{
+	printf("# anomalies\n");
+	for (int type = 0; type < CaptureAnalyzer::NUM_ANOMALY_TYPES; ++type)
+	{
+		printf("%-15s %12llu\n", CaptureAnalyzer::anomalyName((CaptureAnalyzer::AnomalyType)type),
+			(unsigned long long)analyzer.getAnomalyCount((CaptureAnalyzer::AnomalyType)type));
+	}
+	for (const CaptureAnalyzer::Anomaly& a : analyzer.getAnomalies())
+	{
+		printf("%10.3f record %llu: %s, frame 0x%04x slot %d\n", a.micros / 1e6,
+			(unsigned long long)a.record, CaptureAnalyzer::anomalyName(a.type), a.frame, a.slot);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	CaptureAnalyzer::Config config;
+	config.threads = std::thread::hardware_concurrency();
+	const char* sections = "tgas";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "j:n:i:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			config.threads = atoi(optarg);
+			break;
+		case 'n':
+			config.maxAnomalies = atoi(optarg);
+			break;
+		case 'i':
+			config.maxLatchInterval = atoi(optarg);
+			break;
+		case 'o':
+			sections = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-j threads] [-n anomalies] [-i intervalUS] [-o tgas] capture\n", argv[0]);
+		return 1;
+	}
+	const char* path = argv[optind];
+	if (0 == config.threads)
+		config.threads = 1;
+
+	// the vector decoding has to match the firmware for every frame
+	if (!checkSegmentGather())
+	{
+		fprintf(stderr, "vector segment decoding differs from SegmentDecoder\n");
+		return 2;
+	}
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "can not open %s\n", path);
+		return 1;
+	}
+	size_t size = st.st_size;
+	const uint8_t* data = size ? (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "can not map %s\n", path);
+		return 1;
+	}
+	if (data)
+		madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CaptureAnalyzer analyzer(config);
+	if (!analyzer.analyze(data, size))
+	{
+		fprintf(stderr, "%s is not a capture file\n", path);
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (strchr(sections, 't'))
+		printTimeline(analyzer);
+	if (strchr(sections, 'g'))
+		printGlyphs(analyzer);
+	if (strchr(sections, 'a'))
+		printAnomalies(analyzer);
+	if (strchr(sections, 's'))
+	{
+		printf("# summary\n");
+		printf("records %llu, refreshes %llu, other frames %llu, %.3f s of bus time\n",
+			(unsigned long long)analyzer.getRecordCount(), (unsigned long long)analyzer.getRefreshCount(),
+			(unsigned long long)analyzer.getOtherFrameCount(), analyzer.getDuration() / 1e6);
+		printf("decoded in %.3f s with %u threads, %.1f M records/s\n",
+			seconds, config.threads, analyzer.getRecordCount() / seconds / 1e6);
+	}
+
+	if (data)
+		munmap((void*)data, size);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,350 @@
+#include "CaptureAnalyzer.h"
+
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "FrameCapture.h"
+#include "CaptureCodec.h"
+#include "SegmentDecoder.h"
+#include "SegmentGather.h"
+
+// CaptureDecoder input from the mapped file
+class MemoryReader
+{
+public:
+	MemoryReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+	int read() { return pos < length ? data[pos++] : -1; }
+	bool seek(uint32_t newPos)
+	{
+		pos = newPos;
+		return pos <= length;
+	}
+	size_t size() const { return length; }
+
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t pos = 0;
+};
+
+const char* CaptureAnalyzer::anomalyName(AnomalyType type)
+{
+	static const char* names[NUM_ANOMALY_TYPES] = {
+		"gap", "unknown glyph", "torn refresh", "time backwards", "latch interval"
+	};
+	return names[type];
+}
+
+void CaptureAnalyzer::readRecords(const uint8_t* data, Chunk& chunk, uint32_t& previousMicros)
+{
+	const uint8_t* records = data + FrameCapture::headerSize;
+	chunk.frames.resize(chunk.count);
+	chunk.micros.resize(chunk.count);
+	chunk.flags.resize(chunk.count);
+
+	const uint8_t* p = records + chunk.first * FrameCapture::recordSize;
+	for (size_t i = 0; i < chunk.count; ++i, p += FrameCapture::recordSize)
+	{
+		CaptureRecord r;
+		FrameCapture::decodeRecord(p, r);
+		chunk.frames[i] = r.data;
+		chunk.micros[i] = r.micros;
+		chunk.flags[i] = r.flags;
+	}
+
+	if (chunk.first > 0)
+	{
+		CaptureRecord r;
+		FrameCapture::decodeRecord(records + (chunk.first - 1) * FrameCapture::recordSize, r);
+		previousMicros = r.micros;
+	}
+}
+
+// the block headers tell where the chunk starts
+void CaptureAnalyzer::readBlocks(const uint8_t* data, size_t size, Chunk& chunk, uint32_t& previousMicros)
+{
+	chunk.frames.clear();
+	chunk.micros.clear();
+	chunk.flags.clear();
+
+	MemoryReader reader(data, size);
+	CaptureDecoder<MemoryReader> decoder(reader);
+	if (!decoder.begin() || !decoder.seekBlock(chunk.firstBlock))
+	{
+		chunk.count = 0;
+		return;
+	}
+	chunk.first = decoder.getRecordIndex();
+	previousMicros = decoder.getBlockHeader().micros;
+
+	CaptureRecord r;
+	for (uint32_t block = 0; block < chunk.blocks; ++block)
+	{
+		if (block > 0 && !decoder.seekBlock(chunk.firstBlock + block))
+			break;
+		while (decoder.nextInBlock(r))
+		{
+			chunk.frames.push_back(r.data);
+			chunk.micros.push_back(r.micros);
+			chunk.flags.push_back(r.flags);
+		}
+	}
+	chunk.count = chunk.frames.size();
+}
+
+// runs on a worker thread, only touches the chunk
+void CaptureAnalyzer::decodeChunk(const uint8_t* data, size_t size, Chunk& chunk)
+{
+	// the frame before the chunk for the latch interval
+	uint32_t previousMicros = 0;
+	if (compressed)
+		readBlocks(data, size, chunk, previousMicros);
+	else
+		readRecords(data, chunk, previousMicros);
+
+	size_t count = chunk.count;
+	chunk.patterns.resize(count);
+	chunk.slots.resize(count);
+	chunk.anomalies.clear();
+	memset(chunk.anomalyCounts, 0, sizeof(chunk.anomalyCounts));
+	memset(chunk.patternCounts, 0, sizeof(chunk.patternCounts));
+	chunk.otherFrames = 0;
+
+	gatherSegments(chunk.frames.data(), chunk.patterns.data(), count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint16_t frame = chunk.frames[i];
+		int slot = DisplayFrame::slotOf(frame);
+		chunk.slots[i] = slot;
+
+		Anomaly anomaly = { chunk.first + i, 0, NUM_ANOMALY_TYPES, frame, (int8_t)slot };
+		auto add = [&](AnomalyType type) {
+			++chunk.anomalyCounts[type];
+			// only the first ones of all chunks can be listed
+			if (chunk.anomalies.size() < config.maxAnomalies)
+			{
+				anomaly.type = type;
+				chunk.anomalies.push_back(anomaly);
+			}
+		};
+
+		if (chunk.flags[i] & FrameCapture::CAPTURE_FLAG_GAP)
+			add(ANOMALY_GAP);
+
+		if (slot < 0)
+		{
+			++chunk.otherFrames;
+		}
+		else if (slot < 4)
+		{
+			uint8_t pattern = chunk.patterns[i];
+			++chunk.patternCounts[slot][pattern];
+			if (0 == SegmentDecoder::glyph(pattern))
+				add(ANOMALY_UNKNOWN_GLYPH);
+		}
+
+		if (chunk.first + i > 0)
+		{
+			uint32_t interval = chunk.micros[i] - previousMicros;
+			if (interval >= 0x80000000UL)
+				add(ANOMALY_TIME_BACKWARDS);
+			else if (interval > config.maxLatchInterval)
+				add(ANOMALY_LATCH_INTERVAL);
+		}
+		previousMicros = chunk.micros[i];
+	}
+}
+
+void CaptureAnalyzer::addAnomaly(const Anomaly& anomaly)
+{
+	if (anomalies.size() < config.maxAnomalies)
+		anomalies.push_back(anomaly);
+}
+
+void CaptureAnalyzer::addEvent(const std::string& text)
+{
+	Event e = { nowMicros, text };
+	timeline.push_back(e);
+}
+
+// SpaState::processFrame
+void CaptureAnalyzer::processChunk(const Chunk& chunk)
+{
+	if (0 == chunk.count)
+		return;
+	records = chunk.first + chunk.count;
+
+	for (int i = 0; i < NUM_ANOMALY_TYPES; ++i)
+		anomalyCounts[i] += chunk.anomalyCounts[i];
+	for (int slot = 0; slot < 4; ++slot)
+	{
+		for (int pattern = 0; pattern < 128; ++pattern)
+			patternCounts[slot][pattern] += chunk.patternCounts[slot][pattern];
+	}
+	otherFrames += chunk.otherFrames;
+
+	std::vector<Anomaly>::const_iterator nextAnomaly = chunk.anomalies.begin();
+	for (size_t i = 0; i < chunk.count; ++i)
+	{
+		uint64_t record = chunk.first + i;
+		uint32_t interval = chunk.micros[i] - lastMicros;
+		if (record > 0 && interval < 0x80000000UL)
+			nowMicros += interval;
+		lastMicros = chunk.micros[i];
+
+		for (; nextAnomaly != chunk.anomalies.end() && nextAnomaly->record == record; ++nextAnomaly)
+		{
+			Anomaly anomaly = *nextAnomaly;
+			anomaly.micros = nowMicros;
+			addAnomaly(anomaly);
+		}
+
+		displayGap = displayGap || (chunk.flags[i] & FrameCapture::CAPTURE_FLAG_GAP);
+		int slot = chunk.slots[i];
+		if (slot < 0)
+			continue;
+
+		uint16_t frame = chunk.frames[i];
+		DisplayFrameAssembler::Result result = displayAssembler.add(slot, frame, chunk.micros[i], displayGap);
+		displayGap = false;
+		if (slot < 4)
+			pendingPatterns[slot] = chunk.patterns[i];
+
+		if (DisplayFrameAssembler::RESULT_TORN == result)
+		{
+			++anomalyCounts[ANOMALY_TORN_REFRESH];
+			Anomaly anomaly = { record, nowMicros, ANOMALY_TORN_REFRESH, frame, (int8_t)slot };
+			addAnomaly(anomaly);
+		}
+		else if (DisplayFrameAssembler::RESULT_COMPLETE == result)
+		{
+			++refreshes;
+			processRefresh(displayAssembler.getFrame());
+		}
+	}
+}
+
+// SpaState::processDisplayFrame, readSegment, classifyTemperature and
+// readLEDStates
+void CaptureAnalyzer::processRefresh(const DisplayFrame& frame)
+{
+	for (int seg = 0; seg < 4; ++seg)
+	{
+		if (!lastDisplayFrameValid || frame.raw[seg] != lastDisplayFrame.raw[seg])
+		{
+			char c = SegmentDecoder::glyph(pendingPatterns[seg]);
+			if (c)
+				digit[seg] = c;
+		}
+	}
+
+	uint8_t result = temperatureClassifier.update(digit, frame.timestamp);
+
+	if ((result & TemperatureClassifier::RESULT_UNITS) && isCelsius != temperatureClassifier.getIsCelsius())
+	{
+		isCelsius = temperatureClassifier.getIsCelsius();
+		addEvent(std::string("temp_units ") + (isCelsius ? "C" : "F"));
+	}
+
+	if ((result & TemperatureClassifier::RESULT_CURRENT) && curTemp != temperatureClassifier.getCurrentTemperature())
+	{
+		curTemp = temperatureClassifier.getCurrentTemperature();
+		addEvent("temp " + std::to_string(curTemp));
+	}
+
+	if (result & TemperatureClassifier::RESULT_TARGET)
+	{
+		int minTemp = SpaProtocol::minTemperature(isCelsius);
+		int maxTemp = SpaProtocol::maxTemperature(isCelsius);
+		int newTarget = temperatureClassifier.getTargetTemperature();
+
+		if (minTemp <= newTarget && newTarget <= maxTemp && targTemp != newTarget)
+		{
+			targTemp = newTarget;
+			addEvent("target_temp " + std::to_string(targTemp));
+		}
+	}
+
+	bool ledsRepeated = lastDisplayFrameValid && frame.getLEDs() == lastDisplayFrame.getLEDs();
+	if (!ledsRepeated || !ledDebouncer.isSettled())
+	{
+		const uint16_t heatingEnabled = (1 << DisplayFrame::LED_HEATER_RED) | (1 << DisplayFrame::LED_HEATER_GREEN);
+		bool wasHeatingEnabled = (ledDebouncer.getState() & heatingEnabled) != 0;
+		uint16_t changed = ledDebouncer.update(~frame.getLEDs());
+		uint16_t leds = ledDebouncer.getState();
+
+		// in the order SpaState emits the changes
+		if (changed & (1 << DisplayFrame::LED_POWER))
+			addEvent(std::string("power ") + (leds & (1 << DisplayFrame::LED_POWER) ? "on" : "off"));
+		if (changed & (1 << DisplayFrame::LED_BUBBLE))
+			addEvent(std::string("bubbles ") + (leds & (1 << DisplayFrame::LED_BUBBLE) ? "on" : "off"));
+		if (changed & (1 << DisplayFrame::LED_HEATER_RED))
+			addEvent(std::string("heating ") + (leds & (1 << DisplayFrame::LED_HEATER_RED) ? "on" : "off"));
+		if (changed && wasHeatingEnabled != ((leds & heatingEnabled) != 0))
+			addEvent(std::string("heating_enabled ") + (wasHeatingEnabled ? "false" : "true"));
+		if (changed & (1 << DisplayFrame::LED_FILTER))
+			addEvent(std::string("filter ") + (leds & (1 << DisplayFrame::LED_FILTER) ? "on" : "off"));
+	}
+
+	lastDisplayFrame = frame;
+	lastDisplayFrameValid = true;
+}
+
+bool CaptureAnalyzer::analyze(const uint8_t* data, size_t size)
+{
+	if (size < FrameCapture::headerSize)
+		return false;
+	compressed = FrameCapture::decodeCompressedHeader(data);
+	if (!compressed && !FrameCapture::decodeHeader(data))
+		return false;
+
+	// records of plain captures, blocks of compressed ones
+	uint64_t units = compressed ?
+		(size - FrameCapture::headerSize + FrameCapture::blockSize - 1) / FrameCapture::blockSize :
+		(size - FrameCapture::headerSize) / FrameCapture::recordSize;
+	uint32_t chunkUnits = compressed ? config.chunkBlocks : config.chunkRecords;
+
+	// while the main thread processes one batch of chunks in order,
+	// the workers decode the next batch
+	unsigned threads = std::max(1u, config.threads);
+	std::vector<Chunk> batches[2];
+	batches[0].resize(threads);
+	batches[1].resize(threads);
+
+	uint64_t next = 0;
+	auto startBatch = [&](std::vector<Chunk>& batch, std::vector<std::thread>& workers) {
+		for (Chunk& chunk : batch)
+		{
+			uint64_t n = std::min<uint64_t>(std::max(1u, chunkUnits), units - next);
+			chunk.first = compressed ? 0 : next;
+			chunk.count = compressed ? 0 : n;
+			chunk.firstBlock = compressed ? next : 0;
+			chunk.blocks = compressed ? n : 0;
+			next += n;
+			if (n > 0)
+				workers.push_back(std::thread(&CaptureAnalyzer::decodeChunk, this, data, size, std::ref(chunk)));
+		}
+	};
+
+	std::vector<std::thread> workers;
+	startBatch(batches[0], workers);
+	for (int current = 0; ; current ^= 1)
+	{
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+
+		bool last = next >= units;
+		if (!last)
+			startBatch(batches[current ^ 1], workers);
+
+		for (const Chunk& chunk : batches[current])
+			processChunk(chunk);
+
+		if (last)
+			break;
+	}
+	return true;
+}
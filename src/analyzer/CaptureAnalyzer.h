@@ -0,0 +1,131 @@
+#ifndef CAPTURE_ANALYZER_H
+#define CAPTURE_ANALYZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "DisplayFrame.h"
+#include "Debouncer.h"
+#include "TemperatureClassifier.h"
+
+// Decodes a capture file like SpaState does on the device, for captures
+// too long to replay. The records are split into chunks that are decoded
+// on all cores: record parsing, the segment patterns, glyph statistics
+// and anomalies of single frames. The refresh assembly, temperature
+// classification and LED debouncing depend on all frames before, they
+// run in order on the main thread while the next chunks are decoded.
+// Compressed captures are split at their blocks, which decode on their
+// own.
+class CaptureAnalyzer
+{
+public:
+	struct Config
+	{
+		unsigned threads = 1;
+		uint32_t chunkRecords = 1 << 20;
+		uint32_t chunkBlocks = 16;        // of compressed captures
+		uint32_t maxLatchInterval = 5000; // micros between frames before it is an anomaly
+		size_t maxAnomalies = 100;        // anomalies listed, all are counted
+	};
+
+	enum AnomalyType
+	{
+		ANOMALY_GAP,            // frames were lost on the device before this one
+		ANOMALY_UNKNOWN_GLYPH,  // digit frame with an unknown segment pattern
+		ANOMALY_TORN_REFRESH,   // refresh rejected because frames were lost
+		ANOMALY_TIME_BACKWARDS, // latch time before the previous frame's
+		ANOMALY_LATCH_INTERVAL, // more than maxLatchInterval since the previous frame
+		NUM_ANOMALY_TYPES
+	};
+
+	struct Anomaly
+	{
+		uint64_t record;
+		uint64_t micros; // since the first record
+		AnomalyType type;
+		uint16_t frame;
+		int8_t slot;
+	};
+
+	// a state change SpaState would emit
+	struct Event
+	{
+		uint64_t micros; // since the first record
+		std::string text;
+	};
+
+	CaptureAnalyzer(const Config& config) : config(config) {}
+
+	// data is the whole capture file, false if it is not a capture
+	bool analyze(const uint8_t* data, size_t size);
+
+	const std::vector<Event>& getTimeline() const { return timeline; }
+	const std::vector<Anomaly>& getAnomalies() const { return anomalies; }
+	uint64_t getAnomalyCount(AnomalyType type) const { return anomalyCounts[type]; }
+	// digit frames of a slot that showed the segment pattern
+	uint64_t getPatternCount(int slot, uint8_t gfedcba) const { return patternCounts[slot][gfedcba & 0x7F]; }
+
+	uint64_t getRecordCount() const { return records; }
+	uint64_t getRefreshCount() const { return refreshes; }
+	uint64_t getOtherFrameCount() const { return otherFrames; }
+	uint64_t getDuration() const { return nowMicros; }
+
+	static const char* anomalyName(AnomalyType type);
+
+private:
+	// decoded records of one chunk, reused for the following chunks
+	struct Chunk
+	{
+		uint64_t first = 0;
+		size_t count = 0;
+		uint32_t firstBlock = 0; // of compressed captures
+		uint32_t blocks = 0;
+		std::vector<uint16_t> frames;
+		std::vector<uint32_t> micros;
+		std::vector<uint8_t> flags;
+		std::vector<uint8_t> patterns;
+		std::vector<int8_t> slots;
+		std::vector<Anomaly> anomalies;
+		uint64_t anomalyCounts[NUM_ANOMALY_TYPES];
+		uint64_t patternCounts[4][128];
+		uint64_t otherFrames;
+	};
+
+	void decodeChunk(const uint8_t* data, size_t size, Chunk& chunk);
+	void readRecords(const uint8_t* data, Chunk& chunk, uint32_t& previousMicros);
+	void readBlocks(const uint8_t* data, size_t size, Chunk& chunk, uint32_t& previousMicros);
+	void processChunk(const Chunk& chunk);
+	void processRefresh(const DisplayFrame& frame);
+	void addAnomaly(const Anomaly& anomaly);
+	void addEvent(const std::string& text);
+
+	const Config config;
+
+	std::vector<Event> timeline;
+	std::vector<Anomaly> anomalies;
+	uint64_t anomalyCounts[NUM_ANOMALY_TYPES] = {};
+	uint64_t patternCounts[4][128] = {};
+	bool compressed = false;
+	uint64_t records = 0;
+	uint64_t refreshes = 0;
+	uint64_t otherFrames = 0;
+
+	// the state of SpaState's decoder
+	uint64_t nowMicros = 0;
+	uint32_t lastMicros = 0;
+	bool displayGap = false;
+	DisplayFrameAssembler displayAssembler;
+	uint8_t pendingPatterns[4] = {}; // of the digit frames added to the assembler
+	DisplayFrame lastDisplayFrame;
+	bool lastDisplayFrameValid = false;
+	char digit[5] = {};
+	TemperatureClassifier temperatureClassifier;
+	Debouncer<uint16_t, SPA_LED_DEBOUNCE_DEPTH> ledDebouncer;
+	int curTemp = 15;
+	int targTemp = 25;
+	bool isCelsius = true;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SEGMENT_GATHER_H
+#define SEGMENT_GATHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "SegmentDecoder.h"
+
+// SegmentDecoder::segments for many frames at once. The same shifts and
+// masks gather the seven segment bits of 16 frames per vector, the
+// compiler maps them to SSE/AVX or NEON. checkSegmentGather compares it
+// with the firmware decoder for every possible frame.
+typedef uint16_t FrameVector __attribute__((vector_size(32)));
+
+static const size_t frameVectorLanes = sizeof(FrameVector) / sizeof(uint16_t);
+
+static inline void gatherSegments(const uint16_t* frames, uint8_t* patterns, size_t count)
+{
+	size_t i = 0;
+	for (; i + frameVectorLanes <= count; i += frameVectorLanes)
+	{
+		FrameVector msg;
+		memcpy(&msg, frames + i, sizeof(msg));
+		FrameVector gfedcba = SegmentDecoder::segmentPattern<FrameVector>(~msg);
+		for (size_t lane = 0; lane < frameVectorLanes; ++lane)
+			patterns[i + lane] = gfedcba[lane];
+	}
+	for (size_t rest = count - i; rest > 0; --rest, ++i)
+		patterns[i] = SegmentDecoder::segments(frames[i]);
+}
+
+// true if gatherSegments decodes all frames like the firmware
+static inline bool checkSegmentGather()
+{
+	static uint16_t frames[0x10000];
+	static uint8_t patterns[0x10000];
+	for (uint32_t frame = 0; frame < 0x10000; ++frame)
+		frames[frame] = frame;
+	gatherSegments(frames, patterns, 0x10000);
+	for (uint32_t frame = 0; frame < 0x10000; ++frame)
+	{
+		if (patterns[frame] != SegmentDecoder::segments(frame))
+			return false;
+	}
+	return true;
+}
+
+#endif
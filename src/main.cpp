@@ -20,10 +20,12 @@
 
 
 #include "SpaState.h"
+#include "DallasAirTemperatureSensor.h"
 
 #include "Webserver.h"
 #include "Log.h"
 #include "SpaMQTT.h"
+#include "RetryBackoff.h"
 
 #include "OTAPublicKey.h"
 
@@ -44,6 +46,11 @@ const int PIN_CLK     = D7;
 const int PIN_LAT     = D6; 
 const int PIN_DAT_IN  = D5; 
 const int PIN_DAT_OUT = D0; //emulate button press      
+const int PIN_DS18S20 = D2; //air temperature sensor
+
+typedef SpaBusPins<PIN_CLK, PIN_LAT, PIN_DAT_IN, PIN_DAT_OUT> BusPins;
+
+DallasAirTemperatureSensor airTemperatureSensor(PIN_DS18S20);
 
 
 #define TIMEZONE 	TZ_America_Vancouver
@@ -155,7 +162,9 @@ void setup()
 
 	pinMode(LED_BUILTIN, OUTPUT);
 	digitalWrite(PIN_DAT_OUT, HIGH);
-	state.init(PIN_CLK, PIN_LAT, PIN_DAT_IN, PIN_DAT_OUT);
+	state.setAirTemperatureSensor(&airTemperatureSensor);
+	state.setTimingFile("/timing.json");
+	state.init<BusPins>();
 }
 
 timeval cbtime;			// when time set callback was called
@@ -178,22 +187,23 @@ static void timeSet()
 	#endif
 }
 
+// reconnect after 30s without WiFi, then after 60s, 120s, ... 480s
+static RetryBackoff wifiRetry(30000, 60000, 960000);
+
 void checkWiFiConnection()
 {
-  static uint32_t nextRetry = 30000;
   static wl_status_t lastWiFiStatus = WiFi.status();
   wl_status_t newWiFiStatus = WiFi.status();
-  static uint32_t timeLastChange = 0;
-  uint32_t timeNow = millis();
+  uint32_t timeNow = SystemClock::instance().millis();
   // if wifi status hasn't changed in 60 seconds and it's not WL_CONNECTED
   // try to reconnect
   if (lastWiFiStatus != newWiFiStatus)
   {
 	logger.addLine("IP Address: " + WiFi.localIP().toString());
     lastWiFiStatus = newWiFiStatus;
-    timeLastChange = timeNow;
+    wifiRetry.restart(timeNow);
   }
-  else if (timeNow - timeLastChange > nextRetry && WL_CONNECTED != newWiFiStatus)
+  else if (wifiRetry.isDue(timeNow) && WL_CONNECTED != newWiFiStatus)
   {
     String wifiInfo;
     switch (newWiFiStatus)
@@ -223,16 +233,12 @@ void checkWiFiConnection()
       wifiInfo = "WL_CONNECTED";
       break;
     }
-    wifiInfo = "WiFi has been stuck in " + wifiInfo + " for more than " + String(nextRetry/1000) + " second(s), attempting reconnect...";
+    wifiInfo = "WiFi has been stuck in " + wifiInfo + " for more than " + String(wifiRetry.getInterval()/1000) + " second(s), attempting reconnect...";
     
 	logger.addLine(wifiInfo);
     
     WiFi.reconnect();
-    timeLastChange = timeNow;
-
-    nextRetry = nextRetry * 2;
-    if (nextRetry >= 960000)
-      nextRetry = 60000;
+    wifiRetry.attempted(timeNow);
   }
 }
 
@@ -0,0 +1,43 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+#include <new>
+
+static uint64_t allocationCount = 0;
+static uint64_t allocationBytes = 0;
+
+uint64_t AllocationCounter::getCount()
+{
+	return allocationCount;
+}
+
+uint64_t AllocationCounter::getBytes()
+{
+	return allocationBytes;
+}
+
+
+void* operator new(size_t size)
+{
+	++allocationCount;
+	allocationBytes += size;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,15 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <stdint.h>
+
+// Counts the heap allocations of the host program, operator new is
+// replaced in AllocationCounter.cpp
+class AllocationCounter
+{
+public:
+	static uint64_t getCount();
+	static uint64_t getBytes();
+};
+
+#endif
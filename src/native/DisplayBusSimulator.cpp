@@ -0,0 +1,145 @@
+#include "DisplayBusSimulator.h"
+
+#include <NativeHal.h>
+#include <algorithm>
+
+#include "DisplayFrame.h"
+#include "SegmentDecoder.h"
+
+// frames the main board sends to scan the buttons
+static const uint16_t buttonScanFrames[DisplayBusSimulator::NUM_BUTTONS] = {
+	SpaProtocol::CODE_POWER,
+	SpaProtocol::CODE_UP,
+	SpaProtocol::CODE_DOWN,
+	SpaProtocol::CODE_FILTER,
+	SpaProtocol::CODE_HEATER,
+	SpaProtocol::CODE_BUBBLE,
+	SpaProtocol::CODE_FC
+};
+
+
+DisplayBusSimulator::DisplayBusSimulator(uint8_t clockPin, uint8_t latchPin, uint8_t dataPin, uint8_t dataOutPin, const Config& config) :
+	clockPin(clockPin), latchPin(latchPin), dataPin(dataPin), dataOutPin(dataOutPin), config(config),
+	bitNanos(1000000000ULL / config.clockHz),
+	// a frame takes at least 16 clocks and the latch
+	frameNanos(std::max<uint64_t>(1000000000ULL / config.frameRate, 17 * bitNanos)),
+	random(config.seed)
+{
+	setText("    ");
+	nowNanos = NativeHal::getMicros64() * 1000;
+	nextFrameNanos = nowNanos;
+}
+
+void DisplayBusSimulator::setText(const char* text)
+{
+	for (int slot = 0; slot < 4; ++slot)
+	{
+		uint16_t frame = 0xFFFF;
+		SegmentDecoder::encode(text[slot], frame);
+		digitFrames[slot] = frame & ~DisplayFrame::selectMask(slot);
+	}
+}
+
+void DisplayBusSimulator::setBlink(uint32_t periodMS)
+{
+	uint64_t nanos = periodMS * 1000000ULL;
+	if (nanos == blinkNanos)
+		return;
+	// the blinking starts with the text shown
+	blinkNanos = nanos;
+	blinkStartNanos = nowNanos;
+}
+
+bool DisplayBusSimulator::chance(double probability)
+{
+	return probability > 0 && std::generate_canonical<double, 32>(random) < probability;
+}
+
+uint16_t DisplayBusSimulator::nextFrame(int& button)
+{
+	uint8_t cycleLength = DisplayFrame::NUM_SLOTS + (config.buttonScan ? NUM_BUTTONS : 0);
+	uint8_t index = sequenceIndex;
+	sequenceIndex = (sequenceIndex + 1) % cycleLength;
+
+	button = -1;
+	if (index < 4)
+	{
+		bool blank = blinkNanos && ((nowNanos - blinkStartNanos) / blinkNanos) % 2;
+		if (blank)
+			return 0xFFFF & ~DisplayFrame::selectMask(index);
+		return digitFrames[index];
+	}
+	if (DisplayFrame::SLOT_LEDS == index)
+	{
+		++stats.displayRefreshes;
+		return 0xFFFF & ~DisplayFrame::selectMask(DisplayFrame::SLOT_LEDS) & ~leds;
+	}
+	button = index - DisplayFrame::NUM_SLOTS;
+	return buttonScanFrames[button];
+}
+
+// returns whether the data out pin pulled the data line low
+bool DisplayBusSimulator::sendFrame(uint16_t frame)
+{
+	bool pulledLow = false;
+
+	int clocks = 16;
+	if (chance(config.clockErrorRate))
+	{
+		if (random() & 1)
+		{
+			--clocks;
+			++stats.shortFrames;
+		}
+		else
+		{
+			++clocks;
+			++stats.longFrames;
+		}
+	}
+
+	// MSB first, the data is stable at the rising clock edge
+	for (int i = clocks - 1; i >= 0; --i)
+	{
+		bool level = i < 16 && ((frame >> i) & 1);
+		if (chance(config.bitErrorRate))
+		{
+			level = !level;
+			++stats.bitErrors;
+		}
+		if (!NativeHal::getOutput(dataOutPin))
+		{
+			level = false;
+			pulledLow = true;
+		}
+		NativeHal::setInput(dataPin, level);
+		NativeHal::setInput(clockPin, false);
+		NativeHal::setInput(clockPin, true);
+		nowNanos += bitNanos;
+	}
+
+	NativeHal::setMicros(nowNanos / 1000);
+	NativeHal::setInput(latchPin, false);
+	NativeHal::setInput(latchPin, true);
+	++stats.frames;
+	return pulledLow;
+}
+
+void DisplayBusSimulator::run(uint32_t micros)
+{
+	uint64_t endNanos = nowNanos + micros * 1000ULL;
+
+	while (nextFrameNanos + 17 * bitNanos <= endNanos)
+	{
+		uint64_t jitter = config.jitterNanos ? random() % (config.jitterNanos + 1) : 0;
+		nowNanos = std::max(nowNanos, nextFrameNanos + jitter);
+		int button;
+		uint16_t frame = nextFrame(button);
+		bool pulledLow = sendFrame(frame);
+		nextFrameNanos += frameNanos;
+		frameSent(button, pulledLow);
+	}
+
+	nowNanos = std::max(nowNanos, endNanos);
+	NativeHal::setMicros(nowNanos / 1000);
+}
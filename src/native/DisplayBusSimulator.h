@@ -0,0 +1,98 @@
+#ifndef DISPLAY_BUS_SIMULATOR_H
+#define DISPLAY_BUS_SIMULATOR_H
+
+#include <stdint.h>
+#include <random>
+
+// Generates the clock, latch and data signals the main board sends to
+// the display, on the simulated pins of NativeHal. Each scan cycle is
+// the four digit frames, the LED frame and the seven button scan
+// frames, so the interrupt handlers of SpaState see the same sequence
+// as on the bus. The data out pin of the firmware pulls the data line
+// low like the open drain output on the real bus.
+class DisplayBusSimulator
+{
+public:
+	struct Config
+	{
+		uint32_t clockHz = 100000;    // bit clock
+		uint32_t frameRate = 2000;    // frames per second
+		uint32_t jitterNanos = 0;     // largest random delay of a frame
+		double bitErrorRate = 0;      // probability of a flipped bit
+		double clockErrorRate = 0;    // probability of a missing or extra clock in a frame
+		bool buttonScan = true;       // send the button scan frames
+		uint32_t seed = 1;
+	};
+
+	struct Stats
+	{
+		uint32_t frames = 0;
+		uint32_t displayRefreshes = 0;
+		uint32_t bitErrors = 0;
+		uint32_t shortFrames = 0;
+		uint32_t longFrames = 0;
+	};
+
+	// order of the button scan frames
+	enum Button
+	{
+		BUTTON_POWER,
+		BUTTON_UP,
+		BUTTON_DOWN,
+		BUTTON_FILTER,
+		BUTTON_HEATER,
+		BUTTON_BUBBLE,
+		BUTTON_FC,
+		NUM_BUTTONS
+	};
+
+	DisplayBusSimulator(uint8_t clockPin, uint8_t latchPin, uint8_t dataPin, uint8_t dataOutPin, const Config& config);
+	virtual ~DisplayBusSimulator() {}
+
+	// the 4 characters shown, like "38 C"
+	void setText(const char* text);
+	// LED bits that are lit
+	void setLEDs(uint16_t leds) { this->leds = leds; }
+	// blank the display every other periodMS like the target
+	// temperature blinks, 0 shows the text steadily
+	void setBlink(uint32_t periodMS);
+
+	// drive the bus for the given time, frames are latched at their
+	// time on the simulated clock
+	void run(uint32_t micros);
+
+	uint64_t getNanos() const { return nowNanos; }
+	const Stats& getStats() const { return stats; }
+
+protected:
+	// called after each frame with the button it scanned, -1 for
+	// display frames, and whether the data line was pulled low
+	virtual void frameSent(int button, bool pulledLow) {}
+
+private:
+	uint16_t nextFrame(int& button);
+	bool sendFrame(uint16_t frame);
+	bool chance(double probability);
+
+	const uint8_t clockPin;
+	const uint8_t latchPin;
+	const uint8_t dataPin;
+	const uint8_t dataOutPin;
+	const Config config;
+	const uint64_t bitNanos;
+	const uint64_t frameNanos;
+
+	uint16_t digitFrames[4];
+	uint16_t leds = 0;
+	uint64_t blinkNanos = 0;
+	uint64_t blinkStartNanos = 0;
+
+	uint8_t sequenceIndex = 0;
+	uint64_t nowNanos = 0;
+	uint64_t nextFrameNanos = 0;
+
+	std::mt19937 random;
+	Stats stats;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "MainBoardEmulator.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "SpaProtocol.h"
+
+// LED bits of the LED frame
+static const uint16_t LED_POWER        = 1 << SpaProtocol::LED_POWER;
+static const uint16_t LED_HEATER_RED   = 1 << SpaProtocol::LED_HEATER_RED;
+static const uint16_t LED_HEATER_GREEN = 1 << SpaProtocol::LED_HEATER_GREEN;
+static const uint16_t LED_BUBBLE       = 1 << SpaProtocol::LED_BUBBLE;
+static const uint16_t LED_FILTER       = 1 << SpaProtocol::LED_FILTER;
+
+static int toFahrenheit(int c)
+{
+	return (int)lround(c * 9 / 5.0 + 32);
+}
+
+static int toCelsius(int f)
+{
+	return (int)lround((f - 32) * 5 / 9.0);
+}
+
+
+MainBoardEmulator::MainBoardEmulator(uint8_t clockPin, uint8_t latchPin, uint8_t dataPin, uint8_t dataOutPin, const Config& config) :
+	DisplayBusSimulator(clockPin, latchPin, dataPin, dataOutPin, config)
+{
+	lastNanos = getNanos();
+	updateDisplay();
+}
+
+void MainBoardEmulator::setState(const State& newState)
+{
+	state = newState;
+	setMode = false;
+	updateDisplay();
+}
+
+void MainBoardEmulator::hibernate()
+{
+	state.hibernating = true;
+	state.filter = false;
+	state.heater = false;
+	setMode = false;
+	updateDisplay();
+}
+
+void MainBoardEmulator::frameSent(int button, bool pulledLow)
+{
+	// the data line is pulled low in the frame after the scan frame
+	// of the pressed button
+	if (previousButton >= 0)
+	{
+		uint8_t& held = heldScans[previousButton];
+		if (pulledLow)
+		{
+			if (held < pressScans && ++held == pressScans)
+				press((Button)previousButton);
+		}
+		else
+		{
+			held = 0;
+		}
+	}
+	previousButton = button;
+
+	uint64_t now = getNanos();
+	if (getIsHeating() && heatingNanosPerDegree)
+	{
+		heatingNanos += now - lastNanos;
+		if (heatingNanos >= heatingNanosPerDegree)
+		{
+			heatingNanos = 0;
+			++state.current;
+		}
+	}
+	lastNanos = now;
+
+	if (setMode && now >= setModeEndNanos)
+		setMode = false;
+
+	if (button < 0)
+		updateDisplay();
+}
+
+void MainBoardEmulator::press(Button button)
+{
+	++pressCount[button];
+
+	if (BUTTON_POWER == button)
+	{
+		// everything is off after switching the power
+		state.power = !state.power;
+		state.filter = false;
+		state.heater = false;
+		state.bubbles = false;
+		state.hibernating = false;
+		setMode = false;
+		return;
+	}
+	if (!state.power)
+		return;
+	if (state.hibernating)
+	{
+		// only the filter button wakes the board
+		if (BUTTON_FILTER == button)
+		{
+			state.hibernating = false;
+			state.filter = true;
+		}
+		return;
+	}
+
+	switch (button)
+	{
+	case BUTTON_UP:
+	case BUTTON_DOWN:
+		// the first press shows the target temperature,
+		// the next ones change it while it blinks
+		if (setMode)
+		{
+			int minTemp = SpaProtocol::minTemperature(state.celsius);
+			int maxTemp = SpaProtocol::maxTemperature(state.celsius);
+			int step = BUTTON_UP == button ? 1 : -1;
+			state.target = std::min(maxTemp, std::max(minTemp, state.target + step));
+		}
+		setMode = true;
+		setModeEndNanos = getNanos() + setModeNanos;
+		break;
+	case BUTTON_FILTER:
+		// the heater needs the filter pump
+		state.filter = !state.filter;
+		if (!state.filter)
+			state.heater = false;
+		break;
+	case BUTTON_HEATER:
+		state.heater = !state.heater;
+		if (state.heater)
+			state.filter = true;
+		break;
+	case BUTTON_BUBBLE:
+		state.bubbles = !state.bubbles;
+		break;
+	case BUTTON_FC:
+		state.celsius = !state.celsius;
+		if (state.celsius)
+		{
+			state.current = toCelsius(state.current);
+			state.target = toCelsius(state.target);
+		}
+		else
+		{
+			state.current = toFahrenheit(state.current);
+			state.target = toFahrenheit(state.target);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void MainBoardEmulator::updateDisplay()
+{
+	if (!state.power)
+	{
+		setText("    ");
+		setBlink(0);
+		setLEDs(0);
+		return;
+	}
+
+	if (state.hibernating)
+	{
+		setText("End ");
+		setBlink(0);
+		setLEDs(LED_POWER | (state.bubbles ? LED_BUBBLE : 0));
+		return;
+	}
+
+	char text[8];
+	snprintf(text, sizeof(text), "%-3d%c", setMode ? state.target : state.current, state.celsius ? 'C' : 'F');
+	setText(text);
+	setBlink(setMode ? 500 : 0);
+
+	uint16_t leds = LED_POWER;
+	if (state.filter)
+		leds |= LED_FILTER;
+	if (state.bubbles)
+		leds |= LED_BUBBLE;
+	if (state.heater)
+		leds |= getIsHeating() ? LED_HEATER_RED : LED_HEATER_GREEN;
+	setLEDs(leds);
+}
@@ -0,0 +1,65 @@
+#ifndef MAIN_BOARD_EMULATOR_H
+#define MAIN_BOARD_EMULATOR_H
+
+#include "DisplayBusSimulator.h"
+
+// The main board of the spa on the simulated display bus. It watches
+// for the data line being pulled low after a button scan frame, like
+// SpaState::simulateButtonPress does, applies the button to its state
+// and shows the result on the display and the LEDs.
+class MainBoardEmulator : public DisplayBusSimulator
+{
+public:
+	struct State
+	{
+		bool power = true;
+		bool filter = false;
+		bool heater = false;
+		bool bubbles = false;
+		bool celsius = true;
+		int current = 38; // water temperature in the current units
+		int target = 40;  // target temperature in the current units
+		bool hibernating = false; // END, the filter button wakes the board
+	};
+
+	MainBoardEmulator(uint8_t clockPin, uint8_t latchPin, uint8_t dataPin, uint8_t dataOutPin, const Config& config);
+
+	const State& getState() const { return state; }
+	void setState(const State& newState);
+	// what the board does after 72 hours of heating: it shows END with
+	// the filter and the heater off
+	void hibernate();
+
+	// minutes the heater needs to raise the water by one degree,
+	// 0 keeps the water temperature constant
+	void setHeatingMinutesPerDegree(uint32_t minutes) { heatingNanosPerDegree = minutes * 60000000000ULL; }
+
+	bool getIsHeating() const { return state.power && state.heater && state.current < state.target; }
+	// presses the board took, per button
+	uint32_t getPressCount(Button button) const { return pressCount[button]; }
+
+protected:
+	virtual void frameSent(int button, bool pulledLow) override;
+
+private:
+	// scan cycles a button has to be held before it is taken
+	static const uint8_t pressScans = 2;
+	// how long the target temperature blinks after up or down
+	static const uint64_t setModeNanos = 5000000000ULL;
+
+	void press(Button button);
+	void updateDisplay();
+
+	State state;
+	int previousButton = -1;
+	uint8_t heldScans[NUM_BUTTONS] = {};
+	uint32_t pressCount[NUM_BUTTONS] = {};
+
+	bool setMode = false;
+	uint64_t setModeEndNanos = 0;
+	uint64_t heatingNanosPerDegree = 0;
+	uint64_t heatingNanos = 0;
+	uint64_t lastNanos = 0;
+};
+
+#endif
@@ -0,0 +1,446 @@
+#include "MqttBroker.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+enum PacketType
+{
+	PACKET_CONNECT     = 0x10,
+	PACKET_CONNACK     = 0x20,
+	PACKET_PUBLISH     = 0x30,
+	PACKET_PUBACK      = 0x40,
+	PACKET_SUBSCRIBE   = 0x80,
+	PACKET_SUBACK      = 0x90,
+	PACKET_UNSUBSCRIBE = 0xA0,
+	PACKET_UNSUBACK    = 0xB0,
+	PACKET_PINGREQ     = 0xC0,
+	PACKET_PINGRESP    = 0xD0,
+	PACKET_DISCONNECT  = 0xE0
+};
+
+// reads a length prefixed string of a packet
+static bool readString(const uint8_t*& p, const uint8_t* end, std::string& s)
+{
+	if (end - p < 2)
+		return false;
+	size_t length = (p[0] << 8) | p[1];
+	p += 2;
+	if ((size_t)(end - p) < length)
+		return false;
+	s.assign((const char*)p, length);
+	p += length;
+	return true;
+}
+
+static void appendString(std::vector<uint8_t>& v, const std::string& s)
+{
+	v.push_back(s.size() >> 8);
+	v.push_back(s.size());
+	v.insert(v.end(), s.begin(), s.end());
+}
+
+bool MqttBroker::matches(const std::string& filter, const std::string& topic)
+{
+	// wildcards do not match the system topics
+	if (!topic.empty() && '$' == topic[0] && !filter.empty() && ('+' == filter[0] || '#' == filter[0]))
+		return false;
+
+	size_t f = 0;
+	size_t t = 0;
+	for (;;)
+	{
+		size_t fEnd = std::min(filter.find('/', f), filter.size());
+		if (0 == filter.compare(f, fEnd - f, "#"))
+			return true;
+		// the topic has fewer levels
+		if (t > topic.size())
+			return false;
+		size_t tEnd = std::min(topic.find('/', t), topic.size());
+		if (0 != filter.compare(f, fEnd - f, "+") && 0 != filter.compare(f, fEnd - f, topic, t, tEnd - t))
+			return false;
+		f = fEnd + 1;
+		t = tEnd + 1;
+		if (f > filter.size())
+			return t > topic.size();
+	}
+}
+
+bool MqttBroker::start(uint16_t newPort)
+{
+	stop();
+
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd < 0)
+		return false;
+	int one = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(newPort);
+	socklen_t addrLength = sizeof(addr);
+	if (0 != bind(listenFd, (sockaddr*)&addr, sizeof(addr)) ||
+		0 != listen(listenFd, 128) ||
+		0 != getsockname(listenFd, (sockaddr*)&addr, &addrLength))
+	{
+		::close(listenFd);
+		listenFd = -1;
+		return false;
+	}
+
+	port = ntohs(addr.sin_port);
+	running = true;
+	thread = std::thread(&MqttBroker::run, this);
+	return true;
+}
+
+void MqttBroker::stop()
+{
+	if (!running)
+		return;
+
+	running = false;
+	thread.join();
+	for (Connection& c : connections)
+		close(c, false);
+	connections.clear();
+	::close(listenFd);
+	listenFd = -1;
+}
+
+MqttBroker::Stats MqttBroker::getStats() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return stats;
+}
+
+void MqttBroker::run()
+{
+	std::vector<pollfd> fds;
+	while (running)
+	{
+		if (dropRequested)
+		{
+			dropRequested = false;
+			for (Connection& c : connections)
+				close(c, true);
+		}
+
+		connections.erase(std::remove_if(connections.begin(), connections.end(),
+			[](const Connection& c) { return c.fd < 0; }), connections.end());
+
+		fds.resize(connections.size() + 1);
+		fds[0].fd = listenFd;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < connections.size(); ++i)
+		{
+			fds[i + 1].fd = connections[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+
+		if (poll(fds.data(), fds.size(), 10) <= 0)
+			continue;
+
+		// accepting may move the connections
+		bool accepting = fds[0].revents & POLLIN;
+		for (size_t i = 0; i < connections.size(); ++i)
+		{
+			Connection& c = connections[i];
+			if (c.fd >= 0 && fds[i + 1].fd == c.fd && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) && !receive(c))
+				close(c, true);
+		}
+		if (accepting)
+			accept();
+	}
+}
+
+void MqttBroker::accept()
+{
+	int fd = ::accept(listenFd, nullptr, nullptr);
+	if (fd < 0)
+		return;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	Connection c;
+	c.fd = fd;
+	connections.push_back(c);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	++stats.clients;
+	stats.peakClients = std::max(stats.peakClients, stats.clients);
+}
+
+bool MqttBroker::receive(Connection& c)
+{
+	uint8_t buf[4096];
+	ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+		return true;
+	if (n <= 0)
+		return false;
+	c.input.insert(c.input.end(), buf, buf + n);
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats.bytesIn += n;
+	}
+
+	// the complete packets
+	size_t pos = 0;
+	while (c.fd >= 0 && c.input.size() - pos >= 2)
+	{
+		size_t length = 0;
+		size_t i = pos + 1;
+		int shift = 0;
+		bool complete = false;
+		while (i < c.input.size() && shift <= 21)
+		{
+			uint8_t b = c.input[i++];
+			length |= (size_t)(b & 0x7F) << shift;
+			shift += 7;
+			if (!(b & 0x80))
+			{
+				complete = true;
+				break;
+			}
+		}
+		if (!complete)
+		{
+			if (shift > 21)
+				return false;
+			break;
+		}
+		if (c.input.size() - i < length)
+			break;
+		if (!handlePacket(c, c.input[pos], c.input.data() + i, length))
+			return false;
+		pos = i + length;
+	}
+	if (c.fd >= 0)
+		c.input.erase(c.input.begin(), c.input.begin() + pos);
+	return true;
+}
+
+bool MqttBroker::handlePacket(Connection& c, uint8_t header, const uint8_t* data, size_t size)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+	uint8_t type = header & 0xF0;
+
+	if (!c.connected && PACKET_CONNECT != type)
+		return false;
+
+	switch (type)
+	{
+	case PACKET_CONNECT:
+	{
+		std::string protocol;
+		if (c.connected || !readString(p, end, protocol) || end - p < 4)
+			return false;
+		uint8_t flags = p[1];
+		p += 4;
+		if (!readString(p, end, c.clientId))
+			return false;
+		if (flags & 0x04)
+		{
+			if (!readString(p, end, c.willTopic) || !readString(p, end, c.willPayload))
+				return false;
+			c.willRetain = flags & 0x20;
+		}
+
+		// a client id connects only once, the older connection goes
+		uint32_t takeovers = 0;
+		for (Connection& other : connections)
+		{
+			if (&other != &c && other.fd >= 0 && other.connected && other.clientId == c.clientId)
+			{
+				close(other, true);
+				++takeovers;
+			}
+		}
+
+		c.connected = true;
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			++stats.connects;
+			stats.takeovers += takeovers;
+		}
+		const uint8_t connack[2] = { 0, 0 };
+		return send(c, PACKET_CONNACK, connack, sizeof(connack));
+	}
+	case PACKET_PUBLISH:
+	{
+		std::string topic;
+		if (!readString(p, end, topic))
+			return false;
+		uint8_t qos = (header >> 1) & 3;
+		uint8_t packetId[2] = {};
+		if (qos > 0)
+		{
+			if (end - p < 2)
+				return false;
+			packetId[0] = p[0];
+			packetId[1] = p[1];
+			p += 2;
+		}
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			++stats.messagesIn;
+		}
+		publish(topic, std::string((const char*)p, end - p), header & 1);
+		return qos != 1 || send(c, PACKET_PUBACK, packetId, sizeof(packetId));
+	}
+	case PACKET_SUBSCRIBE:
+	{
+		if (end - p < 2)
+			return false;
+		std::vector<uint8_t> suback(p, p + 2);
+		std::vector<std::string> added;
+		p += 2;
+		while (p < end)
+		{
+			std::string filter;
+			if (!readString(p, end, filter) || p == end)
+				return false;
+			++p;
+			if (std::find(c.filters.begin(), c.filters.end(), filter) == c.filters.end())
+				c.filters.push_back(filter);
+			added.push_back(filter);
+			suback.push_back(0);
+		}
+		if (!send(c, PACKET_SUBACK, suback.data(), suback.size()))
+			return false;
+
+		for (std::map<std::string, std::string>::const_iterator r = retained.begin(); r != retained.end(); ++r)
+		{
+			for (const std::string& filter : added)
+			{
+				if (!matches(filter, r->first))
+					continue;
+				std::vector<uint8_t> message;
+				appendString(message, r->first);
+				message.insert(message.end(), r->second.begin(), r->second.end());
+				if (!send(c, PACKET_PUBLISH | 1, message.data(), message.size()))
+					return false;
+				std::lock_guard<std::mutex> lock(statsMutex);
+				++stats.messagesOut;
+				break;
+			}
+		}
+		return true;
+	}
+	case PACKET_UNSUBSCRIBE:
+	{
+		if (end - p < 2)
+			return false;
+		uint8_t packetId[2] = { p[0], p[1] };
+		p += 2;
+		while (p < end)
+		{
+			std::string filter;
+			if (!readString(p, end, filter))
+				return false;
+			c.filters.erase(std::remove(c.filters.begin(), c.filters.end(), filter), c.filters.end());
+		}
+		return send(c, PACKET_UNSUBACK, packetId, sizeof(packetId));
+	}
+	case PACKET_PINGREQ:
+		return send(c, PACKET_PINGRESP, nullptr, 0);
+	case PACKET_DISCONNECT:
+		close(c, false);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void MqttBroker::publish(const std::string& topic, const std::string& payload, bool retain)
+{
+	if (retain)
+	{
+		if (payload.empty())
+			retained.erase(topic);
+		else
+			retained[topic] = payload;
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats.retained = retained.size();
+	}
+
+	std::vector<uint8_t> message;
+	appendString(message, topic);
+	message.insert(message.end(), payload.begin(), payload.end());
+
+	for (Connection& c : connections)
+	{
+		if (c.fd < 0 || !c.connected)
+			continue;
+		for (const std::string& filter : c.filters)
+		{
+			if (!matches(filter, topic))
+				continue;
+			if (send(c, PACKET_PUBLISH, message.data(), message.size()))
+			{
+				std::lock_guard<std::mutex> lock(statsMutex);
+				++stats.messagesOut;
+			}
+			else
+			{
+				close(c, true);
+			}
+			break;
+		}
+	}
+}
+
+bool MqttBroker::send(Connection& c, uint8_t header, const uint8_t* data, size_t size)
+{
+	std::vector<uint8_t> packet;
+	packet.push_back(header);
+	size_t length = size;
+	do
+	{
+		uint8_t b = length & 0x7F;
+		length >>= 7;
+		packet.push_back(length ? b | 0x80 : b);
+	} while (length);
+	packet.insert(packet.end(), data, data + size);
+
+	size_t sent = 0;
+	while (c.fd >= 0 && sent < packet.size())
+	{
+		ssize_t n = ::send(c.fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	stats.bytesOut += sent;
+	return sent == packet.size();
+}
+
+void MqttBroker::close(Connection& c, bool publishWill)
+{
+	if (c.fd < 0)
+		return;
+
+	::close(c.fd);
+	c.fd = -1;
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		--stats.clients;
+		++stats.disconnects;
+	}
+	if (publishWill && c.connected && !c.willTopic.empty())
+		publish(c.willTopic, c.willPayload, c.willRetain);
+	c.connected = false;
+}
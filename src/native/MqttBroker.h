@@ -0,0 +1,85 @@
+#ifndef MQTT_BROKER_H
+#define MQTT_BROKER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stand-in for the MQTT broker in host tests, on a thread of its own so
+// PubSubClient can wait for its answers. It speaks enough MQTT 3.1.1 for
+// the firmware: connect with last will, publish with retain, subscribe
+// with + and # wildcards, ping and disconnect, everything at QoS 0.
+// It counts what passes through it to show the load a fleet puts on a
+// broker.
+class MqttBroker
+{
+public:
+	struct Stats
+	{
+		uint32_t clients = 0;      // connected now
+		uint32_t peakClients = 0;
+		uint32_t connects = 0;     // CONNECTs accepted
+		uint32_t disconnects = 0;  // connections closed for any reason
+		uint32_t takeovers = 0;    // connections closed by a CONNECT with the same client id
+		uint64_t messagesIn = 0;   // PUBLISH received
+		uint64_t messagesOut = 0;  // PUBLISH sent to subscribers
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+		uint32_t retained = 0;     // topics with a retained message
+	};
+
+	MqttBroker() {}
+	~MqttBroker() { stop(); }
+
+	// listens on localhost, port 0 picks a free one
+	bool start(uint16_t port = 0);
+	void stop();
+	uint16_t getPort() const { return port; }
+
+	Stats getStats() const;
+	// closes all connections like a broker restart, the last wills
+	// are published
+	void dropClients() { dropRequested = true; }
+
+	// MQTT topic filter matching with + and #
+	static bool matches(const std::string& filter, const std::string& topic);
+
+private:
+	struct Connection
+	{
+		int fd = -1;
+		bool connected = false; // CONNECT received
+		std::string clientId;
+		std::vector<std::string> filters;
+		std::string willTopic;
+		std::string willPayload;
+		bool willRetain = false;
+		std::vector<uint8_t> input;
+	};
+
+	void run();
+	void accept();
+	bool receive(Connection& c);
+	bool handlePacket(Connection& c, uint8_t header, const uint8_t* data, size_t size);
+	void publish(const std::string& topic, const std::string& payload, bool retain);
+	bool send(Connection& c, uint8_t header, const uint8_t* data, size_t size);
+	void close(Connection& c, bool publishWill);
+
+	int listenFd = -1;
+	uint16_t port = 0;
+	std::thread thread;
+	std::atomic<bool> running { false };
+	std::atomic<bool> dropRequested { false };
+
+	std::vector<Connection> connections;
+	std::map<std::string, std::string> retained;
+
+	mutable std::mutex statsMutex;
+	Stats stats;
+};
+
+#endif
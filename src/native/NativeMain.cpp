@@ -0,0 +1,771 @@
+// Host program of env:native. Replays a capture file taken with
+// startCapture through the decoder and prints the state changes, or
+// drives the interrupt handlers with a simulated display bus.
+//
+//   program [-d dir] [-r capture] [-i seconds]
+//     -d  directory LittleFS paths are relative to (default .)
+//     -r  capture file to replay (default /capture.bin)
+//     -i  start the replay this far into the capture
+//
+//   program -s seconds [-c clockHz] [-f frames/s] [-j jitterUS]
+//           [-e bitErrorRate] [-k clockErrorRate] [-l loopUS]
+//     -s  simulate the bus for this long
+//     -c  bit clock (default 100000)
+//     -f  frames per second (default 2000)
+//     -j  largest random delay of a frame
+//     -e  probability of a flipped bit
+//     -k  probability of a missing or extra clock in a frame
+//     -l  time between loop() calls (default 1000)
+//     -o  record the frames to this capture file
+//
+//   program -m commands [bus options]
+//     -m  send random commands to an emulated main board and measure
+//         the time until they are confirmed on the display
+//
+//   program -g commands [bus options]
+//     -g  sweep the timing of these commands (power, heating, filter,
+//         bubbles, temp, units or all) with the CommandBenchmark of the
+//         firmware against an emulated main board and print its JSON
+//
+//   program -a hours [-w minutes] [-p port] [bus options]
+//     -a  run the firmware against the emulated main board for this long
+//         on a virtual clock, as fast as the host can
+//     -w  start millis() this many minutes before it wraps around
+//     -p  MQTT broker port on localhost (default 1, nothing listens)
+//
+//   program -v spas [-s seconds] [-p port] [-q commands/min] [-x seconds]
+//           [bus options]
+//     -v  run this many spas, each with its own MQTT client, in real time
+//         and measure the publish rate, command round trips and the load
+//         on the broker
+//     -s  how long (default 60)
+//     -p  MQTT broker port on localhost (default a stand-in broker)
+//     -q  commands per minute and spa (default 2)
+//     -x  drop all connections of the stand-in broker this often
+//
+//   program -b benchmarks [-t ms]
+//     -b  run the microbenchmarks whose name contains this, or all,
+//         and print the results as JSON
+//     -t  least time per benchmark (default 200)
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <NativeHal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "SpaState.h"
+#include "SpaMQTT.h"
+#include "Log.h"
+#include "Clock.h"
+#include "RetryBackoff.h"
+#include "DisplayBusSimulator.h"
+#include "MainBoardEmulator.h"
+#include "SpaBenchmark.h"
+#include "SpaFleet.h"
+
+SpaState state;
+Log logger;
+
+typedef SpaBusPins<13, 12, 14, 16> BusPins;
+
+// time between loop() calls
+static uint32_t loopMicros = 1000;
+// the millis() of the firmware in the soak test
+static VirtualClock firmwareClock;
+// print the state changes
+static bool quiet = false;
+
+class NativeAirTemperatureSensor : public AirTemperatureSensor
+{
+public:
+	virtual void begin() override {}
+	virtual int getDeviceCount() override { return 1; }
+	virtual uint32_t requestTemperature() override { return 750; }
+	virtual bool isConversionComplete() override { return true; }
+	virtual float getTemperature(bool celsius) override { return celsius ? 21.5f : 70.7f; }
+};
+
+class PrintListener : public SpaState::Listener
+{
+public:
+	virtual void handleSpaStateChange(const SpaState::ChangeEvent& c) override
+	{
+		String value;
+		switch (c.getType())
+		{
+		case SpaState::ChangeEvent::CHANGE_TYPE_POWER:
+			value = String("power ") + (state.getPowerEnabled() ? "on" : "off");
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_HEATING_ENABLED:
+			value = String("heating_enabled ") + (state.getHeatingEnabled() ? "true" : "false");
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_HEATING:
+			value = String("heating ") + (state.getIsHeating() ? "on" : "off");
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_FILTER:
+			value = String("filter ") + (state.getFilterEnabled() ? "on" : "off");
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_BUBBLES:
+			value = String("bubbles ") + (state.getBubblesEnabled() ? "on" : "off");
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_TARGET_TEMP:
+			value = "target_temp " + String(state.getTargetTemperature());
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_TEMP:
+			value = "temp " + String(state.getCurrentTemperature());
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_AIR_TEMP:
+			value = "air_temp " + String(state.getExternalTemperature());
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_TEMP_UNITS:
+			value = "temp_units " + state.getTemperatureUnitString();
+			break;
+		case SpaState::ChangeEvent::CHANGE_TYPE_RECONCILE:
+			value = "reconcile " + state.getReconciler().toJson();
+			break;
+		default:
+			return;
+		}
+		if (!quiet)
+			printf("%10.3f %s\n", millis() / 1000.0, value.c_str());
+	}
+};
+
+static int replay(const String& capture, uint32_t fromSeconds)
+{
+	if (!state.startReplay(capture, fromSeconds))
+	{
+		fprintf(stderr, "can not replay %s\n", capture.c_str());
+		return 1;
+	}
+
+	while (state.isReplaying())
+	{
+		state.loop();
+		NativeHal::advanceMicros(loopMicros);
+	}
+
+	printf("\n%s", state.toString().c_str());
+	printf("%s", state.getLatencyStats().toString().c_str());
+	return 0;
+}
+
+// The current temperature is shown steadily, every 10 seconds the
+// target temperature blinks for 3.5 seconds
+static int simulate(uint32_t seconds, const DisplayBusSimulator::Config& config)
+{
+	const int currentTemp = 38;
+	const int targetTemp = 40;
+	const uint32_t cycleMS = 10000;
+	const uint32_t blinkMS = 3500;
+
+	DisplayBusSimulator bus(BusPins::Clock::pin, BusPins::Latch::pin, BusPins::DataIn::pin, BusPins::DataOut::pin, config);
+	bus.setLEDs(bit(0) | bit(9) | bit(12)); // power, heater, filter
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::duration busTime(0);
+	Clock::duration loopTime(0);
+
+	uint64_t start = NativeHal::getMicros64();
+	uint64_t end = start + seconds * 1000000ULL;
+	while (NativeHal::getMicros64() < end)
+	{
+		uint32_t cycle = ((NativeHal::getMicros64() - start) / 1000) % cycleMS;
+		if (cycle < cycleMS - blinkMS)
+		{
+			bus.setText((String(currentTemp) + " C").c_str());
+			bus.setBlink(0);
+		}
+		else
+		{
+			bus.setText((String(targetTemp) + " C").c_str());
+			bus.setBlink(500);
+		}
+
+		Clock::time_point t0 = Clock::now();
+		bus.run(loopMicros);
+		Clock::time_point t1 = Clock::now();
+		state.loop();
+		loopTime += Clock::now() - t1;
+		busTime += t1 - t0;
+	}
+
+	const DisplayBusSimulator::Stats& sim = bus.getStats();
+	SpaState::BusStats stats = state.getBusStats();
+	double frames = sim.frames ? sim.frames : 1;
+	printf("\n%s", state.toString().c_str());
+	printf("%s", state.getLatencyStats().toString().c_str());
+	printf("\nSimulated %u s: %u frames (%u/s), %u refreshes\n",
+		seconds, sim.frames, sim.frames / seconds, sim.displayRefreshes);
+	printf("Injected errors: %u bits, %u short, %u long frames\n",
+		sim.bitErrors, sim.shortFrames, sim.longFrames);
+	printf("Ring buffer: peak %u/%u, dropped %u\n",
+		state.getFrameBufferHighWaterMark(), SPA_RING_BUFFER_SIZE, stats.droppedFrames);
+	printf("Decoded refreshes: %u, torn %u, unknown glyphs %u\n",
+		stats.displayFrames, stats.tornDisplayFrames, stats.unknownGlyphs);
+	printf("Host time: bus and interrupts %.0f ns/frame, loop() %.0f ns/frame\n",
+		std::chrono::duration<double, std::nano>(busTime).count() / frames,
+		std::chrono::duration<double, std::nano>(loopTime).count() / frames);
+	printf("Temperature: current %d (sent %d), target %d (sent %d)\n",
+		state.getCurrentTemperature(), currentTemp, state.getTargetTemperature(), targetTemp);
+	return 0;
+}
+
+static void runFor(DisplayBusSimulator& bus, uint32_t ms)
+{
+	uint32_t start = millis();
+	while (millis() - start < ms)
+	{
+		bus.run(loopMicros);
+		state.loop();
+	}
+}
+
+// Sends random commands through SpaState to the emulated main board and
+// measures the time until the board took them and the decoder shows it
+static int benchmarkCommands(uint32_t count, const DisplayBusSimulator::Config& config)
+{
+	enum CommandType { POWER, FILTER, HEATER, BUBBLES, TEMPERATURE, UNITS, WAKE, NUM_TYPES };
+	static const char* names[NUM_TYPES] = { "power", "filter", "heater", "bubbles", "temperature", "units", "wake" };
+	const uint32_t timeoutMS = 60000;
+
+	MainBoardEmulator board(BusPins::Clock::pin, BusPins::Latch::pin, BusPins::DataIn::pin, BusPins::DataOut::pin, config);
+	MainBoardEmulator::State initial;
+	initial.filter = true;
+	board.setState(initial);
+
+	// the decoder settles and the target temperature is probed after boot
+	runFor(board, 12000);
+
+	LatencyHistogram latency[NUM_TYPES];
+	uint32_t sent[NUM_TYPES] = {};
+	uint32_t confirmed[NUM_TYPES] = {};
+	std::mt19937 random(config.seed);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		CommandType type = (CommandType)(random() % NUM_TYPES);
+		const MainBoardEmulator::State& b = board.getState();
+		if (!b.power)
+			type = POWER;
+
+		bool wantBool = false;
+		int wantInt = 0;
+		switch (type)
+		{
+		case POWER:
+			wantBool = !state.getPowerEnabled();
+			state.setPowerEnabled(wantBool);
+			break;
+		case FILTER:
+			wantBool = !state.getFilterEnabled();
+			state.setFilterEnabled(wantBool);
+			break;
+		case HEATER:
+			wantBool = !state.getHeatingEnabled();
+			state.setHeatingEnabled(wantBool);
+			break;
+		case BUBBLES:
+			wantBool = !state.getBubblesEnabled();
+			state.setBubblesEnabled(wantBool);
+			break;
+		case TEMPERATURE:
+		{
+			int minTemp = SpaProtocol::minTemperature(state.getIsTempInC());
+			int maxTemp = SpaProtocol::maxTemperature(state.getIsTempInC());
+			do
+			{
+				wantInt = minTemp + random() % (maxTemp - minTemp + 1);
+			} while (wantInt == state.getTargetTemperature());
+			state.setTargetTemperature(wantInt);
+			break;
+		}
+		case UNITS:
+			wantBool = !state.getIsTempInC();
+			state.setTempInC(wantBool);
+			break;
+		case WAKE:
+			// as after 72 hours of heating
+			board.hibernate();
+			runFor(board, 1000);
+			wantBool = random() % 2;
+			state.wakeFromHibernation(wantBool);
+			break;
+		default:
+			break;
+		}
+
+		uint32_t start = millis();
+		while (state.getPendingCommandCount() > 0 && millis() - start < timeoutMS)
+		{
+			board.run(loopMicros);
+			state.loop();
+		}
+		uint32_t elapsed = millis() - start;
+
+		bool ok = false;
+		switch (type)
+		{
+		case POWER:
+			ok = b.power == wantBool && state.getPowerEnabled() == wantBool;
+			break;
+		case FILTER:
+			ok = b.filter == wantBool && state.getFilterEnabled() == wantBool;
+			break;
+		case HEATER:
+			ok = b.heater == wantBool && state.getHeatingEnabled() == wantBool;
+			break;
+		case BUBBLES:
+			ok = b.bubbles == wantBool && state.getBubblesEnabled() == wantBool;
+			break;
+		case TEMPERATURE:
+			ok = b.target == wantInt && state.getTargetTemperature() == wantInt;
+			break;
+		case UNITS:
+			ok = b.celsius == wantBool && state.getIsTempInC() == wantBool;
+			break;
+		case WAKE:
+			ok = !b.hibernating && !state.getIsHibernating() && b.filter && state.getFilterEnabled() &&
+				b.heater == wantBool && state.getHeatingEnabled() == wantBool;
+			break;
+		default:
+			break;
+		}
+
+		++sent[type];
+		if (ok)
+		{
+			++confirmed[type];
+			latency[type].record(elapsed);
+		}
+
+		// the board leaves the temperature setting mode
+		runFor(board, 6000);
+	}
+
+	printf("%-12s %6s %6s %8s %8s %8s\n", "command", "sent", "ok", "p50 ms", "p95 ms", "max ms");
+	for (int i = 0; i < NUM_TYPES; ++i)
+	{
+		printf("%-12s %6u %6u %8u %8u %8u\n", names[i], sent[i], confirmed[i],
+			latency[i].getPercentile(50), latency[i].getPercentile(95), latency[i].getMax());
+	}
+	printf("learned timing %s\n", state.getCommandTiming().toJson().c_str());
+	printf("button pulses sent %u, presses taken by the board %u\n", state.getBusStats().injectedPresses,
+		board.getPressCount(MainBoardEmulator::BUTTON_POWER) + board.getPressCount(MainBoardEmulator::BUTTON_UP) +
+		board.getPressCount(MainBoardEmulator::BUTTON_DOWN) + board.getPressCount(MainBoardEmulator::BUTTON_FILTER) +
+		board.getPressCount(MainBoardEmulator::BUTTON_HEATER) + board.getPressCount(MainBoardEmulator::BUTTON_BUBBLE) +
+		board.getPressCount(MainBoardEmulator::BUTTON_FC));
+	return 0;
+}
+
+// Runs the command benchmark of the firmware against the emulated main
+// board, the results are the JSON of GET /benchmark
+static int sweepCommands(const char* types, const DisplayBusSimulator::Config& config)
+{
+	MainBoardEmulator board(BusPins::Clock::pin, BusPins::Latch::pin, BusPins::DataIn::pin, BusPins::DataOut::pin, config);
+	MainBoardEmulator::State initial;
+	initial.filter = true;
+	board.setState(initial);
+	runFor(board, 12000);
+
+	CommandBenchmark::Config sweep;
+	sweep.types = CommandBenchmark::parseTypes(types);
+	if (!state.startBenchmark(sweep))
+	{
+		fprintf(stderr, "can not sweep %s\n", types);
+		return 1;
+	}
+	while (state.getBenchmark().isRunning())
+	{
+		board.run(loopMicros);
+		state.loop();
+	}
+	printf("%s\n", state.getBenchmark().toJson().c_str());
+	return 0;
+}
+
+static const char* onOff(bool b)
+{
+	return b ? "on" : "off";
+}
+
+// Sends random desired states to the emulated main board and checks
+// that the board ends up in them with the planned number of presses
+static int reconcileStates(uint32_t count, const DisplayBusSimulator::Config& config)
+{
+	MainBoardEmulator board(BusPins::Clock::pin, BusPins::Latch::pin, BusPins::DataIn::pin, BusPins::DataOut::pin, config);
+	MainBoardEmulator::State initial;
+	initial.filter = true;
+	board.setState(initial);
+	runFor(board, 12000);
+
+	std::mt19937 random(config.seed);
+	LatencyHistogram latency;
+	uint32_t converged = 0;
+	uint32_t boardDisagrees = 0;
+	uint32_t planned = 0;
+	uint32_t presses = 0;
+	uint32_t replans = 0;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		SpaReconciler::DesiredState desired;
+		bool power = random() % 4 != 0;
+		desired.set(SpaReconciler::FIELD_POWER, power);
+		if (power)
+		{
+			// the heater always comes with the filter
+			bool heater = random() % 2;
+			if (random() % 2)
+				desired.set(SpaReconciler::FIELD_HEATER, heater);
+			if (random() % 2)
+				desired.set(SpaReconciler::FIELD_FILTER, heater || random() % 2);
+			if (random() % 2)
+				desired.set(SpaReconciler::FIELD_BUBBLES, random() % 2);
+			if (random() % 4 == 0)
+				desired.set(SpaReconciler::FIELD_CELSIUS, random() % 2);
+			if (random() % 3 == 0)
+			{
+				bool celsius = (desired.fields & SpaReconciler::FIELD_CELSIUS) ?
+					(desired.switches & SpaReconciler::FIELD_CELSIUS) : state.getIsTempInC();
+				int minTemp = SpaProtocol::minTemperature(celsius);
+				int maxTemp = SpaProtocol::maxTemperature(celsius);
+				desired.setTarget(minTemp + random() % (maxTemp - minTemp + 1));
+			}
+		}
+
+		state.setDesiredState(desired);
+		while (state.getReconciler().isRunning())
+		{
+			board.run(loopMicros);
+			state.loop();
+		}
+		const SpaReconciler& reconciler = state.getReconciler();
+		if (SpaReconciler::STATUS_CONVERGED == reconciler.getStatus())
+		{
+			++converged;
+			latency.record(reconciler.getElapsedMS());
+		}
+		else
+		{
+			printf("%s\n", reconciler.toJson().c_str());
+		}
+
+		const MainBoardEmulator::State& b = board.getState();
+		const SpaReconciler::DesiredState& d = reconciler.getDesired();
+		bool agrees = b.power == state.getPowerEnabled() && b.filter == state.getFilterEnabled() &&
+			b.heater == state.getHeatingEnabled() && b.bubbles == state.getBubblesEnabled() &&
+			b.celsius == state.getIsTempInC() && (!(d.fields & SpaReconciler::FIELD_TARGET) || b.target == d.target);
+		if (!agrees)
+			++boardDisagrees;
+
+		planned += reconciler.getPlannedPresses();
+		presses += reconciler.getPresses();
+		replans += reconciler.getReplans();
+
+		// the board leaves the temperature setting mode
+		runFor(board, 6000);
+	}
+
+	printf("%u desired states, %u converged, board disagrees %u\n", count, converged, boardDisagrees);
+	printf("switch presses: planned %u, sent %u, replans %u\n", planned, presses, replans);
+	printf("time to converge: p50 %u ms, p95 %u ms, max %u ms\n",
+		latency.getPercentile(50), latency.getPercentile(95), latency.getMax());
+	return converged == count && 0 == boardDisagrees ? 0 : 1;
+}
+
+// Runs SpaState and SpaMQTT against the emulated main board for hours
+// of virtual time. The firmware clock follows the simulated bus time, so
+// the timers see the same passage of time as the interrupt handlers, and
+// it can start just before millis() wraps around. A command is sent
+// every 20 minutes, the broker never answers and WiFi never comes up.
+static int soak(uint32_t hours, uint32_t wrapMinutes, uint16_t port, const DisplayBusSimulator::Config& config)
+{
+	const uint32_t commandIntervalMS = 20 * 60000;
+	const uint64_t offsetMS = wrapMinutes ? 0x100000000ULL - wrapMinutes * 60000ULL : 0;
+
+	MainBoardEmulator board(BusPins::Clock::pin, BusPins::Latch::pin, BusPins::DataIn::pin, BusPins::DataOut::pin, config);
+	MainBoardEmulator::State initial;
+	initial.filter = true;
+	initial.heater = true;
+	initial.current = 30;
+	board.setState(initial);
+	board.setHeatingMinutesPerDegree(15);
+
+	SpaMQTT mqtt(&state);
+	mqtt.setServer("127.0.0.1", port);
+	mqtt.setClock(&firmwareClock);
+	RetryBackoff wifiRetry(30000, 60000, 960000);
+
+	std::mt19937 random(config.seed);
+	uint32_t commands = 0;
+	size_t peakCommands = 0;
+	size_t peakChanges = 0;
+	uint32_t wraps = 0;
+	uint32_t lastMS = firmwareClock.millis();
+	uint64_t nextCommandMS = commandIntervalMS;
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point t0 = Clock::now();
+
+	uint64_t end = NativeHal::getMicros64() + hours * 3600000000ULL;
+	while (NativeHal::getMicros64() < end)
+	{
+		board.run(loopMicros);
+		firmwareClock.set(offsetMS + NativeHal::getMicros64() / 1000);
+		uint32_t now = firmwareClock.millis();
+		if (now < lastMS)
+			++wraps;
+		lastMS = now;
+
+		state.loop();
+		mqtt.loop();
+		if (wifiRetry.isDue(now))
+			wifiRetry.attempted(now);
+
+		peakCommands = std::max(peakCommands, state.getPendingCommandCount());
+		peakChanges = std::max(peakChanges, mqtt.getPendingChangeCount());
+
+		if (firmwareClock.get() - offsetMS >= nextCommandMS)
+		{
+			nextCommandMS += commandIntervalMS;
+			++commands;
+			switch (random() % 5)
+			{
+			case 0:
+				state.setFilterEnabled(!state.getFilterEnabled());
+				break;
+			case 1:
+				state.setHeatingEnabled(!state.getHeatingEnabled());
+				break;
+			case 2:
+				state.setBubblesEnabled(!state.getBubblesEnabled());
+				break;
+			case 3:
+				state.setTargetTemperature(state.getIsTempInC() ? 30 + random() % 11 : 86 + random() % 19);
+				break;
+			default:
+				state.setTempInC(!state.getIsTempInC());
+				break;
+			}
+		}
+	}
+
+	// let the last command finish and the display settle
+	uint32_t start = millis();
+	uint32_t settled = 0;
+	while (millis() - start < 60000 && settled < 3000)
+	{
+		board.run(loopMicros);
+		firmwareClock.set(offsetMS + NativeHal::getMicros64() / 1000);
+		state.loop();
+		settled = state.getPendingCommandCount() > 0 ? 0 : settled + loopMicros / 1000;
+	}
+
+	double realSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+	const MainBoardEmulator::State& b = board.getState();
+	SpaState::BusStats stats = state.getBusStats();
+	bool match = b.power == state.getPowerEnabled() && b.filter == state.getFilterEnabled() &&
+		b.heater == state.getHeatingEnabled() && b.bubbles == state.getBubblesEnabled() &&
+		b.celsius == state.getIsTempInC() && b.target == state.getTargetTemperature() &&
+		b.current == state.getCurrentTemperature();
+
+	printf("\n%s", state.toString().c_str());
+	printf("\nSoaked %u h of spa time in %.1f s (%.0fx), millis() wrapped %u time(s)\n",
+		hours, realSeconds, hours * 3600 / realSeconds, wraps);
+	printf("Bus: %u frames, dropped %u, torn refreshes %u\n",
+		board.getStats().frames, stats.droppedFrames, stats.tornDisplayFrames);
+	printf("Commands: %u sent, peak queue %u, %u left\n",
+		commands, (unsigned)peakCommands, (unsigned)state.getPendingCommandCount());
+	printf("MQTT: peak pending changes %u\n", (unsigned)peakChanges);
+	printf("WiFi: %u reconnect attempts, interval now %u s\n",
+		wifiRetry.getAttempts(), wifiRetry.getInterval() / 1000);
+	printf("Board: power %s, filter %s, heater %s, bubbles %s, %d/%d %c\n",
+		onOff(b.power), onOff(b.filter), onOff(b.heater), onOff(b.bubbles),
+		b.current, b.target, b.celsius ? 'C' : 'F');
+	printf("Firmware and board %s\n", match ? "agree" : "DISAGREE");
+	return match ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	String capture = "/capture.bin";
+	uint32_t fromSeconds = 0;
+	String output;
+	uint32_t seconds = 0;
+	uint32_t commands = 0;
+	const char* sweep = nullptr;
+	uint32_t desiredStates = 0;
+	uint32_t hours = 0;
+	uint32_t wrapMinutes = 0;
+	uint16_t port = 1;
+	bool portSet = false;
+	uint32_t spas = 0;
+	SpaFleet::Config fleet;
+	const char* benchmarks = nullptr;
+	uint32_t benchmarkMS = 200;
+	bool frameRateSet = false;
+	bool loopMicrosSet = false;
+	DisplayBusSimulator::Config config;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:r:i:o:s:m:g:n:a:w:p:v:q:x:b:t:c:f:j:e:k:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'd':
+			LittleFS.setRoot(optarg);
+			break;
+		case 'r':
+			capture = optarg;
+			break;
+		case 'i':
+			fromSeconds = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			commands = atoi(optarg);
+			break;
+		case 'g':
+			sweep = optarg;
+			break;
+		case 'n':
+			desiredStates = atoi(optarg);
+			break;
+		case 'a':
+			hours = atoi(optarg);
+			break;
+		case 'w':
+			wrapMinutes = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			portSet = true;
+			break;
+		case 'v':
+			spas = atoi(optarg);
+			break;
+		case 'q':
+			fleet.commandsPerMinute = atoi(optarg);
+			break;
+		case 'x':
+			fleet.dropSeconds = atoi(optarg);
+			break;
+		case 'b':
+			benchmarks = optarg;
+			break;
+		case 't':
+			benchmarkMS = atoi(optarg);
+			break;
+		case 'c':
+			config.clockHz = atoi(optarg);
+			break;
+		case 'f':
+			config.frameRate = atoi(optarg);
+			frameRateSet = true;
+			break;
+		case 'j':
+			config.jitterNanos = atoi(optarg) * 1000;
+			break;
+		case 'e':
+			config.bitErrorRate = atof(optarg);
+			break;
+		case 'k':
+			config.clockErrorRate = atof(optarg);
+			break;
+		case 'l':
+			loopMicros = atoi(optarg);
+			loopMicrosSet = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-r capture] [-i seconds]\n"
+				"       %s -s seconds [-c clockHz] [-f frames/s] [-j jitterUS] "
+				"[-e bitErrorRate] [-k clockErrorRate] [-l loopUS] [-o capture]\n"
+				"       %s -m commands [bus options]\n"
+				"       %s -g commands [bus options]\n"
+				"       %s -n states [bus options]\n"
+				"       %s -a hours [-w minutes] [-p port] [bus options]\n"
+				"       %s -v spas [-s seconds] [-p port] [-q commands/min] [-x seconds] [bus options]\n"
+				"       %s -b benchmarks [-t ms]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	if (benchmarks)
+		return SpaBenchmark::run(benchmarks, benchmarkMS, stdout);
+
+	if (spas > 0 && optind == argc)
+	{
+		fleet.spas = spas;
+		// fewer frames like the soak test, many buses run at once
+		fleet.bus = config;
+		if (!frameRateSet)
+			fleet.bus.frameRate = 500;
+		fleet.loopMicros = loopMicrosSet ? loopMicros : 4000;
+		if (seconds > 0)
+			fleet.seconds = seconds;
+		fleet.port = portSet ? port : 0;
+		return SpaFleet::run(fleet, stdout);
+	}
+
+	NativeHal::setMicros(0);
+
+	if (hours > 0)
+	{
+		// fewer frames and loop() calls, the board still scans the
+		// buttons often enough for the commands
+		if (!frameRateSet)
+			config.frameRate = 500;
+		if (!loopMicrosSet)
+			loopMicros = 4000;
+		if (wrapMinutes)
+			firmwareClock.set(0x100000000ULL - wrapMinutes * 60000ULL);
+		state.setClock(&firmwareClock);
+	}
+
+	NativeAirTemperatureSensor airTemperatureSensor;
+	PrintListener listener;
+	state.addListener(&listener);
+	state.setAirTemperatureSensor(&airTemperatureSensor);
+	state.init<BusPins>();
+
+	if (0 == seconds && 0 == commands && !sweep && 0 == desiredStates && 0 == hours)
+		return replay(capture, fromSeconds);
+
+	if (output.length() && !state.startCapture(output))
+	{
+		fprintf(stderr, "can not record to %s\n", output.c_str());
+		return 1;
+	}
+
+	int result;
+	quiet = true;
+	if (seconds > 0)
+		result = simulate(seconds, config);
+	else if (commands > 0)
+		result = benchmarkCommands(commands, config);
+	else if (sweep)
+		result = sweepCommands(sweep, config);
+	else if (desiredStates > 0)
+		result = reconcileStates(desiredStates, config);
+	else
+		result = soak(hours, wrapMinutes, port, config);
+
+	if (output.length())
+	{
+		state.stopCapture();
+		printf("Capture: %u frames, %u bytes\n", state.getCaptureRecordCount(), state.getCaptureBytes());
+	}
+	return result;
+}
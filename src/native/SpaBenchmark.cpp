@@ -0,0 +1,278 @@
+#include "SpaBenchmark.h"
+
+#include <NativeHal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "SpaState.h"
+#include "SpaMQTT.h"
+#include "Log.h"
+#include "DisplayFrame.h"
+#include "SegmentDecoder.h"
+#include "AllocationCounter.h"
+
+// runs the operation the given number of times
+typedef std::function<void(uint64_t)> Operation;
+
+struct Benchmark
+{
+	const char* name;
+	Operation operation;
+};
+
+static std::vector<Benchmark> benchmarks;
+
+// keeps results alive so the operations are not optimized away
+static volatile uint32_t sink = 0;
+
+// the display shows 38 C, after 600 refreshes the target temperature
+// 40 C blinks for 400 refreshes
+static const uint32_t displayCycle = 1000;
+static const uint32_t refreshMicros = 6000;
+
+static const char* displayText(uint32_t refresh)
+{
+	uint32_t r = refresh % displayCycle;
+	if (r < 600)
+		return "38 C";
+	return ((r - 600) / 83) % 2 ? "    " : "40 C";
+}
+
+static uint16_t digitFrame(const char* text, int slot)
+{
+	uint16_t frame = 0xFFFF;
+	SegmentDecoder::encode(text[slot], frame);
+	return frame & ~DisplayFrame::selectMask(slot);
+}
+
+class CountingListener : public SpaState::Listener
+{
+public:
+	virtual void handleSpaStateChange(const SpaState::ChangeEvent& c) override { ++count; }
+	uint32_t count = 0;
+};
+
+
+void SpaBenchmark::addDecoderBenchmarks()
+{
+	// frames on the bus in one scan cycle: the four digits, the LEDs of
+	// power, filter and heater, and the seven button scans
+	std::shared_ptr<std::vector<uint16_t>> frames(new std::vector<uint16_t>);
+	std::shared_ptr<SpaState> state(new SpaState);
+	for (uint32_t refresh = 0; refresh < displayCycle; ++refresh)
+	{
+		const char* text = displayText(refresh);
+		for (int slot = 0; slot < 4; ++slot)
+			frames->push_back(digitFrame(text, slot));
+		frames->push_back(0xFFFF & ~DisplayFrame::selectMask(DisplayFrame::SLOT_LEDS) & ~(bit(0) | bit(9) | bit(12)));
+		for (int button = 0; button < 7; ++button)
+			frames->push_back((uint16_t)state->buttonCodes[button]);
+	}
+
+	// one frame from the ring buffer through the decoder, the frames
+	// are pushed in batches like the latch interrupt would
+	benchmarks.push_back({ "processMessages", [frames, state](uint64_t n) {
+		size_t next = 0;
+		while (n > 0)
+		{
+			uint32_t batch = n < 32 ? n : 32;
+			uint32_t cycles = ESP.getCycleCount();
+			for (uint32_t i = 0; i < batch; ++i)
+			{
+				SpaState::BusFrame frame = { (*frames)[next], false, cycles };
+				state->ringBuffer.push(frame);
+				next = (next + 1) % frames->size();
+			}
+			state->processMessages();
+			n -= batch;
+		}
+		sink = state->getCurrentTemperature();
+	}});
+
+	benchmarks.push_back({ "readSegment", [frames, state](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			// the digit frames of the first refreshes
+			int slot = i % 4;
+			state->readSegment((*frames)[(i / 4 % 100) * 12 + slot], slot);
+		}
+		sink = state->digit[0];
+	}});
+
+	std::shared_ptr<std::vector<std::string>> texts(new std::vector<std::string>);
+	for (uint32_t refresh = 0; refresh < displayCycle; ++refresh)
+		texts->push_back(displayText(refresh));
+
+	benchmarks.push_back({ "classifyTemperature", [texts, state](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			memcpy(state->digit, (*texts)[i % displayCycle].c_str(), 4);
+			state->classifyTemperature(i * refreshMicros);
+		}
+		sink = state->getTargetTemperature();
+	}});
+}
+
+void SpaBenchmark::addLogBenchmarks()
+{
+	benchmarks.push_back({ "Log::addLine", [](uint64_t n) {
+		Log log;
+		String line = "MQTT Connect...fail, rc=-2";
+		for (uint64_t i = 0; i < n; ++i)
+			log.addLine(line);
+	}});
+
+	// the web page reads the full log
+	benchmarks.push_back({ "Log::getLines", [](uint64_t n) {
+		Log log;
+		for (int i = 0; i < 40; ++i)
+			log.addLine("Replay finished: " + String(i * 1000) + " frames");
+		for (uint64_t i = 0; i < n; ++i)
+			sink = log.getLines().length();
+	}});
+}
+
+void SpaBenchmark::addDispatchBenchmarks()
+{
+	static const int listenerCounts[] = { 1, 4 };
+	for (int listeners : listenerCounts)
+	{
+		std::shared_ptr<SpaState> state(new SpaState);
+		std::shared_ptr<std::vector<CountingListener>> counting(new std::vector<CountingListener>(listeners));
+		for (CountingListener& l : *counting)
+			state->addListener(&l);
+
+		benchmarks.push_back({ listeners == 1 ? "emitChange/1 listener" : "emitChange/4 listeners",
+			[state, counting](uint64_t n) {
+			for (uint64_t i = 0; i < n; ++i)
+				state->emitChange(SpaState::ChangeEvent::CHANGE_TYPE_TEMP);
+			sink = (*counting)[0].count;
+		}});
+
+		// changes decoded from a frame carry its timing
+		benchmarks.push_back({ listeners == 1 ? "emitChange traced/1 listener" : "emitChange traced/4 listeners",
+			[state, counting](uint64_t n) {
+			state->frameTraced = true;
+			state->frameLatchMicros = micros();
+			state->framePopMicros = state->frameLatchMicros;
+			state->refreshLatchMicros = state->frameLatchMicros;
+			for (uint64_t i = 0; i < n; ++i)
+				state->emitChange(SpaState::ChangeEvent::CHANGE_TYPE_TEMP);
+			state->frameTraced = false;
+			sink = (*counting)[0].count;
+		}});
+	}
+}
+
+void SpaBenchmark::addMQTTBenchmarks()
+{
+	std::shared_ptr<SpaState> state(new SpaState);
+	std::shared_ptr<SpaMQTT> mqtt(new SpaMQTT(state.get()));
+	mqtt->setName("IntexSpa-233c21");
+
+	benchmarks.push_back({ "SpaMQTT::formatChange", [state, mqtt](uint64_t n) {
+		String topic;
+		String payload;
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			SpaState::ChangeEvent::ChangeType type = (SpaState::ChangeEvent::ChangeType)
+				(SpaState::ChangeEvent::CHANGE_TYPE_POWER + i % (SpaState::ChangeEvent::CHANGE_TYPE_FENCE - 1));
+			mqtt->formatChange(type, topic, payload);
+		}
+		sink = payload.length();
+	}});
+
+	benchmarks.push_back({ "SpaMQTT::getHAAction", [state, mqtt](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+			sink = mqtt->getHAAction().length();
+	}});
+
+	benchmarks.push_back({ "SpaMQTT::getDiagnostics", [state, mqtt](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+			sink = mqtt->getDiagnostics().length();
+	}});
+}
+
+void SpaBenchmark::addCommandBenchmarks()
+{
+	std::shared_ptr<SpaState> state(new SpaState);
+
+	// the loop() of a command between its press and the display, the
+	// time stands still so the timeout does not pass
+	auto processWaiting = [](SpaState& state, SpaState::Command& command, uint64_t n) {
+		const uint32_t now = 100000;
+		command.process(state, now);
+		state.btnRequest = 0;
+		for (uint64_t i = 0; i < n; ++i)
+			command.process(state, now);
+		sink = command.isFinished();
+	};
+
+	benchmarks.push_back({ "Command::process/switch waits", [state, processWaiting](uint64_t n) {
+		SpaState::Command command(SpaState::Command::COMMAND_SET_FILTER, true);
+		processWaiting(*state, command, n);
+	}});
+
+	benchmarks.push_back({ "Command::process/temperature waits", [state, processWaiting](uint64_t n) {
+		SpaState::Command command(SpaState::Command::COMMAND_SET_TEMPERATURE, 30);
+		processWaiting(*state, command, n);
+	}});
+}
+
+
+int SpaBenchmark::run(const char* filter, uint32_t minMS, FILE* out)
+{
+	// Log::addLine echoes to Serial in debug builds
+	NativeHal::setSerialOutput(nullptr);
+
+	benchmarks.clear();
+	addDecoderBenchmarks();
+	addLogBenchmarks();
+	addDispatchBenchmarks();
+	addMQTTBenchmarks();
+	addCommandBenchmarks();
+
+	bool all = strcmp(filter, "all") == 0;
+	const double minNanos = minMS * 1e6;
+	bool first = true;
+
+	fprintf(out, "{\"compiler\":\"%s\",\"min_ms\":%u,\"benchmarks\":[", __VERSION__, minMS);
+	for (const Benchmark& b : benchmarks)
+	{
+		if (!all && !strstr(b.name, filter))
+			continue;
+
+		// double the iterations until the run is long enough
+		uint64_t iterations = 1;
+		double nanos = 0;
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+		for (;;)
+		{
+			uint64_t startCount = AllocationCounter::getCount();
+			uint64_t startBytes = AllocationCounter::getBytes();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			b.operation(iterations);
+			nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			allocations = AllocationCounter::getCount() - startCount;
+			bytes = AllocationCounter::getBytes() - startBytes;
+			if (nanos >= minNanos)
+				break;
+			iterations *= nanos * 10 < minNanos ? 10 : 2;
+		}
+
+		fprintf(out, "%s\n{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f}",
+			first ? "" : ",", b.name, (unsigned long long)iterations, nanos / iterations,
+			(double)allocations / iterations, (double)bytes / iterations);
+		first = false;
+	}
+	fprintf(out, "\n]}\n");
+
+	benchmarks.clear();
+	NativeHal::setSerialOutput(stdout);
+	return 0;
+}
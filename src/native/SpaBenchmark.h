@@ -0,0 +1,25 @@
+#ifndef SPA_BENCHMARK_H
+#define SPA_BENCHMARK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Microbenchmarks of the hot paths of loop() on the host. Each benchmark
+// is repeated until it ran for at least minMS, then its time and heap
+// allocations per operation are written as JSON, so the results of two
+// commits can be compared.
+class SpaBenchmark
+{
+public:
+	// runs the benchmarks whose name contains filter, all for "all"
+	static int run(const char* filter, uint32_t minMS, FILE* out);
+
+private:
+	static void addDecoderBenchmarks();
+	static void addLogBenchmarks();
+	static void addDispatchBenchmarks();
+	static void addMQTTBenchmarks();
+	static void addCommandBenchmarks();
+};
+
+#endif
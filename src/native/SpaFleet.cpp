@@ -0,0 +1,400 @@
+#include "SpaFleet.h"
+
+#include <Arduino.h>
+#include <NativeHal.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpaState.h"
+#include "SpaMQTT.h"
+#include "LatencyStats.h"
+#include "MainBoardEmulator.h"
+#include "MqttBroker.h"
+
+// the same pins on every board
+typedef SpaBusPins<13, 12, 14, 16> FleetPins;
+
+typedef std::chrono::steady_clock HostClock;
+
+static uint64_t hostMicros(HostClock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(HostClock::now() - start).count();
+}
+
+struct VirtualSpa
+{
+	VirtualSpa(const DisplayBusSimulator::Config& config) :
+		board(FleetPins::Clock::pin, FleetPins::Latch::pin, FleetPins::DataIn::pin, FleetPins::DataOut::pin, config),
+		mqtt(&state)
+	{
+	}
+
+	SpaState state;
+	MainBoardEmulator board;
+	SpaMQTT mqtt;
+	String name;
+
+	// the command in flight, confirmed by this topic and payload
+	bool commandPending = false;
+	std::string expectTopic;
+	std::string expectPayload;
+	uint64_t commandSentMicros = 0;
+
+	uint64_t nextCommandMS = 0;
+	uint64_t nextDriftMS = 0;
+};
+
+// Home Assistant's side: sees every publish of the fleet and sends the
+// commands
+class FleetController
+{
+public:
+	FleetController(const String& host, uint16_t port) :
+		server(host)
+	{
+		instance = this;
+		client.setClient(wifiClient);
+		// PubSubClient keeps the pointer
+		client.setServer(server.c_str(), port);
+		client.setCallback(&FleetController::callback);
+		client.setBufferSize(1024);
+	}
+
+	bool connect()
+	{
+		if (client.connected())
+			return true;
+		if (!client.connect("fleet-controller"))
+			return false;
+		++connects;
+		return client.subscribe("#");
+	}
+
+	void loop()
+	{
+		if (connect())
+			client.loop();
+	}
+
+	bool publish(const std::string& topic, const std::string& payload)
+	{
+		return client.publish(topic.c_str(), payload.c_str());
+	}
+
+	// the last payload of a topic, empty if none was seen
+	const std::string& get(const std::string& topic) { return latest[topic]; }
+
+	std::vector<std::unique_ptr<VirtualSpa>>* spas = nullptr;
+	HostClock::time_point start;
+	LatencyHistogram roundTrip;
+	uint32_t confirmed = 0;
+	uint64_t received = 0;
+	uint32_t connects = 0;
+
+private:
+	static void callback(char* topic, uint8_t* payload, unsigned int length)
+	{
+		instance->receive(topic, std::string((const char*)payload, length));
+	}
+
+	void receive(const std::string& topic, const std::string& payload)
+	{
+		++received;
+		latest[topic] = payload;
+
+		// spaN/...
+		if (topic.compare(0, 3, "spa") != 0 || !spas)
+			return;
+		size_t index = strtoul(topic.c_str() + 3, nullptr, 10);
+		if (index >= spas->size())
+			return;
+		VirtualSpa& spa = *(*spas)[index];
+		if (spa.commandPending && topic == spa.expectTopic && payload == spa.expectPayload)
+		{
+			spa.commandPending = false;
+			roundTrip.record(hostMicros(start) - spa.commandSentMicros);
+			++confirmed;
+		}
+	}
+
+	static FleetController* instance;
+	String server;
+	WiFiClient wifiClient;
+	PubSubClient client;
+	std::map<std::string, std::string> latest;
+};
+
+FleetController* FleetController::instance = nullptr;
+
+static std::string toggled(const std::string& value, const char* on, const char* off)
+{
+	return value == on ? off : on;
+}
+
+// sends a random command that changes the state the controller knows
+static void sendCommand(FleetController& controller, VirtualSpa& spa, std::mt19937& random, uint64_t nowMicros)
+{
+	std::string prefix = spa.name.c_str();
+	std::string setting;
+	std::string value;
+
+	std::string power = controller.get(prefix + "power");
+	if (power.empty())
+		return;
+	int choice = "off" == power ? 0 : random() % 5;
+	switch (choice)
+	{
+	case 0:
+		setting = "power";
+		value = toggled(power, "on", "off");
+		break;
+	case 1:
+		setting = "filter";
+		value = toggled(controller.get(prefix + setting), "on", "off");
+		break;
+	case 2:
+		setting = "bubbles";
+		value = toggled(controller.get(prefix + setting), "on", "off");
+		break;
+	case 3:
+		setting = "heating_enabled";
+		value = toggled(controller.get(prefix + setting), "true", "false");
+		break;
+	default:
+	{
+		setting = "target_temp";
+		bool celsius = controller.get(prefix + "temp_units") != "F";
+		int minTemp = SpaProtocol::minTemperature(celsius);
+		int maxTemp = SpaProtocol::maxTemperature(celsius);
+		std::string current = controller.get(prefix + setting);
+		do
+		{
+			value = std::to_string(minTemp + random() % (maxTemp - minTemp + 1));
+		} while (value == current);
+		break;
+	}
+	}
+
+	if (!controller.publish(prefix + setting + "/set", value))
+		return;
+	spa.commandPending = true;
+	spa.expectTopic = prefix + setting;
+	spa.expectPayload = value;
+	spa.commandSentMicros = nowMicros;
+}
+
+int SpaFleet::run(const Config& config, FILE* out)
+{
+	const uint32_t commandTimeoutMS = 60000;
+	const uint32_t driftMinMS = 30000;
+	const uint32_t driftMaxMS = 120000;
+
+	MqttBroker broker;
+	uint16_t port = config.port;
+	if (0 == port)
+	{
+		if (!broker.start())
+		{
+			fprintf(stderr, "can not start the broker\n");
+			return 1;
+		}
+		port = broker.getPort();
+	}
+	bool standIn = 0 == config.port;
+
+	// the firmware logs every connect, the fleet would flood the output
+	NativeHal::setSerialOutput(nullptr);
+	NativeHal::setMicros(0);
+
+	std::mt19937 random(config.bus.seed);
+	uint32_t commandIntervalMS = config.commandsPerMinute ? 60000 / config.commandsPerMinute : 0;
+
+	std::vector<std::unique_ptr<VirtualSpa>> spas;
+	for (uint32_t i = 0; i < config.spas; ++i)
+	{
+		DisplayBusSimulator::Config bus = config.bus;
+		bus.seed = config.bus.seed + i;
+		spas.push_back(std::unique_ptr<VirtualSpa>(new VirtualSpa(bus)));
+		VirtualSpa& spa = *spas.back();
+
+		MainBoardEmulator::State initial;
+		initial.filter = random() % 2;
+		initial.heater = random() % 2;
+		initial.current = 25 + random() % 14;
+		initial.target = 30 + random() % 11;
+		spa.board.setState(initial);
+		spa.board.setHeatingMinutesPerDegree(15);
+
+		spa.name = "spa" + String(i);
+		spa.mqtt.setName(spa.name);
+		spa.name += "/";
+		spa.mqtt.setServer("127.0.0.1", port);
+
+		NativeHal::selectBoard(i);
+		spa.state.init<FleetPins>();
+
+		// spread the commands and the drift over their intervals
+		spa.nextCommandMS = commandIntervalMS ? 15000 + random() % commandIntervalMS : UINT64_MAX;
+		spa.nextDriftMS = driftMinMS + random() % (driftMaxMS - driftMinMS);
+	}
+
+	FleetController controller("127.0.0.1", port);
+	controller.spas = &spas;
+
+	uint32_t commands = 0;
+	uint32_t timeouts = 0;
+	size_t peakChanges = 0;
+	uint32_t peakPublishRate = 0;
+	uint64_t lastSecondReceived = 0;
+	uint64_t nextSecondMS = 1000;
+	uint64_t maxLagMicros = 0;
+
+	uint32_t storms = 0;
+	bool recovering = false;
+	uint32_t disconnectsBeforeDrop = 0;
+	uint64_t dropMicros = 0;
+	LatencyHistogram recovery;
+	uint64_t nextDropMS = config.dropSeconds && standIn ? config.dropSeconds * 1000ULL : UINT64_MAX;
+
+	HostClock::time_point start = HostClock::now();
+	controller.start = start;
+	uint64_t endMicros = config.seconds * 1000000ULL;
+	while (NativeHal::getMicros64() < endMicros)
+	{
+		uint64_t stepStart = NativeHal::getMicros64();
+		for (uint32_t i = 0; i < spas.size(); ++i)
+		{
+			NativeHal::selectBoard(i);
+			NativeHal::setMicros(stepStart);
+			spas[i]->board.run(config.loopMicros);
+		}
+		uint64_t nowMicros = stepStart + config.loopMicros;
+		NativeHal::setMicros(nowMicros);
+		uint64_t nowMS = nowMicros / 1000;
+
+		uint32_t connected = 0;
+		for (uint32_t i = 0; i < spas.size(); ++i)
+		{
+			VirtualSpa& spa = *spas[i];
+			NativeHal::selectBoard(i);
+			spa.state.loop();
+			spa.mqtt.loop();
+			peakChanges = std::max(peakChanges, spa.mqtt.getPendingChangeCount());
+			if (spa.mqtt.isConnected())
+				++connected;
+
+			if (nowMS >= spa.nextDriftMS)
+			{
+				// the water cools down or warms up by a degree
+				spa.nextDriftMS = nowMS + driftMinMS + random() % (driftMaxMS - driftMinMS);
+				MainBoardEmulator::State s = spa.board.getState();
+				s.current += random() % 2 ? 1 : -1;
+				spa.board.setState(s);
+			}
+		}
+
+		controller.loop();
+		uint64_t host = hostMicros(start);
+		for (std::unique_ptr<VirtualSpa>& spa : spas)
+		{
+			if (spa->commandPending && host - spa->commandSentMicros > commandTimeoutMS * 1000ULL)
+			{
+				spa->commandPending = false;
+				++timeouts;
+			}
+			if (nowMS >= spa->nextCommandMS)
+			{
+				spa->nextCommandMS = nowMS + commandIntervalMS / 2 + random() % commandIntervalMS;
+				if (!spa->commandPending)
+				{
+					sendCommand(controller, *spa, random, host);
+					commands += spa->commandPending;
+				}
+			}
+		}
+
+		if (nowMS >= nextSecondMS)
+		{
+			nextSecondMS += 1000;
+			peakPublishRate = std::max<uint32_t>(peakPublishRate, controller.received - lastSecondReceived);
+			lastSecondReceived = controller.received;
+		}
+
+		if (nowMS >= nextDropMS && nowMicros < endMicros)
+		{
+			nextDropMS += config.dropSeconds * 1000ULL;
+			disconnectsBeforeDrop = broker.getStats().disconnects;
+			broker.dropClients();
+			dropMicros = host;
+			recovering = true;
+			++storms;
+		}
+		else if (recovering && connected == spas.size() &&
+			broker.getStats().disconnects >= disconnectsBeforeDrop + spas.size())
+		{
+			recovering = false;
+			recovery.record(host - dropMicros);
+		}
+
+		// keep to real time
+		host = hostMicros(start);
+		if (host < nowMicros)
+			std::this_thread::sleep_for(std::chrono::microseconds(nowMicros - host));
+		else
+			maxLagMicros = std::max(maxLagMicros, host - nowMicros);
+	}
+
+	uint32_t dropped = 0;
+	uint32_t torn = 0;
+	uint32_t agree = 0;
+	for (uint32_t i = 0; i < spas.size(); ++i)
+	{
+		VirtualSpa& spa = *spas[i];
+		SpaState::BusStats stats = spa.state.getBusStats();
+		dropped += stats.droppedFrames;
+		torn += stats.tornDisplayFrames;
+		const MainBoardEmulator::State& b = spa.board.getState();
+		agree += b.power == spa.state.getPowerEnabled() && b.filter == spa.state.getFilterEnabled() &&
+			b.heater == spa.state.getHeatingEnabled() && b.bubbles == spa.state.getBubblesEnabled() &&
+			b.current == spa.state.getCurrentTemperature();
+	}
+	NativeHal::selectBoard(0);
+	NativeHal::setSerialOutput(stdout);
+
+	double seconds = config.seconds;
+	fprintf(out, "Fleet: %u spas for %u s against %s on port %u, lagged real time by up to %.1f ms\n",
+		(unsigned)spas.size(), config.seconds, standIn ? "the stand-in broker" : "the broker", port, maxLagMicros / 1000.0);
+	fprintf(out, "Publishes: %.1f/s seen by the controller, peak %u in one second\n",
+		controller.received / seconds, peakPublishRate);
+	fprintf(out, "Commands: %u sent, %u confirmed, %u timed out, round trip ms avg %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+		commands, controller.confirmed, timeouts,
+		controller.roundTrip.getAverage() / 1000.0, controller.roundTrip.getPercentile(50) / 1000.0,
+		controller.roundTrip.getPercentile(90) / 1000.0, controller.roundTrip.getPercentile(99) / 1000.0,
+		controller.roundTrip.getMax() / 1000.0);
+	if (standIn)
+	{
+		MqttBroker::Stats b = broker.getStats();
+		fprintf(out, "Broker: peak %u clients, %u connects, %u disconnects, %u takeovers, %u retained topics\n",
+			b.peakClients, b.connects, b.disconnects, b.takeovers, b.retained);
+		fprintf(out, "Broker load: %.1f messages/s in, %.1f/s out, %.1f kB/s in, %.1f kB/s out\n",
+			b.messagesIn / seconds, b.messagesOut / seconds, b.bytesIn / seconds / 1000, b.bytesOut / seconds / 1000);
+	}
+	if (storms)
+	{
+		fprintf(out, "Reconnect storms: %u, all spas back after ms avg %.1f max %.1f, %u not recovered\n",
+			storms, recovery.getAverage() / 1000.0, recovery.getMax() / 1000.0, storms - recovery.getCount());
+	}
+	fprintf(out, "Spas: %u frames dropped, %u torn refreshes, peak pending changes %u, %u of %u agree with their board\n",
+		dropped, torn, (unsigned)peakChanges, agree, (unsigned)spas.size());
+	return 0;
+}
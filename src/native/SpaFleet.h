@@ -0,0 +1,33 @@
+#ifndef SPA_FLEET_H
+#define SPA_FLEET_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "DisplayBusSimulator.h"
+
+// Load test of many spas against one MQTT broker. Each virtual spa is
+// a SpaState and a SpaMQTT with its own device name, driven by its own
+// emulated main board on a NativeHal board of its own. The water
+// temperature drifts, and a controller client sends commands like Home
+// Assistant does and times them until the spa publishes the new state.
+// The fleet runs in real time, so the broker sees the publish rate and
+// the reconnects of the real fleet.
+class SpaFleet
+{
+public:
+	struct Config
+	{
+		uint32_t spas = 10;
+		uint32_t seconds = 60;
+		uint16_t port = 0;              // broker on localhost, 0 starts the stand-in
+		uint32_t commandsPerMinute = 2; // per spa
+		uint32_t dropSeconds = 0;       // the stand-in drops all connections this often
+		uint32_t loopMicros = 4000;     // time between loop() calls
+		DisplayBusSimulator::Config bus;
+	};
+
+	static int run(const Config& config, FILE* out);
+};
+
+#endif